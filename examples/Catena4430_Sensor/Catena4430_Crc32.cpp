@@ -0,0 +1,45 @@
+/*
+
+Module: Catena4430_Crc32.cpp
+
+Function:
+    cCrc32::update()
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#include "Catena4430_Crc32.h"
+
+using namespace McciCatena4430;
+
+// CRC of each nibble value, reflected polynomial 0xEDB88320.
+static const std::uint32_t kCrcNibbleTable[16] =
+    {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+
+void
+cCrc32::update(
+    const std::uint8_t *pBuffer,
+    size_t nBuffer
+    )
+    {
+    std::uint32_t crc = this->m_crc;
+
+    for (size_t i = 0; i < nBuffer; ++i)
+        {
+        crc ^= pBuffer[i];
+        crc = (crc >> 4) ^ kCrcNibbleTable[crc & 0xF];
+        crc = (crc >> 4) ^ kCrcNibbleTable[crc & 0xF];
+        }
+
+    this->m_crc = crc;
+    }
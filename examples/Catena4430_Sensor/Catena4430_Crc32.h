@@ -0,0 +1,56 @@
+/*
+
+Module: Catena4430_Crc32.h
+
+Function:
+    Streaming CRC-32 (IEEE 802.3, as used by zip and PNG).
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena4430_Crc32_h_
+# define _Catena4430_Crc32_h_
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace McciCatena4430 {
+
+/*
+
+Overview:
+    cCrc32 computes the CRC of a stream a buffer at a time, so it can run over a
+    file as it's streamed. It uses a 16-entry table (a nibble at a time),
+    which is a good trade of flash space for speed on a Cortex-M0+.
+
+    The result matches zlib's crc32(), so host tools can use that.
+
+*/
+
+class cCrc32
+    {
+public:
+    void begin()
+        {
+        this->m_crc = 0xFFFFFFFFu;
+        }
+    void update(const std::uint8_t *pBuffer, size_t nBuffer);
+    std::uint32_t get() const
+        {
+        return ~this->m_crc;
+        }
+
+private:
+    std::uint32_t   m_crc = 0xFFFFFFFFu;
+    };
+
+} // namespace McciCatena4430
+
+#endif /* _Catena4430_Crc32_h_ */
@@ -0,0 +1,57 @@
+/*
+
+Module: Catena4430_FramLayout.h
+
+Function:
+    Layout of the application's area in FRAM.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena4430_FramLayout_h_
+# define _Catena4430_FramLayout_h_
+
+#pragma once
+
+#include <cstdint>
+
+namespace McciCatena4430 {
+
+/*
+
+Overview:
+    The platform's cFramStorage keeps its keyed objects at the bottom of
+    the FRAM, and uses well under 1 KiB. The sketch keeps its own data at
+    the top of the FRAM, addressed directly with cFram::read() and
+    cFram::write(). Each item starts with a magic number, so that an
+    erased or never-written area is ignored.
+
+*/
+
+namespace FramLayout {
+
+// total size of the FRAM on the 4610 (MB85RC64TA).
+constexpr std::uint32_t kFramSize = 8 * 1024;
+
+// SD card configuration (see cMeasurementLoop::SdConfig).
+constexpr std::uint32_t kSdConfigSize = 16;
+constexpr std::uint32_t kSdConfigOffset = kFramSize - kSdConfigSize;
+
+// uplinks waiting to be sent (see cUplinkQueue); this leaves about
+// 2 KiB for cFramStorage.
+constexpr std::uint32_t kUplinkQueueSize = 6 * 1024;
+constexpr std::uint32_t kUplinkQueueOffset = kSdConfigOffset - kUplinkQueueSize;
+
+// the lowest address used by the application.
+constexpr std::uint32_t kAppBase = kUplinkQueueOffset;
+
+} // namespace FramLayout
+
+} // namespace McciCatena4430
+
+#endif /* _Catena4430_FramLayout_h_ */
@@ -26,16 +26,23 @@ Author:
 #include <Catena_Date.h>
 #include <Catena_Timer.h>
 #include <Catena4430_c4430Gpios.h>
+#include <Catena4430_cLedMirror.h>
 #include <Catena4430_cPCA9570.h>
 #include <Catena4430_cClockDriver_PCF8523.h>
+#include <Catena4430_cClockDriver_Stm32Rtc.h>
+#include <Catena4430_cI2cBus.h>
 #include <SD.h>
 #include <SPI.h>
 #include "Catena4430_cMeasurementLoop.h"
 
 // the global clock object
-extern  McciCatena4430::cClockDriver_PCF8523    gClock;
+extern  McciCatena4430::cClockDriver_Stm32Rtc    gClock;
+extern  McciCatena4430::cClockDriver_PCF8523     gPcf8523;
+extern  McciCatena4430::cI2cBus                 gI2cBus;
+extern  McciCatena4430::cPCA9570                i2cgpio;
 
 extern  McciCatena4430::c4430Gpios              gpio;
+extern  McciCatena4430::cLedMirror              gLedMirror;
 extern  McciCatena::Catena                      gCatena;
 extern  McciCatena::cDate                       gDate;
 extern  McciCatena::cTimer                      ledTimer;
@@ -23,10 +23,12 @@ Author:
 #include <Catena_Date.h>
 #include <Catena4430_cPCA9570.h>
 #include <Catena4430_c4430Gpios.h>
+#include <Catena4430_cLedMirror.h>
 #include <Catena4430_cPIRdigital.h>
 #include "Catena4430_cMeasurementLoop.h"
 #include "Catena4430_cmd.h"
 #include <Catena4430_cClockDriver_PCF8523.h>
+#include <Catena4430_cI2cBus.h>
 
 extern McciCatena::Catena gCatena;
 using namespace McciCatena4430;
@@ -51,13 +53,18 @@ constexpr std::uint32_t kClearDoubleResetMagic = 0xCA44300;
 |
 \****************************************************************************/
 
+// the I2C transaction manager for the wing's devices
+cI2cBus                 gI2cBus    { &Wire };
+
 // the global I2C GPIO object
 cPCA9570                i2cgpio    { &Wire };
 
-// the global clock object
-cClockDriver_PCF8523    gClock      { &Wire };
+// the global clock object: the MCU's RTC, backed up by the PCF8523
+cClockDriver_PCF8523    gPcf8523    { &Wire };
+cClockDriver_Stm32Rtc   gClock      { &gPcf8523 };
 
 c4430Gpios gpio     { &i2cgpio };
+cLedMirror gLedMirror { &gpio };
 Catena gCatena;
 cDate gDate;
 cTimer ledTimer;
@@ -83,10 +90,6 @@ Catena_Mx25v8035f gFlash;
 cDownload gDownload;
 
 unsigned ledCount;
-bool fAnalogPin1;
-bool fAnalogPin2;
-bool fCheckPinA1;
-bool fCheckPinA2;
 bool fToggle;
 
 /****************************************************************************\
@@ -98,9 +101,14 @@ bool fToggle;
 // the individual commmands are put in this table
 static const cCommandStream::cEntry sMyExtraCommmands[] =
         {
+        { "activity", cmdActivity },
         { "date", cmdDate },
         { "dir", cmdDir },
+        { "light", cmdLight },
         { "log", cmdLog },
+        { "sdbench", cmdSdBench },
+        { "sdmigrate", cmdSdMigrate },
+        { "stats", cmdStats },
         { "tree", cmdDir },
         // other commands go here....
         };
@@ -248,9 +256,17 @@ void setup_printSignOn()
 
 void setup_gpio()
     {
+    // the PCA9570 and PCF8523 go through gI2cBus, at 400 kHz.
+    gI2cBus.begin(gCatena);
+    i2cgpio.setBus(&gI2cBus);
+    gPcf8523.setBus(&gI2cBus);
+
     if (! gpio.begin())
         Serial.println("GPIO failed to initialize");
 
+    // gLedMirror sets the LEDs together, then flushes.
+    gpio.setWriteBack(true);
+
     ledTimer.begin(400);
 
     // set up the LED
@@ -264,6 +280,8 @@ void setup_gpio()
         gMeasurementLoop.fDisableLED = true;
         gLed.Set(McciCatena::LedPattern::Off);
         }
+
+    gLedMirror.setDisabled(gMeasurementLoop.fDisableLED);
     }
 
 void setup_rtc()
@@ -315,6 +333,10 @@ void setup_radio()
 void setup_measurement()
     {
     gMeasurementLoop.begin();
+
+    // the inputs are set up now; start copying them to the LEDs.
+    if (! gLedMirror.begin(gCatena))
+        gCatena.SafePrintf("LED mirror failed to start\n");
     }
 
 void setup_commands()
@@ -345,59 +367,6 @@ void setup_start()
 
 void loop()
     {
+    // the LEDs are updated by gLedMirror, from pin-change interrupts.
     gCatena.poll();
-    
-    if (gMeasurementLoop.fDisableLED)
-        {
-        gpio.setGreen(false);
-        gpio.setRed(false);
-
-        // set flags of Pin A1 and A2 to false.
-        // this used to check A1/A2 when disabling the flag fDisableLed
-        fAnalogPin1 = false;
-        fAnalogPin2 = false;
-        fCheckPinA1 = false;
-        fCheckPinA2 = false;
-        }
-    else
-        {
-        // copy current PIR state to the blue LED.
-        gpio.setBlue(digitalRead(A0));
-
-        if (!fCheckPinA1)
-            {
-            // check the connection pin A1
-            if (digitalRead(A1) == 0)
-                {
-                fAnalogPin1 = true;
-                fCheckPinA1 = true;
-                }
-            }
-
-        if (fAnalogPin1)
-            {
-            // copy current state of Pin A1 to the Green LED.
-            gpio.setGreen(digitalRead(A1));
-            }
-        else
-            gpio.setGreen(false);
-
-        if (!fCheckPinA2)
-            {
-            // check the connection pin A2
-            if (digitalRead(A2) == 0)
-                {
-                fAnalogPin2 = true;
-                fCheckPinA2 = true;
-                }
-            }
-
-        if (fAnalogPin2)
-            {
-            // copy current state of Pin A2 to the Green LED.
-            gpio.setRed(digitalRead(A2));
-            }
-        else
-            gpio.setRed(false);
-        }
     }
@@ -14,6 +14,7 @@ Author:
 */
 
 #include "Catena4430_cMeasurementLoop.h"
+#include "Catena4430_FramLayout.h"
 #include <TimeLib.h>
 #include <Catena4430.h>
 #include <arduino_lmic.h>
@@ -31,7 +32,7 @@ static constexpr uint8_t kVddPin = D11;
 void lptimSleep(uint32_t timeOut);
 uint32_t HAL_AddTick(uint32_t delta);
 
-void user_request_network_time_cb(void *pVoidUserUTCTime, int flagSuccess);
+void user_request_network_time_cb(void *pUserData, int flagSuccess);
 
 uint32_t timeOut = 200;
 
@@ -55,6 +56,22 @@ void cMeasurementLoop::begin()
         this->m_ActivityTimer.begin(this->m_ActivityTimerSec * 1000);
         }
 
+    // get the SD card settings from FRAM.
+    this->loadSdConfig();
+
+    // pick up any uplinks that were still queued before the reset.
+    this->m_uplinkQueue.begin(
+        gCatena.getFram(),
+        FramLayout::kUplinkQueueOffset,
+        FramLayout::kUplinkQueueSize
+        );
+
+    // start drift estimation from whatever the RTC is calibrated to now.
+    std::int8_t rtcOffset;
+    if (! gPcf8523.getOffset(rtcOffset))
+        rtcOffset = 0;
+    this->m_rtcDrift.begin(rtcOffset);
+
     // start and initialize the PIR sensor
     this->m_pir.begin(gCatena);
 
@@ -76,6 +93,7 @@ void cMeasurementLoop::begin()
         {
         this->m_fSi1133 = true;
         this->m_fLowLight = true;
+        gLedMirror.setLowLight(true);
 
         auto const measConfig =	Catena_Si1133::ChannelConfiguration_t()
             .setAdcMux(Catena_Si1133::InputLed_t::LargeWhite)
@@ -93,16 +111,23 @@ void cMeasurementLoop::begin()
         }
 
     // read network time and set correct UTC time in RTC
-    uint32_t userUTCTime; // Seconds since the UTC epoch
     this->fNwTimeSet = false;
+    this->m_fNwTimePending = false;
 
     // Schedule a network time request at the next possible time
-    LMIC_requestNetworkTime(user_request_network_time_cb, &userUTCTime);
+    LMIC_requestNetworkTime(user_request_network_time_cb, this);
 
     // start (or restart) the FSM.
     if (! this->m_running)
         {
         this->m_fFwUpdate = false;
+        this->m_fSdBusy = false;
+        this->m_fMeasuring = false;
+        this->m_fLightCheckBusy = false;
+        this->m_lightCheckMs = millis();
+        this->m_fSdMounted = false;
+        this->m_fSdFileOpen = false;
+        this->m_fSdDirty = false;
         this->startTime = millis();
         this->m_exit = false;
         this->m_fsm.init(*this, &cMeasurementLoop::fsmDispatch);
@@ -208,20 +233,22 @@ cMeasurementLoop::fsmDispatch(
     case State::stMeasure:
         if (fEntry)
             {
-            // start SI1133 measurement (one-time)
-            this->m_si1133.start(true);
-            this->updateSynchronousMeasurements();
+            // start the conversions, and do the quick reads while
+            // they run; poll() evaluates us on every pass until done.
+            this->startMeasurements();
             this->setTimer(1000);
             }
 
-        if (this->m_si1133.isOneTimeReady())
+        if (this->pollMeasurements())
             {
-            this->updateLightMeasurements();
             newState = State::stTransmit;
             }
         else if (this->timedOut())
             {
             this->m_si1133.stop();
+            this->m_fMeasureLightPending = false;
+            ++this->m_measureStats.nLightTimeouts;
+            (void) this->pollMeasurements();
             newState = State::stTransmit;
             if (this->isTraceEnabled(this->DebugFlags::kError))
                 gCatena.SafePrintf("S1133 timed out\n");
@@ -231,19 +258,15 @@ cMeasurementLoop::fsmDispatch(
     case State::stTransmit:
         if (fEntry)
             {
-            TxBuffer_t b;
-
-            this->fillTxBuffer(b, this->m_data);
-            this->m_FileData = this->m_data;
-
-            this->m_FileTxBuffer.begin();
-            for (auto i = 0; i < b.getn(); ++i)
-                this->m_FileTxBuffer.put(b.getbase()[i]);
-
+            // hand the finished measurement to the uplink and SD card,
+            // and start filling the other slot.
+            this->m_iFill ^= 1;
             this->resetMeasurements();
 
+            this->fillTxBuffer(this->m_txBuffer, this->fileData(), this->getTxBufferLimit());
+
             if (gLoRaWAN.IsProvisioned())
-                this->startTransmission(b);
+                this->startUplink();
             }
         if (! gLoRaWAN.IsProvisioned())
             {
@@ -251,7 +274,23 @@ cMeasurementLoop::fsmDispatch(
             }
         if (this->txComplete())
             {
-            newState = State::stWriteFile;
+            // keep the payload if it didn't get through; if it did, the
+            // link is up, so send one of the older ones too.
+            if (this->m_fUplinkHeld)
+                {
+                newState = State::stWriteFile;
+                }
+            else if (this->m_txerr)
+                {
+                this->m_uplinkQueue.push(this->m_pTxPayload, this->m_nTxPayload);
+                newState = State::stWriteFile;
+                }
+            else if (! this->m_uplinkQueue.empty())
+                newState = State::stBackfill;
+            else
+                newState = State::stWriteFile;
+
+            this->finishUplink();
 
             // calculate the new sleep interval.
             this->updateTxCycleTime();
@@ -260,25 +299,59 @@ cMeasurementLoop::fsmDispatch(
             currentTimeSec = uint32_t(millis() - this->startTime) / 1000;
             if (currentTimeSec > m_rtcSetSec)
                 {
-                uint32_t userUTCTime; // Seconds since the UTC epoch
                 // Schedule a network time request at the next possible time
-                LMIC_requestNetworkTime(user_request_network_time_cb, &userUTCTime);
+                LMIC_requestNetworkTime(user_request_network_time_cb, this);
+                }
+            // while time requests are stretched, keep the MCU RTC, which
+            // stamps the data, on the calibrated PCF8523.
+            else if (this->m_rtcSetSec > kRtcSetSecDefault &&
+                     uint32_t(millis() - this->m_mcuRtcSyncMs) / 1000 > kMcuRtcSyncSec)
+                {
+                if (! gClock.syncFromMaster() && this->isTraceEnabled(this->DebugFlags::kError))
+                    gCatena.SafePrintf("couldn't load MCU RTC from PCF8523\n");
+                this->m_mcuRtcSyncMs = millis();
                 }
             }
         break;
 
-    // if there's an SD card, append to file
-    case State::stWriteFile:
+    // send one queued uplink; it stays queued unless it gets through.
+    case State::stBackfill:
         if (fEntry)
             {
+            if (! this->startBackfill())
+                {
+                newState = State::stWriteFile;
+                break;
+                }
+            }
+        if (this->txComplete())
+            {
+            if (! this->m_txerr)
+                this->m_uplinkQueue.pop();
+            newState = State::stWriteFile;
             }
+        break;
 
-        if (this->writeSdCard(this->m_FileTxBuffer, this->m_FileData))
-            newState = State::stTryToUpdate;
-        else if (gLoRaWAN.IsProvisioned())
-            newState = State::stTryToUpdate;
-        else
-            newState = State::stAwaitCard;
+    // if there's an SD card, append to file, one step at a time.
+    case State::stWriteFile:
+    case State::stSdMount:
+    case State::stSdOpen:
+    case State::stSdCompress:
+    case State::stSdWrite:
+    case State::stSdClose:
+    case State::stSdPowerDown:
+        {
+        auto const tStart = micros();
+
+        newState = this->fsmDispatchSdWriter(currentState, fEntry);
+
+        auto const tStep = micros() - tStart;
+        if (tStep > this->m_sdStats.maxStepUs)
+            {
+            this->m_sdStats.maxStepUs = tStep;
+            this->m_sdStats.maxStepState = currentState;
+            }
+        }
         break;
 
     // try to update firmware
@@ -314,6 +387,8 @@ cMeasurementLoop::fsmDispatch(
         if (fEntry)
             {
             gLog.printf(gLog.kInfo, "Rebooting to apply firmware\n");
+            if (this->m_fSdMounted)
+                this->sdTeardown();
             this->setTimer(1 * 1000);
             }
         if (this->timedOut())
@@ -340,71 +415,177 @@ cMeasurementLoop::fsmDispatch(
 
 void cMeasurementLoop::resetMeasurements()
     {
-    memset((void *) &this->m_data, 0, sizeof(this->m_data));
-    this->m_data.flags = Flags(0);
+    auto &data = this->fillData();
+
+    memset((void *) &data, 0, sizeof(data));
+    data.flags = Flags(0);
+
+    unsigned const maxDepth = this->getMaxActivityDepth();
+    data.activity.setDepth(this->m_activityDepth < maxDepth ? this->m_activityDepth : maxDepth);
     }
 
-void cMeasurementLoop::updateSynchronousMeasurements()
+// only format 0x24 can carry more than kMaxActivityEntriesSflt16
+// samples; multi-window uplinks (format 0x23) take precedence.
+unsigned cMeasurementLoop::getMaxActivityDepth() const
     {
-    this->m_data.Vbat = gCatena.ReadVbat();
-    this->m_data.flags |= Flags::Vbat;
+    auto const flags = gCatena.GetOperatingFlags();
+
+    if ((flags & static_cast<std::uint32_t>(OPERATING_FLAGS::fPackedActivity)) != 0 &&
+        (flags & static_cast<std::uint32_t>(OPERATING_FLAGS::fMultiWindow)) == 0)
+        return kMaxActivityEntries;
+    else
+        return kMaxActivityEntriesSflt16;
+    }
+
+/*
+
+Name:   cMeasurementLoop::startMeasurements()
+
+Function:
+    Start a measurement: trigger the sensors, and take the quick readings.
+
+Definition:
+    void cMeasurementLoop::startMeasurements();
+
+Description:
+    The Si1133 is started first, because its conversion takes longest.
+    The ADC (Vbat, Vbus) and the other non-I2C readings are taken while
+    it converts. The BME280 is read by pollMeasurements(), so
+    its forced conversion also overlaps the Si1133's.
 
-    this->m_data.Vbus = gCatena.ReadVbus();
-    this->m_data.flags |= Flags::Vbus;
+Returns:
+    No explicit result.
 
-    if (gCatena.getBootCount(this->m_data.BootCount))
+*/
+
+void cMeasurementLoop::startMeasurements()
+    {
+    this->m_measureStartMs = millis();
+    this->m_fMeasuring = true;
+    this->m_fMeasureEnvPending = this->m_fBme280;
+    this->m_fMeasureLightPending = this->m_fSi1133;
+
+    // start SI1133 measurement (one-time), abandoning any background
+    // check.
+    if (this->m_fLightCheckBusy)
         {
-        this->m_data.flags |= Flags::Boot;
+        this->m_si1133.stop();
+        this->m_fLightCheckBusy = false;
         }
 
-    if (this->m_fBme280)
+    if (this->m_fSi1133)
+        this->m_si1133.start(true);
+
+    this->updateSynchronousMeasurements();
+    }
+
+/*
+
+Name:   cMeasurementLoop::pollMeasurements()
+
+Function:
+    Collect the results of a measurement started by startMeasurements().
+
+Definition:
+    bool cMeasurementLoop::pollMeasurements();
+
+Description:
+    Each call collects whatever has finished. When nothing is left,
+    the time spent is recorded in the measurement statistics.
+
+Returns:
+    true if the measurement is complete.
+
+*/
+
+bool cMeasurementLoop::pollMeasurements()
+    {
+    if (this->m_fMeasureEnvPending)
+        {
+        this->m_fMeasureEnvPending = false;
+        this->updateEnvMeasurements();
+        }
+
+    if (this->m_fMeasureLightPending && this->m_si1133.isOneTimeReady())
+        {
+        this->m_fMeasureLightPending = false;
+        this->updateLightMeasurements();
+        }
+
+    if (this->m_fMeasureEnvPending || this->m_fMeasureLightPending)
+        return false;
+
+    if (this->m_fMeasuring)
+        {
+        auto &stats = this->m_measureStats;
+        std::uint32_t const dwellMs = millis() - this->m_measureStartMs;
+
+        this->m_fMeasuring = false;
+        ++stats.nMeasurements;
+        stats.lastDwellMs = dwellMs;
+        stats.totalDwellMs += dwellMs;
+        if (dwellMs > stats.maxDwellMs)
+            stats.maxDwellMs = dwellMs;
+        }
+
+    return true;
+    }
+
+void cMeasurementLoop::updateSynchronousMeasurements()
+    {
+    this->fillData().Vbat = gCatena.ReadVbat();
+    this->fillData().flags |= Flags::Vbat;
+
+    this->fillData().Vbus = gCatena.ReadVbus();
+    this->fillData().flags |= Flags::Vbus;
+
+    if (gCatena.getBootCount(this->fillData().BootCount))
         {
-        auto m = this->m_BME280.readTemperaturePressureHumidity();
-        this->m_data.env.Temperature = m.Temperature;
-        this->m_data.env.Pressure = m.Pressure;
-        this->m_data.env.Humidity = m.Humidity;
-        this->m_data.flags |= Flags::TPH;
+        this->fillData().flags |= Flags::Boot;
         }
 
-    // SI1133 is handled separately
+    // BME280 and SI1133 are handled separately
 
     // update activity -- this is is already handled elsewhere
 
     // grab data on pellets.
     cPelletFeeder::PelletFeederData data;
     this->m_PelletFeeder.readAndReset(data);
-    this->m_data.flags |= Flags::Pellets;
+    this->fillData().flags |= Flags::Pellets;
 
     // fill in the measurement.
     for (unsigned i = 0; i < kMaxPelletEntries; ++i)
         {
-        this->m_data.pellets[i].Total = data.feeder[i].total;
-        this->m_data.pellets[i].Recent = data.feeder[i].current;
+        this->fillData().pellets[i].Total = data.feeder[i].total;
+        this->fillData().pellets[i].Recent = data.feeder[i].current;
         }
 
     // grab time of last activity update.
-    gClock.get(this->m_data.DateTime);
+    gClock.getWithMs(this->fillData().DateTime, this->fillData().DateTimeMs);
     }
 
-void cMeasurementLoop::measureActivity()
+void cMeasurementLoop::updateEnvMeasurements()
     {
-    if (this->m_data.nActivity == this->kMaxActivityEntries)
-        {
-        // make room by deleting first entry
-        for (unsigned i = 0; i < this->kMaxActivityEntries - 1; ++i)
-            this->m_data.activity[i] = this->m_data.activity[i+1];
-
-        this->m_data.nActivity = this->kMaxActivityEntries - 1;
-        }
+    auto m = this->m_BME280.readTemperaturePressureHumidity();
+    this->fillData().env.Temperature = m.Temperature;
+    this->fillData().env.Pressure = m.Pressure;
+    this->fillData().env.Humidity = m.Humidity;
+    this->fillData().flags |= Flags::TPH;
+    }
 
-    // get another measurement.
+void cMeasurementLoop::measureActivity()
+    {
+    // get another measurement; if the history is full, this replaces
+    // the oldest entry.
     uint32_t const tDelta = this->m_pirLastTimeMs - this->m_pirBaseTimeMs;
-    this->m_data.activity[this->m_data.nActivity++].Avg = this->m_pirSum / tDelta;
-    this->m_data.flags |= Flags::Activity;
+    Measurement::Activity const a { this->m_pirSum / tDelta };
+    if (this->fillData().activity.push(a))
+        ++this->m_measureStats.nActivityDropped;
+    this->fillData().flags |= Flags::Activity;
 
     // record time. Since a zero timevalue is always invalid, we don't
     // need to check validity.
-    (void) gClock.get(this->m_data.DateTime);
+    (void) gClock.getWithMs(this->fillData().DateTime, this->fillData().DateTimeMs);
 
     // start new measurement.
     this->m_pirBaseTimeMs = this->m_pirLastTimeMs;
@@ -420,13 +601,92 @@ void cMeasurementLoop::updateLightMeasurements()
     this->m_si1133.readMultiChannelData(data, 1);
     this->m_si1133.stop();
 
-    this->m_data.flags |= Flags::Light;
-    this->m_data.light.White = (float) data[0];
+    this->fillData().flags |= Flags::Light;
+    this->fillData().light.White = (float) data[0];
 
-    if (data[0] <= 500)
-        m_fLowLight = true;
-    else
-        m_fLowLight = false;
+    this->updateLowLight(data[0]);
+
+    // this reading will do for the next background check, too.
+    this->m_lightCheckMs = millis();
+    }
+
+void cMeasurementLoop::updateLowLight(std::uint32_t light)
+    {
+    bool fLowLight = this->m_fLowLight;
+
+    if (light <= kLowLightOn)
+        fLowLight = true;
+    else if (light > kLowLightOff)
+        fLowLight = false;
+
+    this->m_lightStats.lastLight = light;
+    if (fLowLight != this->m_fLowLight)
+        {
+        this->m_fLowLight = fLowLight;
+        ++this->m_lightStats.nChanges;
+        }
+
+    gLedMirror.setLowLight(this->m_fLowLight);
+    }
+
+/*
+
+Name:   cMeasurementLoop::pollLightCheck()
+
+Function:
+    Check the light level between measurements.
+
+Definition:
+    void cMeasurementLoop::pollLightCheck();
+
+Description:
+    Every m_lightCheckSec seconds (a minute, by default), a one-time
+    Si1133 conversion is started; a later poll collects it and updates
+    the low-light state, so the LEDs follow the light within a minute
+    rather than once per uplink. The MCU is awake every 200 ms anyway,
+    so the checks don't add wakeups; they cost the conversion and the
+    I2C transactions. The check stands aside while stMeasure is using
+    the Si1133.
+
+Returns:
+    No explicit result.
+
+*/
+
+void cMeasurementLoop::pollLightCheck()
+    {
+    if (! this->m_fSi1133 || this->m_fMeasuring)
+        return;
+
+    if (this->m_fLightCheckBusy)
+        {
+        if (this->m_si1133.isOneTimeReady())
+            {
+            uint32_t data[1];
+
+            this->m_si1133.readMultiChannelData(data, 1);
+            this->m_si1133.stop();
+            this->m_fLightCheckBusy = false;
+            ++this->m_lightStats.nChecks;
+            this->updateLowLight(data[0]);
+            }
+        else if ((millis() - this->m_lightCheckMs) >= kLightCheckTimeoutMs)
+            {
+            this->m_si1133.stop();
+            this->m_fLightCheckBusy = false;
+            }
+        return;
+        }
+
+    if (this->m_lightCheckSec == 0)
+        return;
+
+    if ((millis() - this->m_lightCheckMs) >= this->m_lightCheckSec * 1000)
+        {
+        this->m_lightCheckMs = millis();
+        this->m_si1133.start(true);
+        this->m_fLightCheckBusy = true;
+        }
     }
 
 void cMeasurementLoop::resetPirAccumulation()
@@ -460,8 +720,139 @@ void cMeasurementLoop::accumulatePirData()
 |
 \****************************************************************************/
 
+/*
+
+Name:   cMeasurementLoop::startUplink()
+
+Function:
+    Start this cycle's uplink.
+
+Definition:
+    void cMeasurementLoop::startUplink();
+
+Description:
+    Normally, the format 0x22 message in m_txBuffer is sent. If
+    fMultiWindow is set in the operating flags, the measurement is
+    added to the pending format 0x23 frame instead, and the frame is
+    only sent when it's full, or when the measurement won't go in it
+    (in which case the measurement starts the next frame; see
+    finishUplink()). If nothing is sent, the uplink is marked complete
+    and successful, with m_fUplinkHeld set.
+
+    If the measurement won't fit in a format 0x23 frame by itself at the
+    current data rate, m_txBuffer is rebuilt as a single message sized
+    for the data rate, and sent instead.
+
+    Whichever message carries the measurement, commitTxBuffer() is
+    called for it just once. In multi-window mode, the message built in
+    stTransmit is only written to the SD card, so it isn't committed.
+
+Returns:
+    No explicit result.
+
+*/
+
+void cMeasurementLoop::startUplink()
+    {
+    bool const fMultiWindow = (gCatena.GetOperatingFlags() &
+                               static_cast<std::uint32_t>(OPERATING_FLAGS::fMultiWindow)) != 0;
+
+    this->m_fUplinkHeld = false;
+    this->m_fUplinkCarry = false;
+
+    if (! fMultiWindow)
+        {
+        // a frame left over from multi-window mode goes out as backfill.
+        if (this->m_uplinkFrameState.nWindows != 0)
+            {
+            this->m_uplinkQueue.push(this->m_uplinkFrame.getbase(), this->m_uplinkFrame.getn());
+            this->m_uplinkFrameState.nWindows = 0;
+            }
+
+        this->commitTxBuffer(this->fileData());
+        this->startTransmission(this->m_txBuffer.getbase(), this->m_txBuffer.getn());
+        return;
+        }
+
+    if (! this->appendUplinkWindow(this->fileData()))
+        {
+        if (this->m_uplinkFrameState.nWindows == 0)
+            {
+            this->fillTxBuffer(this->m_txBuffer, this->fileData(), getMaxUplinkPayload());
+            this->commitTxBuffer(this->fileData());
+            this->startTransmission(this->m_txBuffer.getbase(), this->m_txBuffer.getn());
+            return;
+            }
+
+        this->m_fUplinkCarry = true;
+        }
+    else if (! this->isUplinkFrameFull())
+        {
+        this->m_fUplinkHeld = true;
+        this->m_txcomplete = true;
+        this->m_txerr = false;
+        return;
+        }
+
+    this->startTransmission(this->m_uplinkFrame.getbase(), this->m_uplinkFrame.getn());
+    }
+
+// the uplink frame has been sent (or queued); start the next one. If
+// the measurement that didn't fit won't fit by itself either, it's
+// queued as a single message sized for the data rate.
+void cMeasurementLoop::finishUplink()
+    {
+    if (this->m_fUplinkHeld || this->m_uplinkFrameState.nWindows == 0)
+        return;
+
+    this->m_uplinkFrameState.nWindows = 0;
+    if (this->m_fUplinkCarry && ! this->appendUplinkWindow(this->fileData()))
+        {
+        this->fillTxBuffer(this->m_txBuffer, this->fileData(), getMaxUplinkPayload());
+        this->commitTxBuffer(this->fileData());
+        this->m_uplinkQueue.push(this->m_txBuffer.getbase(), this->m_txBuffer.getn());
+        }
+    }
+
 void cMeasurementLoop::startTransmission(
-    cMeasurementLoop::TxBuffer_t &b
+    const std::uint8_t *pPayload,
+    size_t nPayload
+    )
+    {
+    std::uint8_t uplinkPort;
+    if (this->fNwTimeSet)
+        {
+        uplinkPort = kUplinkPortwithNwTime;
+        this->fNwTimeSet = false;
+        }
+    else
+        {
+        uplinkPort = kUplinkPort;
+        }
+
+    this->m_pTxPayload = pPayload;
+    this->m_nTxPayload = nPayload;
+    this->sendUplink(pPayload, nPayload, uplinkPort);
+    }
+
+// send the oldest queued uplink, if any; returns false if there's none.
+bool cMeasurementLoop::startBackfill()
+    {
+    std::uint8_t payload[cUplinkQueue::kMaxPayload];
+    auto const nPayload = this->m_uplinkQueue.peek(payload);
+
+    if (nPayload == 0)
+        return false;
+
+    // the LMIC copies the payload, so it can live on the stack.
+    this->sendUplink(payload, nPayload, kUplinkPortBackfill);
+    return true;
+    }
+
+void cMeasurementLoop::sendUplink(
+    const std::uint8_t *pPayload,
+    size_t nPayload,
+    std::uint8_t uplinkPort
     )
     {
     auto const savedLed = gLed.Set(McciCatena::LedPattern::Off);
@@ -492,18 +883,7 @@ void cMeasurementLoop::startTransmission(
     this->m_txpending = true;
     this->m_txcomplete = this->m_txerr = false;
 
-    std::uint8_t uplinkPort;
-    if (this->fNwTimeSet)
-        {
-        uplinkPort = kUplinkPortwithNwTime;
-        this->fNwTimeSet = false;
-        }
-    else
-        {
-        uplinkPort = kUplinkPort;
-        }
-
-    if (! gLoRaWAN.SendBuffer(b.getbase(), b.getn(), sendBufferDoneCb, (void *)this, fConfirmed, uplinkPort))
+    if (! gLoRaWAN.SendBuffer(pPayload, nPayload, sendBufferDoneCb, (void *)this, fConfirmed, uplinkPort))
         {
         // uplink wasn't launched.
         this->m_txcomplete = true;
@@ -533,6 +913,10 @@ void cMeasurementLoop::poll()
     // no need to evaluate unless something happens.
     fEvent = false;
 
+    // set the clocks from network time on the second boundary.
+    if (this->m_fNwTimePending && std::int32_t(millis() - this->m_nwTimeSetMs) >= 0)
+        this->applyNetworkTime();
+
     // if we're not active, and no request, nothing to do.
     if (! this->m_active)
         {
@@ -555,7 +939,7 @@ void cMeasurementLoop::poll()
         {
         // time to record another minute of data.
         this->measureActivity();
-        if (this->m_data.nActivity == this->kMaxActivityEntries)
+        if (this->fillData().activity.isFull())
             fEvent = true;
         }
 
@@ -575,19 +959,44 @@ void cMeasurementLoop::poll()
         fEvent = true;
         }
 
+    // while writing to the SD card, or collecting a measurement, step
+    // the FSM on every pass.
+    if (this->m_fSdBusy || this->m_fMeasuring)
+        {
+        fEvent = true;
+        }
+
     if (fEvent)
         this->m_fsm.eval();
 
-    this->m_data.Vbus = gCatena.ReadVbus();
-    setVbus(this->m_data.Vbus);
+    // keep the low-light state current between measurements.
+    this->pollLightCheck();
 
-    if (!(this->m_fUsbPower) && !(this->m_fFwUpdate) && !(os_queryTimeCriticalJobs(ms2osticks(timeOut))))
+    this->fillData().Vbus = gCatena.ReadVbus();
+    setVbus(this->fillData().Vbus);
+
+    // if we're keeping the SD card mounted, flush the data file now and
+    // then, and let go of the card when USB power goes away.
+    if (this->m_fSdMounted && ! this->m_fSdBusy)
+        {
+        if (! this->m_fUsbPower)
+            {
+            gLog.printf(gLog.kInfo, "USB power lost, unmounting SD card\n");
+            this->sdTeardown();
+            }
+        else if (this->m_fSdDirty && (millis() - this->m_sdDirtyMs) >= kSdFlushMs)
+            {
+            this->m_sdFile.flush();
+            this->m_fSdDirty = false;
+            }
+        }
+
+    if (!(this->m_fUsbPower) && !(this->m_fFwUpdate) && !(this->m_fSdBusy) && !(this->m_fMeasuring) && !(this->m_fNwTimePending) && !(gLedMirror.isPending()) && !(gI2cBus.isBusy()) && !(os_queryTimeCriticalJobs(ms2osticks(timeOut))))
         lptimSleep(timeOut);
     }
 
-void user_request_network_time_cb(void *pVoidUserUTCTime, int flagSuccess) {
-    // Explicit conversion from void* to uint32_t* to avoid compiler errors
-    uint32_t *pUserUTCTime = (uint32_t *) pVoidUserUTCTime;
+void user_request_network_time_cb(void *pUserData, int flagSuccess) {
+    cMeasurementLoop * const pThis = (cMeasurementLoop *) pUserData;
 
     // A struct that will be populated by LMIC_getNetworkTimeReference.
     // It contains the following fields:
@@ -609,36 +1018,123 @@ void user_request_network_time_cb(void *pVoidUserUTCTime, int flagSuccess) {
         return;
         }
 
-    // Update userUTCTime, considering the difference between the GPS and UTC
-    // epoch, and the leap seconds
-    *pUserUTCTime = lmicTimeReference.tNetwork + 315964800;
+    // Network time when the request was sent, in milliseconds, converted
+    // from the GPS epoch to the UTC epoch. DeviceTimeAns also gives the
+    // fraction of the second, in 1/256 s units; LMIC keeps it separately.
+    std::int64_t const tRequestMs =
+        (std::int64_t(lmicTimeReference.tNetwork) + 315964800) * 1000 +
+        (std::int64_t(LMIC.netDeviceTimeFrac) * 1000 + 128) / 256;
 
     // Add the delay between the instant the time was transmitted and
-    // the current time
+    // the current time.
+    std::uint32_t const msNow = millis();
+    std::int64_t const tNowMs =
+        tRequestMs + osticks2ms(os_getTime() - lmicTimeReference.tLocal);
 
-    // Current time, in ticks
-    ostime_t ticksNow = os_getTime();
-    // Time when the request was sent, in ticks
-    ostime_t ticksRequestSent = lmicTimeReference.tLocal;
-    uint32_t requestDelaySec = osticks2ms(ticksNow - ticksRequestSent) / 1000;
-    *pUserUTCTime += requestDelaySec;
+    // Set the clocks at the start of the next second; the RTCs start
+    // counting a new second when they're written.
+    cDate::CommonTime_t const tNextSec = cDate::CommonTime_t(tNowMs / 1000 + 1);
+    std::uint32_t const msToNextSec = std::uint32_t(std::int64_t(tNextSec) * 1000 - tNowMs);
 
-    // gDate.setGpsTime((int64_t)*pUserUTCTime);
-    gDate.setCommonTime((int64_t)*pUserUTCTime);
+    gDate.setCommonTime(tNextSec);
 
     gCatena.SafePrintf(
-                "The current GPS time is: %04d-%02d-%02d %02d:%02d:%02d\n",
+                "The current GPS time is: %04d-%02d-%02d %02d:%02d:%02d, less %u ms\n",
                 gDate.year(), gDate.month(), gDate.day(),
-                gDate.hour(), gDate.minute(), gDate.second()
+                gDate.hour(), gDate.minute(), gDate.second(),
+                unsigned(msToNextSec)
                 );
 
+    pThis->scheduleNetworkTimeSet(tNextSec, msNow + msToNextSec);
+    }
+
+void cMeasurementLoop::scheduleNetworkTimeSet(McciCatena::cDate::CommonTime_t tSecond, std::uint32_t atMs)
+    {
+    this->m_nwTimeTarget = tSecond;
+    this->m_nwTimeSetMs = atMs;
+    this->m_fNwTimePending = true;
+    }
+
+void cMeasurementLoop::applyNetworkTime()
+    {
+    // if we're late (because of sleep), set the clock to the second it
+    // is now; anything left over shows up in the statistics.
+    std::uint32_t const lateMs = millis() - this->m_nwTimeSetMs;
+    cDate dNetwork;
+
+    this->m_fNwTimePending = false;
+    dNetwork.setCommonTime(this->m_nwTimeTarget + lateMs / 1000);
+
+    // see how far off the MCU RTC was, to the millisecond.
+    cDate dRtc;
+    std::uint16_t rtcMs;
+    std::uint32_t mcuErrorMs = ~std::uint32_t(0);
+    if (gClock.getWithMs(dRtc, rtcMs))
+        {
+        std::int32_t const errorMs = std::int32_t(
+            (dRtc.getCommonTime() - this->m_nwTimeTarget) * 1000 + rtcMs - lateMs
+            );
+        this->m_nwTimeStats.lastRtcErrorMs = errorMs;
+        mcuErrorMs = errorMs < 0 ? -errorMs : errorMs;
+        }
+
+    this->updateRtcDrift(dNetwork, mcuErrorMs);
+
     unsigned errCode;
-    if (! gClock.set(gDate, &errCode))
+    if (! gClock.set(dNetwork, &errCode))
         gCatena.SafePrintf("couldn't set clock: %u\n", errCode);
     else
-        gMeasurementLoop.fNwTimeSet = true;
+        {
+        this->fNwTimeSet = true;
+        this->m_mcuRtcSyncMs = millis();
+        this->setRtcDriftReference(dNetwork);
+        ++this->m_nwTimeStats.nSyncs;
+        this->m_nwTimeStats.lastLateMs = lateMs;
+        }
+
+    this->startTime = millis();
+    }
+
+void cMeasurementLoop::updateRtcDrift(const McciCatena::cDate &dNetwork, std::uint32_t mcuErrorMs)
+    {
+    cDate dRtc;
+
+    if (! gPcf8523.get(dRtc) ||
+        ! this->m_rtcDrift.addSample(dRtc.getCommonTime(), dNetwork.getCommonTime()))
+        return;
+
+    auto const &drift = this->m_rtcDrift;
+    std::int32_t const lastError = drift.getLastErrorSec();
+    std::uint32_t const absError = lastError < 0 ? -lastError : lastError;
 
-    gMeasurementLoop.startTime = millis();
+    // recalibrate if the estimate calls for a different offset.
+    std::int8_t const offset = drift.getBestOffset();
+    if (offset != drift.getOffset() && gPcf8523.setOffset(offset))
+        this->m_rtcDrift.setOffset(offset);
+
+    // ask for time less often while both RTCs keep within a second; go
+    // back to the default as soon as either doesn't. The data is stamped
+    // from the MCU RTC, which is only as good as its last load from the
+    // PCF8523 (see stTransmit).
+    if (drift.isCharacterized() && absError <= 1 && mcuErrorMs <= 1000)
+        {
+        this->m_rtcSetSec *= 2;
+        if (this->m_rtcSetSec > kRtcSetSecMax)
+            this->m_rtcSetSec = kRtcSetSecMax;
+        }
+    else if (absError > 2 || mcuErrorMs > 2000)
+        this->m_rtcSetSec = kRtcSetSecDefault;
+
+    if (this->isTraceEnabled(this->DebugFlags::kTrace))
+        gCatena.SafePrintf(
+            "RTC error %d s, MCU RTC %d ms; drift %d ppb over %u h; offset %d; next time request in %u h\n",
+            int(lastError),
+            int(this->m_nwTimeStats.lastRtcErrorMs),
+            int(drift.getDriftPpb()),
+            unsigned(drift.getSpanSec() / 3600),
+            int(drift.getOffset()),
+            unsigned(this->m_rtcSetSec / 3600)
+            );
     }
 
 static void setup_lptim(uint32_t msec)
@@ -912,6 +1408,9 @@ void cMeasurementLoop::doDeepSleep()
 
 void cMeasurementLoop::deepSleepPrepare(void)
     {
+    if (this->m_fSdMounted)
+        this->sdTeardown();
+
     pinMode(kVddPin, INPUT);
 
     Serial.end();
@@ -932,6 +1431,9 @@ void cMeasurementLoop::deepSleepRecovery(void)
     Serial.begin();
     Wire.begin();
     SPI.begin();
+
+    // the RTC's shadow registers are stale until resynced.
+    gClock.wakeup();
     //if (this->m_pSPI2)
     //    this->m_pSPI2->begin();
     }
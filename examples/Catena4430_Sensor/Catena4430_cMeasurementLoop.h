@@ -26,25 +26,32 @@ Author:
 #include <Catena_Led.h>
 #include <Catena_Log.h>
 #include <Catena_Mx25v8035f.h>
-#include <Catena4430_cClockDriver_PCF8523.h>
+#include <Catena4430_cClockDriver_Stm32Rtc.h>
 #include <Catena_PollableInterface.h>
 #include <Catena_Si1133.h>
 #include <Catena_Timer.h>
 #include <Catena_TxBuffer.h>
 #include <Catena.h>
 #include <mcciadk_baselib.h>
+#include <SD.h>
 #include <stdlib.h>
 #include "Catena4430_cPelletFeeder.h"
 #include "Catena4430_cPIRdigital.h"
+#include "Catena4430_cRecordCompressor.h"
+#include "Catena4430_cRingBuffer.h"
+#include "Catena4430_cUplinkQueue.h"
+#include "Catena4430_cRtcDrift.h"
 #include <Catena_Date.h>
 
 #include <cstdint>
+#include <cstring>
 
 extern McciCatena::Catena gCatena;
 extern McciCatena::cDate gDate;
 extern McciCatena::Catena::LoRaWAN gLoRaWAN;
 extern McciCatena::StatusLed gLed;
-extern McciCatena4430::cClockDriver_PCF8523 gClock;
+extern McciCatena4430::cClockDriver_Stm32Rtc gClock;
+extern McciCatena4430::cClockDriver_PCF8523 gPcf8523;
 
 namespace McciCatena4430 {
 
@@ -176,11 +183,11 @@ public:
 
         // time of most recent activity measurement
         McciCatena::cDate           DateTime;
+        // and the milliseconds into that second
+        std::uint16_t               DateTimeMs;
 
         // flags of entries that are valid.
         Flags                       flags;
-        // count of valid activity measurements
-        std::uint8_t                nActivity;
 
         // measured battery voltage, in volts
         float                       Vbat;
@@ -196,8 +203,8 @@ public:
         Light                       light;
         // food pellet tracking.
         Pellets                     pellets[kMaxPelletEntries];
-        // array of potential activity measurements.
-        Activity                    activity[kMaxActivityEntries];
+        // the most recent activity measurements, oldest first.
+        cRingBuffer<Activity, kMaxActivityEntries> activity;
         };
     };
 
@@ -207,14 +214,63 @@ public:
     // some parameters
     static constexpr std::uint8_t kUplinkPort = 2;
     static constexpr std::uint8_t kUplinkPortwithNwTime = 3;
+    static constexpr std::uint8_t kUplinkPortBackfill = 4;
     static constexpr bool kEnableDeepSleep = false;
-    static constexpr unsigned kMaxActivityEntries = 8;
+    // activity samples kept per uplink: at most kMaxActivityEntries
+    // with packed activity (format 0x24), otherwise at most
+    // kMaxActivityEntriesSflt16.
+    static constexpr unsigned kMaxActivityEntries = 32;
+    static constexpr unsigned kMaxActivityEntriesSflt16 = 8;
     using MeasurementFormat = cMeasurementFormat22<kMaxActivityEntries>;
     static constexpr unsigned kMaxPelletEntries = MeasurementFormat::kMaxPelletEntries;
     using Measurement = MeasurementFormat::Measurement;
     using Flags = MeasurementFormat::Flags;
     static constexpr std::uint8_t kMessageFormat = MeasurementFormat::kMessageFormat;
+    // multi-window uplinks (format 0x23): the most windows per frame, and
+    // the largest frame we'll build, whatever the data rate allows.
+    static constexpr std::uint8_t kMessageFormatMultiWindow = 0x23;
+    static constexpr unsigned kMaxUplinkWindows = 4;
+    static constexpr size_t kMaxUplinkFrame = 128;
+    // packed activity (format 0x24): bits per activity sample.
+    static constexpr std::uint8_t kMessageFormatPackedActivity = 0x24;
+    static constexpr std::uint8_t kActivityBitsMin = 2;
+    static constexpr std::uint8_t kActivityBitsMax = 8;
+    static constexpr std::uint8_t kActivityBitsDefault = 4;
     static constexpr std::uint8_t kSdCardCSpin = D5;
+    // time to let the SD card power settle before mounting, in ms
+    static constexpr std::uint32_t kSdPowerUpMs = 100;
+    // bytes written to the SD card per FSM step
+    static constexpr size_t kSdWriteChunkBytes = 128;
+    // size of the buffer for one formatted SD record
+    static constexpr size_t kSdRecordSize = 320;
+    // space for updateFromSd()'s read buffers, which share the SD
+    // writer's buffers (see SdBuffers).
+    static constexpr size_t kSdUpdateBufferSize = 1120;
+    // on USB power, flush the open data file this long after a write, in ms
+    static constexpr std::uint32_t kSdFlushMs = 5000;
+    // SD library SPI clock rate IDs: 0 is fastest; default is SPI_HALF_SPEED.
+    static constexpr std::uint8_t kSdSckRateDefault = 1;
+    static constexpr std::uint8_t kSdSckRateSlowest = 6;
+    // number of buckets in the sdbench latency histogram
+    static constexpr unsigned kSdBenchBuckets = 8;
+    // network time request interval: the starting value, and the longest
+    // it's stretched to once the RTC drift is known.
+    static constexpr std::uint32_t kRtcSetSecDefault = 8 * 60 * 60;
+    static constexpr std::uint32_t kRtcSetSecMax = 4 * 24 * 60 * 60;
+    // while it's stretched, the MCU RTC (which stamps the data) is
+    // reloaded from the calibrated PCF8523 this often.
+    static constexpr std::uint32_t kMcuRtcSyncSec = 8 * 60 * 60;
+    // light is "low" at or below kLowLightOn, and stays low until it's
+    // above kLowLightOff, so a level near the threshold doesn't flicker.
+    static constexpr std::uint32_t kLowLightOn = 500;
+    static constexpr std::uint32_t kLowLightOff = 600;
+    // default interval between background light checks; 0 disables them.
+    // Once a minute, like the activity samples: each check is a Si1133
+    // conversion and a few I2C transactions, so every 15 s cost
+    // 5,760 a day on battery.
+    static constexpr std::uint32_t kLightCheckSecDefault = 60;
+    // longest a background light check may take.
+    static constexpr std::uint32_t kLightCheckTimeoutMs = 500;
 
     void deepSleepPrepare();
     void deepSleepRecovery();
@@ -227,6 +283,9 @@ public:
         fDisableDeepSleep = 1 << 17,
         fQuickLightSleep = 1 << 18,
         fDeepSleepTest = 1 << 19,
+        fSdCompress = 1 << 20,
+        fMultiWindow = 1 << 21,
+        fPackedActivity = 1 << 22,
         fDisableLed = 1 << 30,
         };
 
@@ -245,9 +304,14 @@ public:
         , m_txCycleSec_Permanent(6 * 60)    // default uplink interval
         , m_txCycleSec(60)                  // initial uplink interval
         , m_txCycleCount(10)                // initial count of fast uplinks
-        , m_rtcSetSec(8 * 60 * 60)          // set RTC time every 8 hours
+        , m_rtcSetSec(kRtcSetSecDefault)    // set RTC time every 8 hours, at first
         , m_DebugFlags(DebugFlags(kError | kTrace))
         , m_ActivityTimerSec(60)            // the activity time sample interval
+        , m_activityDepth(kMaxActivityEntries) // activity history kept per uplink
+        , m_activityBits(kActivityBitsDefault) // packed activity resolution
+        , m_iFill(0)                        // fill m_measurement[0] first
+        , m_sdSckRate(kSdSckRateDefault)    // SD card SPI clock
+        , m_lightCheckSec(kLightCheckSecDefault) // background light checks
         {};
 
     // neither copyable nor movable
@@ -265,7 +329,14 @@ public:
         stWarmup,       // transition from inactive to measure, get some data.
         stMeasure,      // take measurents
         stTransmit,     // transmit data
-        stWriteFile,    // write file data
+        stBackfill,     // transmit a queued uplink
+        stWriteFile,    // write file data: format record, power up card
+        stSdMount,      // mount the SD card
+        stSdOpen,       // open the data file
+        stSdCompress,   // compress the record
+        stSdWrite,      // write a chunk of the record
+        stSdClose,      // close the data file
+        stSdPowerDown,  // power down the SD card
         stTryToUpdate,  // try to update firmware
         stTryToMigrate, // try to migrate device to TTN V3
         stAwaitCard,    // wait for a card to show up.
@@ -285,7 +356,14 @@ public:
         case State::stWarmup:   return "stWarmup";
         case State::stMeasure:  return "stMeasure";
         case State::stTransmit: return "stTransmit";
+        case State::stBackfill: return "stBackfill";
         case State::stWriteFile: return "stWriteFile";
+        case State::stSdMount:  return "stSdMount";
+        case State::stSdOpen:   return "stSdOpen";
+        case State::stSdCompress: return "stSdCompress";
+        case State::stSdWrite:  return "stSdWrite";
+        case State::stSdClose:  return "stSdClose";
+        case State::stSdPowerDown: return "stSdPowerDown";
         case State::stTryToUpdate: return "stTryToUpdate";
         case State::stTryToMigrate: return "stTryToMigrate";
         case State::stAwaitCard: return "stAwaitCard";
@@ -295,8 +373,210 @@ public:
             }
         }
 
+    // results of one pass of the SD card benchmark
+    struct SdBenchResult
+        {
+        // SD library SPI clock rate ID
+        std::uint8_t    sckRate;
+        // true if the card mounted
+        bool            fMounted;
+        // true if everything written was read back correctly
+        bool            fVerified;
+        // time from power-up until the card was mounted, in ms
+        std::uint32_t   readyMs;
+        // time taken by the successful mount, in microseconds
+        std::uint32_t   mountUs;
+        // sequential write throughput, bytes/second
+        std::uint32_t   seqBytesPerSec;
+        // small-append (open/write/close) throughput, bytes/second
+        std::uint32_t   appendBytesPerSec;
+        // longest small append, in microseconds
+        std::uint32_t   appendMaxUs;
+        // histogram of small-append latencies
+        std::uint16_t   histogram[kSdBenchBuckets];
+        };
+
     // concrete type for uplink data buffer
     using TxBuffer_t = McciCatena::AbstractTxBuffer_t<MeasurementFormat::kTxBufferSize>;
+    using UplinkFrame_t = McciCatena::AbstractTxBuffer_t<kMaxUplinkFrame>;
+    static_assert(MeasurementFormat::kTxBufferSize <= cUplinkQueue::kMaxPayload &&
+                  kMaxUplinkFrame <= cUplinkQueue::kMaxPayload,
+                  "uplinks don't fit in the uplink queue");
+    // format 0x24 needs a count, the bits, and at most 3 + bits per sample.
+    static_assert(MeasurementFormat::kTxBufferSize - kMaxActivityEntries * 2 +
+                  2 + (kMaxActivityEntries * (3 + kActivityBitsMax) + 7) / 8 <= MeasurementFormat::kTxBufferSize,
+                  "packed activity doesn't fit in TxBuffer_t");
+
+    // the state of the format 0x23 frame being built: how many windows
+    // it has, and the values (as the decoder will see them) that the
+    // next window's changes are relative to.
+    struct UplinkFrameState
+        {
+        std::uint32_t   lastTime;
+        std::int32_t    tCode;
+        std::int32_t    pCode;
+        std::int32_t    rhCode;
+        std::uint16_t   pelletTotal[kMaxPelletEntries];
+        // expected size of the next window, for deciding when to send.
+        std::uint8_t    nNextWindowBytes;
+        std::uint8_t    nWindows;
+        Flags           flags;
+        };
+
+    // a Print target in RAM, used to format a record before it's
+    // written to the SD card a chunk at a time. The kSdRecordSize bytes
+    // of storage are in SdBuffers.
+    class cRecordBuffer : public Print
+        {
+    public:
+        explicit cRecordBuffer(std::uint8_t *pBuf)
+            : m_buf(pBuf)
+            {}
+
+        // neither copyable nor movable; use copy().
+        cRecordBuffer(const cRecordBuffer&) = delete;
+        cRecordBuffer& operator=(const cRecordBuffer&) = delete;
+        cRecordBuffer(const cRecordBuffer&&) = delete;
+        cRecordBuffer& operator=(const cRecordBuffer&&) = delete;
+
+        void begin()
+            {
+            this->m_n = 0;
+            this->m_fOverflow = false;
+            }
+        virtual size_t write(std::uint8_t c) override
+            {
+            if (this->m_n >= kSdRecordSize)
+                {
+                this->m_fOverflow = true;
+                return 0;
+                }
+            this->m_buf[this->m_n++] = c;
+            return 1;
+            }
+        using Print::write;
+        const std::uint8_t *getbase() const
+            {
+            return this->m_buf;
+            }
+        size_t getn() const
+            {
+            return this->m_n;
+            }
+        bool isOverflow() const
+            {
+            return this->m_fOverflow;
+            }
+        // copy the contents of another record.
+        void copy(const cRecordBuffer &other)
+            {
+            memcpy(this->m_buf, other.m_buf, other.m_n);
+            this->m_n = other.m_n;
+            this->m_fOverflow = other.m_fOverflow;
+            }
+    private:
+        std::uint8_t    * const m_buf;
+        size_t          m_n = 0;
+        bool            m_fOverflow = false;
+        };
+
+    // the SD writer's buffers. They're idle while a firmware update is
+    // loaded from the card, so updateFromSd() uses the same space for
+    // its read buffers, rather than keeping 1K of RAM for a rare event.
+    union SdBuffers
+        {
+        struct
+            {
+            std::uint8_t    record[kSdRecordSize];
+            std::uint8_t    lzPrev[kSdRecordSize];
+            std::uint8_t    lzFrame[cRecordCompressor::getMaxFrameSize(kSdRecordSize)];
+            } writer;
+        alignas(4) std::uint8_t update[kSdUpdateBufferSize];
+        };
+
+    // statistics for the SD card writer
+    struct SdWriterStats
+        {
+        // number of records we tried to write
+        std::uint32_t   nCycles;
+        // number of those that failed
+        std::uint32_t   nErrors;
+        // time from start to finish of the most recent write, in ms
+        std::uint32_t   lastCycleMs;
+        // longest single FSM step, in microseconds
+        std::uint32_t   maxStepUs;
+        // the state that took that long
+        State           maxStepState;
+        // number of records compressed
+        std::uint32_t   nCompressed;
+        // bytes in and out of the compressor
+        std::uint32_t   compressRawBytes;
+        std::uint32_t   compressOutBytes;
+        // total and longest time spent compressing, in microseconds
+        std::uint32_t   compressUsTotal;
+        std::uint32_t   compressUsMax;
+        };
+
+    // measurement (stMeasure) statistics
+    struct MeasureStats
+        {
+        // number of measurements taken
+        std::uint32_t   nMeasurements;
+        // time spent in stMeasure: most recent, longest, and total, in ms
+        std::uint32_t   lastDwellMs;
+        std::uint32_t   maxDwellMs;
+        std::uint32_t   totalDwellMs;
+        // number of times the Si1133 didn't finish in time
+        std::uint32_t   nLightTimeouts;
+        // activity samples dropped because the history was full
+        std::uint32_t   nActivityDropped;
+        };
+
+    // what fillTxBuffer() put in the message: the flags sent, the
+    // number of (oldest) activity samples left out, and how.
+    struct TxBufferPlan
+        {
+        Flags           flags;
+        unsigned        nActivityHeld;
+        bool            fPacked;
+        size_t          nLimit;
+        };
+
+    // what didn't fit in uplinks at the data rate of the time
+    struct UplinkSizeStats
+        {
+        // activity samples moved to the uplink queue
+        std::uint32_t   nActivityHeld;
+        // activity samples that didn't fit in the queued message either
+        std::uint32_t   nActivityNotSent;
+        // times the pellet counts were held for the next uplink
+        std::uint32_t   nPelletsHeld;
+        // uplinks sent without some of the voltages, boot count, or
+        // environmental and light readings
+        std::uint32_t   nShortened;
+        };
+
+    // light level statistics
+    struct LightStats
+        {
+        // number of background light checks
+        std::uint32_t   nChecks;
+        // number of times the low-light state changed
+        std::uint32_t   nChanges;
+        // the most recent reading
+        std::uint32_t   lastLight;
+        };
+
+    // network time sync statistics
+    struct NwTimeStats
+        {
+        // number of times the clocks were set from network time
+        std::uint32_t   nSyncs;
+        // MCU RTC minus network time, just before the last set, in ms
+        std::int32_t    lastRtcErrorMs;
+        // how late the last set was, after the second boundary, in ms
+        std::uint32_t   lastLateMs;
+        };
 
     // flag to disable LED
     bool fDisableLED;
@@ -356,10 +636,142 @@ public:
 
     /// bring up the SD card, if possible.
     bool checkSdCard();
-    /// tear down the SD card.
+    /// release the SD card; it stays mounted if we're on USB power.
     void sdFinish();
+    /// close the data file and tear down the SD card, even on USB power.
+    void sdTeardown();
+    /// move data files from the old flat layout to the per-month layout.
+    bool migrateSdData(unsigned &nMoved, unsigned &nFailed);
+    /// return true if the FSM is in the middle of writing to the SD card.
+    bool isSdBusy() const
+        {
+        return this->m_fSdBusy;
+        }
+    /// return true if the SD card is being kept mounted between writes.
+    bool isSdMounted() const
+        {
+        return this->m_fSdMounted;
+        }
+    /// benchmark the SD card at a given SPI clock rate ID.
+    bool runSdBench(std::uint8_t sckRate, SdBenchResult &result);
+    /// get the SPI clock rate ID used for the SD card.
+    std::uint8_t getSdSckRate() const
+        {
+        return this->m_sdSckRate;
+        }
+    /// set the SPI clock rate ID for the SD card, and save it in FRAM.
+    bool saveSdSckRate(std::uint8_t sckRate);
+    /// return the nominal clock for an SPI clock rate ID.
+    static std::uint32_t getSdSckHz(std::uint8_t sckRate);
+    /// return a printable name for a benchmark histogram bucket.
+    static const char *getSdBenchBucketName(unsigned iBucket);
+    /// get the SD writer statistics.
+    const SdWriterStats &getSdWriterStats() const
+        {
+        return this->m_sdStats;
+        }
+    /// compare the RTCs with network time, and recalibrate. mcuErrorMs
+    /// is how far off the MCU RTC was, or ~0 if unknown.
+    void updateRtcDrift(const McciCatena::cDate &dNetwork, std::uint32_t mcuErrorMs);
+    /// the RTC was just set from network time.
+    void setRtcDriftReference(const McciCatena::cDate &dNetwork)
+        {
+        this->m_rtcDrift.setReference(dNetwork.getCommonTime());
+        }
+    /// the RTC was set some other way.
+    void clearRtcDriftReference()
+        {
+        this->m_rtcDrift.clearReference();
+        }
+    /// get the RTC drift estimate.
+    const cRtcDrift &getRtcDrift() const
+        {
+        return this->m_rtcDrift;
+        }
+    /// set the clocks to tSecond when millis() reaches atMs.
+    void scheduleNetworkTimeSet(McciCatena::cDate::CommonTime_t tSecond, std::uint32_t atMs);
+    /// get the network time statistics.
+    const NwTimeStats &getNwTimeStats() const
+        {
+        return this->m_nwTimeStats;
+        }
+    /// get the network time request interval, in seconds.
+    std::uint32_t getRtcSetSec() const
+        {
+        return this->m_rtcSetSec;
+        }
+    /// get/set the number of activity samples kept for each uplink,
+    /// 1 to kMaxActivityEntries; takes effect at the next uplink, and
+    /// is limited by getMaxActivityDepth().
+    unsigned getActivityDepth() const
+        {
+        return this->m_activityDepth;
+        }
+    /// get the most activity samples the uplink format allows.
+    unsigned getMaxActivityDepth() const;
+    /// get/set the bits per sample for packed activity, kActivityBitsMin
+    /// to kActivityBitsMax; takes effect at the next uplink.
+    unsigned getActivityBits() const
+        {
+        return this->m_activityBits;
+        }
+    void setActivityBits(unsigned bits)
+        {
+        if (bits < kActivityBitsMin)
+            bits = kActivityBitsMin;
+        else if (bits > kActivityBitsMax)
+            bits = kActivityBitsMax;
+        this->m_activityBits = std::uint8_t(bits);
+        }
+    void setActivityDepth(unsigned depth)
+        {
+        if (depth < 1)
+            depth = 1;
+        else if (depth > kMaxActivityEntries)
+            depth = kMaxActivityEntries;
+        this->m_activityDepth = std::uint8_t(depth);
+        }
+    /// get the measurement statistics.
+    const MeasureStats &getMeasureStats() const
+        {
+        return this->m_measureStats;
+        }
+    /// get the largest single uplink to send at the current data rate.
+    size_t getTxBufferLimit() const;
+    /// get the statistics on uplinks that had to be cut down.
+    const UplinkSizeStats &getUplinkSizeStats() const
+        {
+        return this->m_uplinkSizeStats;
+        }
+    /// get the queue of uplinks waiting to be sent.
+    const cUplinkQueue &getUplinkQueue() const
+        {
+        return this->m_uplinkQueue;
+        }
+    /// get the light level statistics.
+    const LightStats &getLightStats() const
+        {
+        return this->m_lightStats;
+        }
+    /// get/set the background light check interval, in seconds; 0 disables.
+    std::uint32_t getLightCheckSec() const
+        {
+        return this->m_lightCheckSec;
+        }
+    void setLightCheckSec(std::uint32_t sec)
+        {
+        this->m_lightCheckSec = sec;
+        }
+    /// true if the light is low.
+    bool isLowLight() const
+        {
+        return this->m_fLowLight;
+        }
 
 private:
+    // set the clocks from a pending network time.
+    void applyNetworkTime();
+
     // sleep handling
     void sleep();
     bool checkDeepSleep();
@@ -369,14 +781,38 @@ private:
     // void deepSleepRecovery();
 
     // read data
+    void startMeasurements();
+    bool pollMeasurements();
     void updateSynchronousMeasurements();
+    void updateEnvMeasurements();
     void updateLightMeasurements();
+    void updateLowLight(std::uint32_t light);
+    void pollLightCheck();
     void resetMeasurements();
     void measureActivity();
+    Measurement &fillData()
+        {
+        return this->m_measurement[this->m_iFill];
+        }
+    Measurement const &fileData() const
+        {
+        return this->m_measurement[this->m_iFill ^ 1];
+        }
 
     // telemetry handling.
-    void fillTxBuffer(TxBuffer_t &b, Measurement const & mData);
-    void startTransmission(TxBuffer_t &b);
+    void fillTxBuffer(TxBuffer_t &b, Measurement const & mData, size_t nLimit);
+    void commitTxBuffer(Measurement const &mData);
+    size_t putActivity(TxBuffer_t *pb, Measurement const &mData, bool fPacked, unsigned iFirst, unsigned n) const;
+    size_t putPackedActivity(TxBuffer_t *pb, Measurement const &mData, unsigned iFirst, unsigned n) const;
+    void holdActivity(Measurement const &mData, bool fPacked, unsigned nHeld, size_t nLimit);
+    bool appendUplinkWindow(Measurement const &mData);
+    bool isUplinkFrameFull() const;
+    static size_t getMaxUplinkPayload();
+    void startUplink();
+    void finishUplink();
+    void startTransmission(const std::uint8_t *pPayload, size_t nPayload);
+    bool startBackfill();
+    void sendUplink(const std::uint8_t *pPayload, size_t nPayload, std::uint8_t uplinkPort);
     void sendBufferDone(bool fSuccess);
     bool txComplete()
         {
@@ -391,14 +827,24 @@ private:
     // SD card handling
     bool initSdCard();
 
-    bool writeSdCard(TxBuffer_t &b, Measurement const &mData);
+    static void writeSdHeader(Print &out);
+    void writeSdRecord(Print &out, TxBuffer_t const &b, Measurement const &mData) const;
+    State fsmDispatchSdWriter(State currentState, bool fEntry);
+    State sdWriterNextState();
+    bool sdMount();
+    void sdEnd();
+    void sdCloseDataFile();
+    void loadSdConfig();
+    bool openSdDataFile(File &dataFile, McciCatena::cDate const &d, bool fCompressed = false);
+    bool writeSdCompressedHeader(std::uint32_t fileKey);
     bool handleSdFirmwareUpdate();
     bool handleSdFirmwareUpdateCardUp();
-    bool updateFromSd(const char *sFile, McciCatena::cDownload::DownloadRq_t rq);
+    bool updateFromSd(const char *sFile, McciCatena::cDownload::DownloadRq_t rq, bool fDelta = false);
     void handleSdTTNv3Migrate();
     void rejoinNetwork();
     void sdPowerUp(bool fOn);
     void sdPrep();
+    void sdPrepStart();
 
     // pir handling
     void resetPirAccumulation(void);
@@ -467,6 +913,36 @@ private:
     bool                            m_fSpi2Active: 1;
     // set true when we've BIN file in SD card to update
     bool                            m_fFwUpdate : 1;
+    // set true while the FSM is writing to the SD card
+    bool                            m_fSdBusy : 1;
+    // set true while waiting for a second boundary to set the clocks
+    bool                            m_fNwTimePending : 1;
+    // set true while stMeasure is collecting results
+    bool                            m_fMeasuring : 1;
+    // set true until the BME280 has been read in this measurement
+    bool                            m_fMeasureEnvPending : 1;
+    // set true until the Si1133 has been read in this measurement
+    bool                            m_fMeasureLightPending : 1;
+    // set true while a background light check is converting
+    bool                            m_fLightCheckBusy : 1;
+    // set true if this cycle's window was added to the uplink frame, not sent
+    bool                            m_fUplinkHeld : 1;
+    // set true if this cycle's window starts the next uplink frame
+    bool                            m_fUplinkCarry : 1;
+    // set false if a step of the SD writer fails
+    bool                            m_fSdResult : 1;
+    // set true while the SD card is kept mounted between writes
+    bool                            m_fSdMounted : 1;
+    // set true while m_sdFile is open
+    bool                            m_fSdFileOpen : 1;
+    // set true if m_sdFile has been written but not flushed
+    bool                            m_fSdDirty : 1;
+    // set true if the record being written is to be compressed
+    bool                            m_fSdCompress : 1;
+    // set true if m_sdLzPrev holds the last frame written
+    bool                            m_fSdLzPrevValid : 1;
+    // set true if the record being written uses m_sdLzPrev
+    bool                            m_fSdLzUseDict : 1;
 
     // PIR sample control
     cPIRdigital                     m_pir;
@@ -484,6 +960,10 @@ private:
     // activity time control
     McciCatena::cTimer              m_ActivityTimer;
     std::uint32_t                   m_ActivityTimerSec;
+    // number of activity samples kept, at most kMaxActivityEntries.
+    std::uint8_t                    m_activityDepth;
+    // bits per sample for packed activity.
+    std::uint8_t                    m_activityBits;
 
     // uplink time control
     McciCatena::cTimer              m_UplinkTimer;
@@ -493,17 +973,79 @@ private:
 
     // RTC set time control
     std::uint32_t                   m_rtcSetSec;
+    cRtcDrift                       m_rtcDrift { cClockDriver_PCF8523::kOffsetPpbPerStep };
+    // pending network time: the second to set, and when (in millis()).
+    McciCatena::cDate::CommonTime_t m_nwTimeTarget;
+    std::uint32_t                   m_nwTimeSetMs;
+    NwTimeStats                     m_nwTimeStats {};
+    // when the MCU RTC was last set, from network time or the PCF8523.
+    std::uint32_t                   m_mcuRtcSyncMs {};
+
+    // when stMeasure was entered, in millis(), and its statistics.
+    std::uint32_t                   m_measureStartMs;
+    MeasureStats                    m_measureStats {};
+    UplinkSizeStats                 m_uplinkSizeStats {};
+    // pellet counts that didn't fit in an uplink, for the next one.
+    std::uint32_t                   m_pelletsHeld[kMaxPelletEntries] {};
+    // what the last fillTxBuffer() left out, for commitTxBuffer().
+    TxBufferPlan                    m_txPlan {};
+
+    // background light checks: interval, when the last one started.
+    std::uint32_t                   m_lightCheckSec;
+    std::uint32_t                   m_lightCheckMs;
+    LightStats                      m_lightStats {};
 
     // simple timer for timing-out sensors.
     std::uint32_t                   m_timer_start;
     std::uint32_t                   m_timer_delay;
 
-    // the current measurement
-    Measurement                     m_data;
-
-    // the data to write to the file
-    Measurement                     m_FileData;
-    TxBuffer_t                      m_FileTxBuffer;
+    // the measurement slots: fillData() is being accumulated, while
+    // fileData() is encoded, uplinked and written to the SD card.
+    // stTransmit swaps them by flipping m_iFill.
+    Measurement                     m_measurement[2];
+    std::uint8_t                    m_iFill;
+
+    // the encoded form of fileData(), for the uplink and the SD card.
+    TxBuffer_t                      m_txBuffer;
+
+    // uplinks that didn't get through, oldest first.
+    cUplinkQueue                    m_uplinkQueue;
+    // the uplink in flight, to queue if it fails.
+    const std::uint8_t              *m_pTxPayload = nullptr;
+    size_t                          m_nTxPayload = 0;
+
+    // the format 0x23 frame being built, in multi-window mode.
+    UplinkFrame_t                   m_uplinkFrame;
+    UplinkFrameState                m_uplinkFrameState {};
+
+    // year * 100 + month of the SD data directory we last created;
+    // zero if unknown.
+    std::uint32_t                   m_sdDirCacheKey;
+
+    // the SD record being written, what's actually written (the record,
+    // or its compressed frame), and how much has been written.
+    SdBuffers                       m_sdBuffers;
+    cRecordBuffer                   m_sdRecord { this->m_sdBuffers.writer.record };
+    const std::uint8_t              *m_pSdWriteData;
+    size_t                          m_nSdWriteData;
+    size_t                          m_sdRecordIndex;
+
+    // for compression: the last record written, the file it went to and
+    // the size of the file after; and the compressed frame.
+    cRecordBuffer                   m_sdLzPrev { this->m_sdBuffers.writer.lzPrev };
+    std::uint32_t                   m_sdLzFileKey;
+    std::uint32_t                   m_sdLzFileSize;
+    File                            m_sdFile;
+    // the day (YYYYMMDD) of the open data file, times 2, plus 1
+    // if it's compressed.
+    std::uint32_t                   m_sdFileKey;
+    // time of the first unflushed write to m_sdFile.
+    std::uint32_t                   m_sdDirtyMs;
+    std::uint32_t                   m_sdCycleStartMs;
+    SdWriterStats                   m_sdStats;
+
+    // SPI clock rate ID for the SD card (see loadSdConfig()).
+    std::uint8_t                    m_sdSckRate;
     };
 
 //
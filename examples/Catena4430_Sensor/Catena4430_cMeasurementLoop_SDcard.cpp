@@ -17,6 +17,9 @@ Author:
 
 #include "Catena4430_Sensor.h"
 
+#include "Catena4430_cRecordCompressor.h"
+#include "Catena4430_Crc32.h"
+
 #include <Catena_Download.h>
 
 #include <Catena_Fram.h>
@@ -25,6 +28,7 @@ Author:
 
 #include <SD.h>
 #include <mcciadk_baselib.h>
+#include <new>
 
 using namespace McciCatena4430;
 using namespace McciCatena;
@@ -39,6 +43,9 @@ SDClass gSD;
 
 constexpr char gkMigrateFileName[] = "MIGRATE.V3";
 
+// the top-level directory for data files.
+constexpr char kSdDataDir[] = "Data";
+
 /****************************************************************************\
 |
 |   Some utilities
@@ -51,7 +58,9 @@ void cMeasurementLoop::sdPowerUp(bool fOn)
     gpio.setVsdcard(fOn);
     }
 
-void cMeasurementLoop::sdPrep()
+// set up SPI2 and turn on power to the card; the caller must then
+// wait kSdPowerUpMs before using the card.
+void cMeasurementLoop::sdPrepStart()
     {
     digitalWrite(cMeasurementLoop::kSdCardCSpin, 1);
     pinMode(cMeasurementLoop::kSdCardCSpin, OUTPUT);
@@ -63,10 +72,72 @@ void cMeasurementLoop::sdPrep()
 
     digitalWrite(cMeasurementLoop::kSdCardCSpin, 1);
     this->sdPowerUp(true);
-    delay(100);
     }
 
+void cMeasurementLoop::sdPrep()
+    {
+    this->sdPrepStart();
+    delay(kSdPowerUpMs);
+    }
+
+/*
+
+Name:   cMeasurementLoop::sdFinish()
+
+Index:  Name:   cMeasurementLoop::sdTeardown()
+
+Function:
+    Release the SD card.
+
+Definition:
+    void cMeasurementLoop::sdFinish();
+
+    void cMeasurementLoop::sdTeardown();
+
+Description:
+    sdFinish() is called when a user of the card (a command, the
+    firmware updater) is done with it. If the card is being kept
+    mounted because we're on USB power, nothing happens; otherwise
+    the card is unmounted and powered down.
+
+    sdTeardown() closes the data file (if open), unmounts and powers
+    down the card unconditionally. It's used when USB power goes away,
+    before sleeping, and after errors.
+
+Returns:
+    No explicit result.
+
+*/
+
 void cMeasurementLoop::sdFinish()
+    {
+    if (this->m_fSdMounted)
+        return;
+
+    this->sdEnd();
+    }
+
+void cMeasurementLoop::sdTeardown()
+    {
+    this->sdCloseDataFile();
+    this->m_fSdMounted = false;
+    this->sdEnd();
+    }
+
+// flush and close the data file, if it's open.
+void cMeasurementLoop::sdCloseDataFile()
+    {
+    if (this->m_fSdFileOpen)
+        {
+        this->m_sdFile.close();
+        this->m_fSdFileOpen = false;
+        }
+
+    this->m_fSdDirty = false;
+    }
+
+// unmount the card and turn off power.
+void cMeasurementLoop::sdEnd()
     {
     // gSD.end() calls card.forceIdle() which will
     // (try to) put the card in the idle state.
@@ -120,8 +191,18 @@ cMeasurementLoop::initSdCard(
 bool
 cMeasurementLoop::checkSdCard()
     {
+    if (this->m_fSdMounted)
+        return true;
+
     sdPrep();
-    return gSD.begin(gSPI2, SPI_HALF_SPEED, kSdCardCSpin);
+    return this->sdMount();
+    }
+
+// mount the card at the configured SPI clock; power must already be up.
+bool
+cMeasurementLoop::sdMount()
+    {
+    return gSD.begin(gSPI2, this->m_sdSckRate, kSdCardCSpin);
     }
 
 static const char kHeader[] =
@@ -130,198 +211,754 @@ static const char kHeader[] =
     "Act[7],Act[6],Act[5],Act[4],Act[3],Act[2],Act[1],Act[0]"
     "\n";
 
+/*
+
+Name:   cMeasurementLoop::openSdDataFile()
+
+Function:
+    Open (creating if needed) the data file for a given day.
+
+Definition:
+    bool cMeasurementLoop::openSdDataFile(
+        File &dataFile,
+        const McciCatena::cDate &d,
+        bool fCompressed
+        );
+
+Description:
+    Data files are kept in per-month directories, as Data/YYYY/MM/DD.DAT,
+    so no directory holds more than a few dozen entries no matter how
+    long the card has been in service; the cost of finding the file
+    doesn't grow with the age of the card.
+
+    The year and month of the most recently created directory are
+    cached, so gSD.mkdir() is only called when the month changes. If the
+    open fails anyway (for example, because the card was swapped), the
+    cache is dropped and we try once more after re-creating the directory.
+
+    If fCompressed is set, the file is DD.DLZ instead of DD.DAT; see
+    Catena4430_cRecordCompressor.h for its format.
+
+Returns:
+    true if dataFile was opened for append.
+
+*/
+
 bool
-cMeasurementLoop::writeSdCard(
-    cMeasurementLoop::TxBuffer_t &b,
-    cMeasurementLoop::Measurement const & mData
+cMeasurementLoop::openSdDataFile(
+    File &dataFile,
+    const cDate &d,
+    bool fCompressed
     )
     {
-    cDate d;
-    bool fResult;
-    File dataFile;
+    char dirName[16];
+    char fName[32];
+    std::uint32_t const dirKey = d.year() * 100u + d.month();
+
+    McciAdkLib_Snprintf(dirName, sizeof(dirName), 0, "%s/%04u/%02u", kSdDataDir, d.year(), d.month());
+    McciAdkLib_Snprintf(fName, sizeof(fName), 0, "%s/%02u.%s", dirName, d.day(), fCompressed ? "dlz" : "dat");
 
-    if (! mData.DateTime.isValid())
+    for (unsigned nTry = 0; nTry < 2; ++nTry)
         {
-        gCatena.SafePrintf("RTC not set, not storing data!\n");
-        return false;
+        if (this->m_sdDirCacheKey != dirKey)
+            {
+            // gSD.mkdir() creates the parents as needed, and succeeds if
+            // the directory already exists.
+            if (! gSD.mkdir(dirName))
+                {
+                gCatena.SafePrintf("mkdir failed: %s\n", dirName);
+                return false;
+                }
+
+            this->m_sdDirCacheKey = dirKey;
+            }
+
+        dataFile = gSD.open(fName, FILE_WRITE);
+        if (dataFile)
+            return true;
+
+        // the card may have changed under us; forget what we knew.
+        this->m_sdDirCacheKey = 0;
         }
 
-    fResult = this->checkSdCard();
-    if (! fResult)
-        gCatena.SafePrintf("** SD card not detected!\n");
+    gCatena.SafePrintf("can't open: %s\n", fName);
+    return false;
+    }
+
+/*
+
+Name:   cMeasurementLoop::writeSdHeader()
 
-    if (fResult)
+Index:  Name:   cMeasurementLoop::writeSdRecord()
+
+Function:
+    Format the header line or a data record for the SD card.
+
+Definition:
+    static void cMeasurementLoop::writeSdHeader(
+        Print &out
+        );
+
+    void cMeasurementLoop::writeSdRecord(
+        Print &out,
+        const cMeasurementLoop::TxBuffer_t &b,
+        const cMeasurementLoop::Measurement &mData
+        ) const;
+
+Description:
+    The header line or the CSV record for mData (with the raw uplink
+    data from b) is written to out, including the trailing CR/LF.
+    out can be a File or a cRecordBuffer.
+
+*/
+
+void
+cMeasurementLoop::writeSdHeader(
+    Print &out
+    )
+    {
+    for (auto i : kHeader)
         {
-        // make a directory
-        fResult = gSD.mkdir("Data");
-        if (! fResult)
-            gCatena.SafePrintf("mkdir failed\n");
+        if (i == '\n')
+            {
+            out.println();
+            }
+        else if (i == '\0')
+            {
+            break;
+            }
+        else
+            {
+            out.print(i);
+            }
         }
+    }
 
-    if (fResult)
+// write the header line as the first frame of a new compressed file; it's
+// then the dictionary for the first record.
+bool
+cMeasurementLoop::writeSdCompressedHeader(
+    std::uint32_t fileKey
+    )
+    {
+    this->m_sdLzPrev.begin();
+    writeSdHeader(this->m_sdLzPrev);
+
+    auto const nFrame = cRecordCompressor::compress(
+                            nullptr, 0,
+                            this->m_sdLzPrev.getbase(), this->m_sdLzPrev.getn(),
+                            this->m_sdBuffers.writer.lzFrame, sizeof(this->m_sdBuffers.writer.lzFrame)
+                            );
+
+    if (nFrame == 0 || this->m_sdFile.write(this->m_sdBuffers.writer.lzFrame, nFrame) != nFrame)
         {
-        char fName[32];
-        bool fNew;
-        auto d = mData.DateTime;
-        McciAdkLib_Snprintf(fName, sizeof(fName), 0, "Data/%04u%02u%02u.dat", d.year(), d.month(), d.day());
+        this->m_fSdLzPrevValid = false;
+        return false;
+        }
+
+    this->m_fSdLzPrevValid = true;
+    this->m_sdLzFileKey = fileKey;
+    this->m_sdLzFileSize = this->m_sdFile.size();
+    return true;
+    }
+
+void
+cMeasurementLoop::writeSdRecord(
+    Print &out,
+    const cMeasurementLoop::TxBuffer_t &b,
+    const cMeasurementLoop::Measurement &mData
+    ) const
+    {
+    char buf[32];
+    auto const &d = mData.DateTime;
+
+    McciAdkLib_Snprintf(
+        buf, sizeof(buf), 0,
+        "%04u-%02u-%02uT%02u:%02u:%02u.%03uZ,",
+        d.year(), d.month(), d.day(),
+        d.hour(), d.minute(), d.second(),
+        unsigned(mData.DateTimeMs)
+        );
+    //gCatena.SafePrintf("write time\n");
+    out.print(buf);
+
+    //gCatena.SafePrintf("write DevEUI");
+    do  {
+        CatenaBase::EUI64_buffer_t devEUI;
 
-        fNew = !gSD.exists(fName);
-        if (fNew)
+    	auto const pFram = gCatena.getFram();
+
+        // use devEUI.
+        if (pFram != nullptr &&
+            pFram->getField(cFramStorage::StandardKeys::kDevEUI, devEUI))
             {
-            //gCatena.SafePrintf("%s not found, will create & write header\n", fName);
+            out.print('"');
+
+            /* write the devEUI */
+            for (auto i = 0; i < sizeof(devEUI.b); ++i)
+                {
+                // the devEUI is stored in little-endian order.
+                McciAdkLib_Snprintf(
+                    buf, sizeof(buf), 0,
+                    "%02x", devEUI.b[sizeof(devEUI.b) - i - 1]
+                    );
+                out.print(buf);
+                }
+
+            out.print('"');
             }
+        } while (0);
 
-        File dataFile = gSD.open(fName, FILE_WRITE);
-        if (dataFile)
+    out.print(',');
+
+    //gCatena.SafePrintf("write raw hex\n");
+    out.print('"');
+    for (unsigned i = 0; i < b.getn(); ++i)
+        {
+        McciAdkLib_Snprintf(
+            buf, sizeof(buf), 0,
+            "%02x",
+            b.getbase()[i]
+            );
+        out.print(buf);
+        }
+
+    out.print("\",");
+
+    //gCatena.SafePrintf("write Vbat\n");
+    if ((mData.flags & Flags::Vbat) != Flags(0))
+       out.print(mData.Vbat);
+
+    out.print(',');
+
+    if ((mData.flags & Flags::Vcc) != Flags(0))
+        out.print(mData.Vsystem);
+
+    out.print(',');
+
+    if ((mData.flags & Flags::Vbus) != Flags(0))
+        out.print(mData.Vbus);
+
+    out.print(',');
+
+    if ((mData.flags & Flags::Boot) != Flags(0))
+        out.print(mData.BootCount);
+
+    out.print(',');
+
+    if ((mData.flags & Flags::TPH) != Flags(0))
+        {
+        out.print(mData.env.Temperature);
+        out.print(',');
+
+        out.print(mData.env.Humidity);
+        out.print(',');
+        out.print(mData.env.Pressure);
+        out.print(',');
+        }
+    else
+        {
+        out.print(",,,");
+        }
+
+    if ((mData.flags & Flags::Light) != Flags(0))
+        {
+        out.print(mData.light.White);
+        }
+    out.print(',');
+
+    for (auto const & feeder : mData.pellets)
+        {
+        if ((mData.flags & Flags::Pellets) != Flags(0))
+            out.print(unsigned(feeder.Recent));
+        out.print(',');
+        if ((mData.flags & Flags::Pellets) != Flags(0))
+            out.print(feeder.Total);
+        out.print(',');
+        }
+
+    // the file has columns for the newest kMaxActivityEntriesSflt16
+    // samples; packed uplinks can have more, but they're all in the
+    // raw column.
+    unsigned const nActivity = mData.activity.size();
+    unsigned const iFirst = nActivity > kMaxActivityEntriesSflt16
+                                ? nActivity - kMaxActivityEntriesSflt16 : 0;
+
+    for (auto i = kMaxActivityEntriesSflt16; i > 0; )
+        {
+        --i;
+        if ((mData.flags & Flags::Activity) != Flags(0) &&
+            iFirst + i < nActivity)
+                out.print(mData.activity[iFirst + i].Avg);
+        if (i > 0)
+            out.print(',');
+        }
+
+    out.println();
+    }
+
+/*
+
+Name:   cMeasurementLoop::fsmDispatchSdWriter()
+
+Function:
+    Handle the sub-states that write a record to the SD card.
+
+Definition:
+    cMeasurementLoop::State cMeasurementLoop::fsmDispatchSdWriter(
+        cMeasurementLoop::State currentState,
+        bool fEntry
+        );
+
+Description:
+    Writing to the card is broken into steps -- power up, mount, open,
+    (optionally) compress, write (a chunk at a time), close, power
+    down -- so that no single call blocks the polling loop for long;
+    the PIR and pellet-feeder pollers keep running while we write. Each
+    step does its work on entry and returns stNoChange; poll()
+    re-evaluates the FSM on every pass while m_fSdBusy is set, and the
+    next evaluation moves us on.
+
+    If fSdCompress is set in the operating flags, records go to a .DLZ
+    file, compressed with cRecordCompressor using the previous record
+    as the dictionary.
+
+    The time taken by each evaluation is recorded in m_sdStats, so we
+    can see the longest time we kept the rest of the system waiting.
+
+Returns:
+    The next state, or State::stNoChange.
+
+*/
+
+cMeasurementLoop::State
+cMeasurementLoop::fsmDispatchSdWriter(
+    cMeasurementLoop::State currentState,
+    bool fEntry
+    )
+    {
+    State newState = State::stNoChange;
+
+    switch (currentState)
+        {
+    // format the record, and power up the card.
+    case State::stWriteFile:
+        if (fEntry)
             {
-            if (fNew)
+            this->m_fSdResult = false;
+
+            if (! this->fileData().DateTime.isValid())
+                {
+                gCatena.SafePrintf("RTC not set, not storing data!\n");
+                }
+            else
                 {
-                //gCatena.SafePrintf("write header\n");
-                for (auto i : kHeader)
+                this->m_sdRecord.begin();
+                this->writeSdRecord(this->m_sdRecord, this->m_txBuffer, this->fileData());
+                if (this->m_sdRecord.isOverflow())
                     {
-                    if (i == '\n')
-                        {
-                        dataFile.println();
-                        }
-                    else if (i == '\0')
-                        {
-                        break;
-                        }
-                    else
+                    gLog.printf(gLog.kBug, "SD record buffer overflow\n");
+                    }
+                else
+                    {
+                    this->m_fSdBusy = true;
+                    this->m_fSdResult = true;
+                    this->m_fSdCompress = (gCatena.GetOperatingFlags() &
+                                           static_cast<std::uint32_t>(OPERATING_FLAGS::fSdCompress)) != 0;
+                    this->m_sdCycleStartMs = millis();
+
+                    // if the card is still up from last time, we can
+                    // skip straight to opening the file.
+                    if (! this->m_fSdMounted)
                         {
-                        dataFile.print(i);
+                        this->sdPrepStart();
+                        this->setTimer(kSdPowerUpMs);
                         }
                     }
                 }
+            }
 
-            char buf[32];
-            McciAdkLib_Snprintf(
-                buf, sizeof(buf), 0,
-                "%04u-%02u-%02uT%02u:%02u:%02uZ,",
-                d.year(), d.month(), d.day(),
-                d.hour(), d.minute(), d.second()
-                );
-            //gCatena.SafePrintf("write time\n");
-            dataFile.print(buf);
+        if (! this->m_fSdBusy)
+            newState = this->sdWriterNextState();
+        else if (this->m_fSdMounted)
+            newState = State::stSdOpen;
+        else if (this->timedOut())
+            newState = State::stSdMount;
+        break;
+
+    case State::stSdMount:
+        if (fEntry)
+            {
+            this->m_fSdResult = this->sdMount();
+            if (! this->m_fSdResult)
+                gCatena.SafePrintf("** SD card not detected!\n");
+            break;
+            }
+
+        newState = this->m_fSdResult ? State::stSdOpen : State::stSdPowerDown;
+        break;
 
-            //gCatena.SafePrintf("write DevEUI");
-            do  {
-                CatenaBase::EUI64_buffer_t devEUI;
+    case State::stSdOpen:
+        if (fEntry)
+            {
+            auto const &d = this->fileData().DateTime;
+            std::uint32_t const fileKey = ((d.year() * 100 + d.month()) * 100 + d.day()) * 2 +
+                                          (this->m_fSdCompress ? 1 : 0);
 
-            	auto const pFram = gCatena.getFram();
+            // in persistent mode, the file may still be open; but
+            // records go into one file per day.
+            if (this->m_fSdFileOpen && this->m_sdFileKey == fileKey)
+                {
+                this->m_fSdResult = true;
+                }
+            else
+                {
+                this->sdCloseDataFile();
+                this->m_fSdResult = this->openSdDataFile(this->m_sdFile, d, this->m_fSdCompress);
 
-                // use devEUI.
-                if (pFram != nullptr &&
-                    pFram->getField(cFramStorage::StandardKeys::kDevEUI, devEUI))
+                if (this->m_fSdResult)
                     {
-                    dataFile.print('"');
+                    this->m_fSdFileOpen = true;
+                    this->m_sdFileKey = fileKey;
 
-                    /* write the devEUI */
-                    for (auto i = 0; i < sizeof(devEUI.b); ++i)
+                    // a brand-new file is empty: that's cheaper to check than
+                    // a separate directory lookup with gSD.exists().
+                    if (this->m_sdFile.size() == 0)
                         {
-                        // the devEUI is stored in little-endian order.
-                        McciAdkLib_Snprintf(
-                            buf, sizeof(buf), 0,
-                            "%02x", devEUI.b[sizeof(devEUI.b) - i - 1]
-                            );
-                        dataFile.print(buf);
+                        if (this->m_fSdCompress)
+                            this->m_fSdResult = this->writeSdCompressedHeader(fileKey);
+                        else
+                            writeSdHeader(this->m_sdFile);
                         }
-
-                    dataFile.print('"');
                     }
-                } while (0);
+                }
 
-            dataFile.print(',');
+            // we can only use the previous record as the dictionary if
+            // it's the last thing in this file.
+            this->m_fSdLzUseDict = this->m_fSdResult &&
+                                   this->m_fSdLzPrevValid &&
+                                   this->m_sdLzFileKey == fileKey &&
+                                   this->m_sdFile.size() == this->m_sdLzFileSize;
+
+            this->m_pSdWriteData = this->m_sdRecord.getbase();
+            this->m_nSdWriteData = this->m_sdRecord.getn();
+            this->m_sdRecordIndex = 0;
+            break;
+            }
 
-            //gCatena.SafePrintf("write raw hex\n");
-            dataFile.print('"');
-            for (unsigned i = 0; i < b.getn(); ++i)
+        if (! this->m_fSdResult)
+            newState = State::stSdPowerDown;
+        else if (this->m_fSdCompress)
+            newState = State::stSdCompress;
+        else
+            newState = State::stSdWrite;
+        break;
+
+    case State::stSdCompress:
+        if (fEntry)
+            {
+            auto const tStart = micros();
+            auto const nFrame = cRecordCompressor::compress(
+                                    this->m_sdLzPrev.getbase(),
+                                    this->m_fSdLzUseDict ? this->m_sdLzPrev.getn() : 0,
+                                    this->m_sdRecord.getbase(),
+                                    this->m_sdRecord.getn(),
+                                    this->m_sdBuffers.writer.lzFrame,
+                                    sizeof(this->m_sdBuffers.writer.lzFrame)
+                                    );
+            std::uint32_t const tCompress = micros() - tStart;
+
+            if (nFrame == 0)
                 {
-                McciAdkLib_Snprintf(
-                    buf, sizeof(buf), 0,
-                    "%02x",
-                    b.getbase()[i]
-                    );
-                dataFile.print(buf);
+                gLog.printf(gLog.kBug, "SD record compression failed\n");
+                this->m_fSdResult = false;
+                break;
                 }
 
-            dataFile.print("\",");
-
-            //gCatena.SafePrintf("write Vbat\n");
-            if ((mData.flags & Flags::Vbat) != Flags(0))
-               dataFile.print(mData.Vbat);
+            auto &stats = this->m_sdStats;
+            ++stats.nCompressed;
+            stats.compressRawBytes += this->m_sdRecord.getn();
+            stats.compressOutBytes += nFrame;
+            stats.compressUsTotal += tCompress;
+            if (tCompress > stats.compressUsMax)
+                stats.compressUsMax = tCompress;
+
+            this->m_pSdWriteData = this->m_sdBuffers.writer.lzFrame;
+            this->m_nSdWriteData = nFrame;
+            break;
+            }
 
-            dataFile.print(',');
+        newState = this->m_fSdResult ? State::stSdWrite : State::stSdClose;
+        break;
 
-            if ((mData.flags & Flags::Vcc) != Flags(0))
-                dataFile.print(mData.Vsystem);
+    case State::stSdWrite:
+        {
+        auto const nRecord = this->m_nSdWriteData;
+        auto const iRecord = this->m_sdRecordIndex;
 
-            dataFile.print(',');
+        if (iRecord >= nRecord)
+            {
+            // remember this record as the dictionary for the next.
+            if (this->m_fSdCompress)
+                {
+                this->m_sdLzPrev.copy(this->m_sdRecord);
+                this->m_fSdLzPrevValid = true;
+                this->m_sdLzFileKey = this->m_sdFileKey;
+                this->m_sdLzFileSize = this->m_sdFile.size();
+                }
 
-            if ((mData.flags & Flags::Vbus) != Flags(0))
-                dataFile.print(mData.Vbus);
+            newState = State::stSdClose;
+            break;
+            }
 
-            dataFile.print(',');
+        size_t n = nRecord - iRecord;
+        if (n > kSdWriteChunkBytes)
+            n = kSdWriteChunkBytes;
 
-            if ((mData.flags & Flags::Boot) != Flags(0))
-                dataFile.print(mData.BootCount);
+        if (this->m_sdFile.write(this->m_pSdWriteData + iRecord, n) != n)
+            {
+            gCatena.SafePrintf("SD write failed\n");
+            this->m_fSdResult = false;
+            this->m_fSdLzPrevValid = false;
+            newState = State::stSdClose;
+            break;
+            }
 
-            dataFile.print(',');
+        this->m_sdRecordIndex = iRecord + n;
+        }
+        break;
 
-            if ((mData.flags & Flags::TPH) != Flags(0))
+    case State::stSdClose:
+        if (fEntry)
+            {
+            // on USB power, leave the file open; poll() will flush it.
+            if (this->m_fSdResult && this->m_fUsbPower)
                 {
-                dataFile.print(mData.env.Temperature);
-                dataFile.print(',');
-
-                dataFile.print(mData.env.Humidity);
-                dataFile.print(',');
-                dataFile.print(mData.env.Pressure);
-                dataFile.print(',');
+                if (! this->m_fSdDirty)
+                    {
+                    this->m_fSdDirty = true;
+                    this->m_sdDirtyMs = millis();
+                    }
                 }
             else
                 {
-                dataFile.print(",,,");
+                this->sdCloseDataFile();
                 }
+            break;
+            }
 
-            if ((mData.flags & Flags::Light) != Flags(0))
-                {
-                dataFile.print(mData.light.White);
-                }
-            dataFile.print(',');
+        newState = State::stSdPowerDown;
+        break;
+
+    case State::stSdPowerDown:
+        if (fEntry)
+            {
+            // on USB power, leave the card mounted. After an error,
+            // power-cycle it in any case.
+            if (this->m_fSdResult && this->m_fUsbPower)
+                this->m_fSdMounted = true;
+            else
+                this->sdTeardown();
+            break;
+            }
+
+        this->m_fSdBusy = false;
+
+        ++this->m_sdStats.nCycles;
+        if (! this->m_fSdResult)
+            ++this->m_sdStats.nErrors;
+        this->m_sdStats.lastCycleMs = millis() - this->m_sdCycleStartMs;
+
+        if (this->isTraceEnabled(this->DebugFlags::kTrace))
+            gCatena.SafePrintf(
+                "SD write %s: %u ms; longest step so far %u us (%s)\n",
+                this->m_fSdResult ? "done" : "failed",
+                unsigned(this->m_sdStats.lastCycleMs),
+                unsigned(this->m_sdStats.maxStepUs),
+                getStateName(this->m_sdStats.maxStepState)
+                );
 
-            for (auto const & feeder : mData.pellets)
+        newState = this->sdWriterNextState();
+        break;
+
+    default:
+        break;
+        }
+
+    return newState;
+    }
+
+// where to go when the SD writer is done.
+cMeasurementLoop::State
+cMeasurementLoop::sdWriterNextState()
+    {
+    if (this->m_fSdResult)
+        return State::stTryToUpdate;
+    else if (gLoRaWAN.IsProvisioned())
+        return State::stTryToUpdate;
+    else
+        return State::stAwaitCard;
+    }
+
+/*
+
+Name:   cMeasurementLoop::migrateSdData()
+
+Function:
+    Move data files from the old flat layout to the per-month layout.
+
+Definition:
+    bool cMeasurementLoop::migrateSdData(
+        unsigned &nMoved,
+        unsigned &nFailed
+        );
+
+Description:
+    Older versions of this sketch wrote every daily file directly into
+    Data/, as Data/YYYYMMDD.DAT. We scan Data/ for such files, and copy
+    each one to Data/YYYY/MM/DD.DAT, then remove the original. If the
+    new-style file already exists (because data was logged after the
+    firmware was updated), the old records are appended without their
+    header line; the host tools sort records by time, so order within
+    a day doesn't matter.
+
+    The SD library can't rename files, so this is a copy; it's meant to
+    be run once per card, from the "sdmigrate" command.
+
+Returns:
+    true if the card could be scanned; nMoved and nFailed are set to the
+    number of files moved and the number that couldn't be moved.
+
+*/
+
+#define FUNCTION "cMeasurementLoop::migrateSdData"
+
+static bool
+parseFlatDataFileName(
+    const char *sName,
+    cDate &d
+    )
+    {
+    unsigned v[3] = { 0, 0, 0 };
+    static const std::uint8_t kWidth[3] = { 4, 2, 2 };
+    const char *p = sName;
+
+    for (unsigned i = 0; i < 3; ++i)
+        {
+        for (unsigned j = 0; j < kWidth[i]; ++j, ++p)
+            {
+            if (! ('0' <= *p && *p <= '9'))
+                return false;
+            v[i] = v[i] * 10 + (*p - '0');
+            }
+        }
+
+    if (! (p[0] == '.' &&
+           (p[1] == 'D' || p[1] == 'd') &&
+           (p[2] == 'A' || p[2] == 'a') &&
+           (p[3] == 'T' || p[3] == 't') &&
+           p[4] == '\0'))
+        return false;
+
+    if (! cDate::isValidYearMonthDay(v[0], v[1], v[2]))
+        return false;
+
+    d.setDate(v[0], v[1], v[2]);
+    return true;
+    }
+
+bool
+cMeasurementLoop::migrateSdData(
+    unsigned &nMoved,
+    unsigned &nFailed
+    )
+    {
+    nMoved = 0;
+    nFailed = 0;
+
+    // don't have the same file open twice.
+    this->sdCloseDataFile();
+
+    if (! this->checkSdCard())
+        {
+        this->sdFinish();
+        return false;
+        }
+
+    File dir = gSD.open(kSdDataDir);
+    if (! dir)
+        {
+        // no data directory: nothing to do.
+        this->sdFinish();
+        return true;
+        }
+
+    while (true)
+        {
+        File entry = dir.openNextFile();
+        if (! entry)
+            break;
+
+        cDate d;
+        char sOld[32];
+
+        if (entry.isDirectory() || ! parseFlatDataFileName(entry.name(), d))
+            {
+            entry.close();
+            continue;
+            }
+
+        McciAdkLib_Snprintf(sOld, sizeof(sOld), 0, "%s/%s", kSdDataDir, entry.name());
+
+        File newFile;
+        bool fOk = this->openSdDataFile(newFile, d);
+
+        if (fOk)
+            {
+            // if appending to an existing file, skip our header line.
+            if (newFile.size() != 0)
                 {
-                if ((mData.flags & Flags::Pellets) != Flags(0))
-                    dataFile.print(unsigned(feeder.Recent));
-                dataFile.print(',');
-                if ((mData.flags & Flags::Pellets) != Flags(0))
-                    dataFile.print(feeder.Total);
-                dataFile.print(',');
+                int c;
+                do  {
+                    c = entry.read();
+                    } while (c >= 0 && c != '\n');
                 }
 
-            for (auto i = kMaxActivityEntries; i > 0; )
+            std::uint8_t buf[128];
+            int n;
+            while ((n = entry.read(buf, sizeof(buf))) > 0)
                 {
-                --i;
-                if ((mData.flags & Flags::Activity) != Flags(0) &&
-                    i < mData.nActivity)
-                        dataFile.print(mData.activity[i].Avg);
-                if (i > 0)
-                    dataFile.print(',');
+                if (newFile.write(buf, n) != size_t(n))
+                    {
+                    fOk = false;
+                    break;
+                    }
                 }
 
-            dataFile.println();
-            dataFile.close();
+            newFile.close();
+            }
+
+        entry.close();
+
+        if (fOk && gSD.remove(sOld))
+            {
+            ++nMoved;
+            gLog.printf(gLog.kInfo, "%s: moved %s\n", FUNCTION, sOld);
             }
         else
             {
-            gCatena.SafePrintf("can't open: %s\n", fName);
+            ++nFailed;
+            gLog.printf(gLog.kError, "%s: couldn't move %s\n", FUNCTION, sOld);
             }
         }
 
-    sdFinish();
-    return fResult;
+    dir.close();
+    this->sdFinish();
+    return true;
     }
-
+
+#undef FUNCTION
+
 /*
 
 Name:	cMeasurementLoop::handleSdFirmwareUpdate()
@@ -341,8 +978,8 @@ Definition:
         );
 
 Description:
-    Check for a suitable file on the SD card. If found, copy to
-    flash. If successful, set the update flag, and rename the
+    Check for a suitable file on the SD card (update.delta, update.bin
+    or fallback.bin, in that order). If found, copy to flash. If successful, set the update flag, and rename the
     update file so we won't consider it again.  handleSdFirmwareUpdateCardUp()
     is simply the inner method, to be called as a wrapper once power is
     up on the card.
@@ -383,10 +1020,22 @@ cMeasurementLoop::handleSdFirmwareUpdateCardUp(
     void
     )
     {
-    static const char * const sUpdate[] = { "update.bin", "fallback.bin" };
+    static const struct
+        {
+        const char *sName;
+        cDownload::DownloadRq_t rq;
+        bool fDelta;
+        } sUpdate[] =
+        {
+        { "update.delta", cDownload::DownloadRq_t::GetUpdate, true },
+        { "update.bin", cDownload::DownloadRq_t::GetUpdate, false },
+        { "fallback.bin", cDownload::DownloadRq_t::GetFallback, false },
+        };
 
-    for (auto s : sUpdate)
+    for (auto const &u : sUpdate)
         {
+        auto const s = u.sName;
+
         if (! gSD.exists(s))
             {
             if (gLog.isEnabled(gLog.kTrace))
@@ -394,23 +1043,430 @@ cMeasurementLoop::handleSdFirmwareUpdateCardUp(
             continue;
             }
 
-        auto result = this->updateFromSd(
-                            s,
-                            s[0] == 'u' ? cDownload::DownloadRq_t::GetUpdate
-                                        : cDownload::DownloadRq_t::GetFallback
-                            );
+        auto result = this->updateFromSd(s, u.rq, u.fDelta);
         if (gLog.isEnabled(gLog.kTrace))
             gLog.printf(gLog.kTrace, "%s: applied update from %s: %s\n", FUNCTION, s, result ? "true": "false");
+
+        // a delta that doesn't apply is removed; try the others.
+        if (u.fDelta && ! result && ! gSD.exists(s))
+            continue;
+
         return result;
         }
 
     return false;
     }
 
+/*
+
+Name:   cSdPrefetchReader
+
+Function:
+    Double-buffered reader for the firmware update file.
+
+Description:
+    The downloader asks for data in kTransferChunkBytes pieces from
+    inside gCatena.poll(), and then spends a while erasing and
+    programming the SPI flash. The flash and the card share SPI2, so
+    they can't transfer at the same time; but while the flash is busy
+    internally (erasing a sector or programming a page), the bus is
+    free. So updateFromSd() calls fill() between polls, to read the next
+    block of the file into the idle buffer while the flash is working.
+    read() then just copies from memory, and only reads the card itself
+    if the prefetch didn't keep up.
+
+    Reads are always a whole kBufferSize (one SD sector) at a sector-
+    aligned file offset, so the SD library transfers straight into our
+    buffer rather than through its one-sector cache.
+
+*/
+
+class cSdPrefetchReader
+    {
+public:
+    static constexpr size_t kBufferSize = 512;
+
+    void begin(File *pFile)
+        {
+        this->m_pFile = pFile;
+        this->m_iCurrent = 0;
+        this->m_fEof = false;
+        this->m_nStalls = 0;
+        for (auto &b : this->m_buf)
+            b.n = b.i = 0;
+        }
+
+    // fill the idle buffer, if it's empty. Returns true if we read.
+    bool fill()
+        {
+        auto &b = this->m_buf[this->m_iCurrent ^ 1];
+
+        if (b.i < b.n || this->m_fEof)
+            return false;
+
+        this->fillBuffer(b);
+        return true;
+        }
+
+    // copy up to nBuffer bytes of the file; returns number copied,
+    // which is less than nBuffer only at end of file.
+    size_t read(std::uint8_t *pBuffer, size_t nBuffer)
+        {
+        size_t nResult = 0;
+
+        while (nResult < nBuffer)
+            {
+            auto *pb = &this->m_buf[this->m_iCurrent];
+
+            if (pb->i >= pb->n)
+                {
+                // current buffer is used up; switch to the other one,
+                // or read now if the prefetch didn't get to it.
+                this->m_iCurrent ^= 1;
+                pb = &this->m_buf[this->m_iCurrent];
+
+                if (pb->i >= pb->n)
+                    {
+                    if (this->m_fEof)
+                        break;
+
+                    ++this->m_nStalls;
+                    this->fillBuffer(*pb);
+                    if (pb->n == 0)
+                        break;
+                    }
+                }
+
+            size_t n = pb->n - pb->i;
+            if (n > nBuffer - nResult)
+                n = nBuffer - nResult;
+
+            memcpy(pBuffer + nResult, pb->data + pb->i, n);
+            pb->i += n;
+            nResult += n;
+            }
+
+        return nResult;
+        }
+
+    // number of times read() had to wait for the card.
+    std::uint32_t getStalls() const
+        {
+        return this->m_nStalls;
+        }
+
+private:
+    struct Buffer
+        {
+        alignas(4) std::uint8_t data[kBufferSize];
+        size_t  n;
+        size_t  i;
+        };
+
+    void fillBuffer(Buffer &b)
+        {
+        int const n = this->m_pFile->read(b.data, sizeof(b.data));
+
+        b.i = 0;
+        b.n = n > 0 ? size_t(n) : 0;
+        if (b.n < sizeof(b.data))
+            this->m_fEof = true;
+        }
+
+    Buffer          m_buf[2];
+    File            *m_pFile;
+    unsigned        m_iCurrent;
+    bool            m_fEof;
+    std::uint32_t   m_nStalls;
+    };
+
+/*
+
+Name:   cSdDeltaReader
+
+Function:
+    Rebuild a firmware image from the running image and a delta file.
+
+Description:
+    update.delta describes a new image as a list of operations against
+    the image we're running: copy a range from the running image (read
+    straight out of internal flash, starting at the vector table), or
+    insert bytes that follow in the delta file. All values are little
+    endian. The file starts with a 32-byte header:
+
+        0   4   magic, "C4DL"
+        4   2   version (kVersion)
+        6   2   size of header (32)
+        8   4   length of the old (running) image
+        12  4   CRC-32 of the old image
+        16  4   length of the new image
+        20  4   CRC-32 of the new image
+        24  8   reserved, zero
+
+    followed by the operations:
+
+        kOpCopy     4 bytes offset in old image, 4 bytes length
+        kOpInsert   4 bytes length, then that many bytes of data
+        kOpEnd      (end of operations)
+
+    read() produces the new image a buffer at a time, as the downloader
+    asks for it; the only state is the current operation. validate()
+    runs through the whole delta without writing anything, and checks
+    the old image and the result against the CRCs in the header; it's
+    run before the flash is touched. extra/catena4430-fwdelta.cpp makes
+    and checks delta files on a PC.
+
+*/
+
+class cSdDeltaReader
+    {
+public:
+    static constexpr std::uint32_t kMagic = 0x4C443443; // "C4DL"
+    static constexpr std::uint16_t kVersion = 1;
+    static constexpr size_t kHeaderSize = 32;
+    static constexpr std::uint8_t kOpEnd = 0;
+    static constexpr std::uint8_t kOpCopy = 1;
+    static constexpr std::uint8_t kOpInsert = 2;
+
+    // read and check the header.
+    bool begin(File *pFile, cSdPrefetchReader *pReader)
+        {
+        std::uint8_t header[kHeaderSize];
+
+        this->m_pReader = pReader;
+        this->m_pOld = (const std::uint8_t *)SCB->VTOR;
+        this->m_fError = false;
+        this->m_fEnd = false;
+        this->m_nOutput = 0;
+        this->m_opRemaining = 0;
+
+        pFile->seek(0);
+        pReader->begin(pFile);
+        if (pReader->read(header, sizeof(header)) != sizeof(header) ||
+            get32(header + 0) != kMagic ||
+            get16(header + 4) != kVersion ||
+            get16(header + 6) != kHeaderSize)
+            {
+            return false;
+            }
+
+        this->m_oldLength = get32(header + 8);
+        this->m_oldCrc = get32(header + 12);
+        this->m_newLength = get32(header + 16);
+        this->m_newCrc = get32(header + 20);
+
+#ifdef FLASH_END
+        if (SCB->VTOR + this->m_oldLength - 1 > FLASH_END)
+            return false;
+#endif
+        return true;
+        }
+
+    // produce up to nBuffer bytes of the new image; returns number of
+    // bytes produced, less than nBuffer only at the end (or on error).
+    size_t read(std::uint8_t *pBuffer, size_t nBuffer)
+        {
+        size_t nResult = 0;
+
+        while (nResult < nBuffer && ! this->m_fEnd && ! this->m_fError)
+            {
+            if (this->m_opRemaining == 0)
+                {
+                this->nextOp();
+                continue;
+                }
+
+            size_t n = nBuffer - nResult;
+            if (n > this->m_opRemaining)
+                n = this->m_opRemaining;
+
+            if (this->m_op == kOpCopy)
+                {
+                memcpy(pBuffer + nResult, this->m_pOld + this->m_oldOffset, n);
+                this->m_oldOffset += n;
+                }
+            else if (this->m_pReader->read(pBuffer + nResult, n) != n)
+                {
+                this->m_fError = true;
+                break;
+                }
+
+            this->m_opRemaining -= n;
+            nResult += n;
+            }
+
+        this->m_nOutput += nResult;
+        if (this->m_nOutput > this->m_newLength)
+            this->m_fError = true;
+
+        return nResult;
+        }
+
+    // run through the delta, checking the CRCs, without writing anything.
+    bool validate()
+        {
+        cCrc32 crc;
+        std::uint8_t buf[64];
+        size_t n;
+
+        crc.begin();
+        crc.update(this->m_pOld, this->m_oldLength);
+        if (crc.get() != this->m_oldCrc)
+            {
+            gLog.printf(gLog.kError, "update.delta: not for this image\n");
+            return false;
+            }
+
+        crc.begin();
+        while ((n = this->read(buf, sizeof(buf))) != 0)
+            crc.update(buf, n);
+
+        if (this->m_fError || ! this->m_fEnd ||
+            this->m_nOutput != this->m_newLength ||
+            crc.get() != this->m_newCrc)
+            {
+            gLog.printf(gLog.kError, "update.delta: damaged\n");
+            return false;
+            }
+
+        return true;
+        }
+
+    std::uint32_t getNewLength() const
+        {
+        return this->m_newLength;
+        }
+    std::uint32_t getNewCrc() const
+        {
+        return this->m_newCrc;
+        }
+    bool isError() const
+        {
+        return this->m_fError;
+        }
+
+private:
+    static std::uint16_t get16(const std::uint8_t *p)
+        {
+        return std::uint16_t(p[0] | (p[1] << 8));
+        }
+    static std::uint32_t get32(const std::uint8_t *p)
+        {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (std::uint32_t(p[3]) << 24);
+        }
+
+    // read the next operation.
+    void nextOp()
+        {
+        std::uint8_t buf[8];
+
+        if (this->m_pReader->read(&this->m_op, 1) != 1)
+            {
+            this->m_fError = true;
+            return;
+            }
+
+        switch (this->m_op)
+            {
+        case kOpEnd:
+            this->m_fEnd = true;
+            break;
+
+        case kOpCopy:
+            if (this->m_pReader->read(buf, 8) != 8)
+                {
+                this->m_fError = true;
+                break;
+                }
+            this->m_oldOffset = get32(buf);
+            this->m_opRemaining = get32(buf + 4);
+            if (this->m_oldOffset > this->m_oldLength ||
+                this->m_opRemaining > this->m_oldLength - this->m_oldOffset)
+                this->m_fError = true;
+            break;
+
+        case kOpInsert:
+            if (this->m_pReader->read(buf, 4) != 4)
+                {
+                this->m_fError = true;
+                break;
+                }
+            this->m_opRemaining = get32(buf);
+            break;
+
+        default:
+            this->m_fError = true;
+            break;
+            }
+        }
+
+    cSdPrefetchReader   *m_pReader;
+    const std::uint8_t  *m_pOld;
+    std::uint32_t       m_oldLength;
+    std::uint32_t       m_oldCrc;
+    std::uint32_t       m_newLength;
+    std::uint32_t       m_newCrc;
+    std::uint32_t       m_nOutput;
+    std::uint32_t       m_oldOffset;
+    std::uint32_t       m_opRemaining;
+    std::uint8_t        m_op;
+    bool                m_fError;
+    bool                m_fEnd;
+    };
+
+/*
+
+Name:   isRunningImage()
+
+Function:
+    Check whether an image is the one we're running.
+
+Definition:
+    static bool isRunningImage(
+        std::uint32_t length,
+        std::uint32_t crc
+        );
+
+Description:
+    The bootloader copies an update image to the start of the
+    application area of the internal flash, so the image we're running
+    is simply the first length bytes at SCB->VTOR. We compute their
+    CRC-32 and compare. Nothing is saved between updates, so this
+    stays right however the running image got there.
+
+    A delta says up front what it will produce. A full image has to be
+    read to be checked, so updateFromSd() makes a pass over update.bin
+    first. Either way, this is checked before touching the SPI flash.
+
+Returns:
+    true if the image we're running is length bytes long with this CRC.
+
+*/
+
+static bool isRunningImage(
+    std::uint32_t length,
+    std::uint32_t crc
+    )
+    {
+    if (length == 0)
+        return false;
+#ifdef FLASH_END
+    if (SCB->VTOR + length - 1 > FLASH_END)
+        return false;
+#endif
+
+    cCrc32 crcRunning;
+
+    crcRunning.begin();
+    crcRunning.update((const std::uint8_t *)SCB->VTOR, length);
+    return crcRunning.get() == crc;
+    }
+
 bool
 cMeasurementLoop::updateFromSd(
     const char *sUpdate,
-    cDownload::DownloadRq_t rq
+    cDownload::DownloadRq_t rq,
+    bool fDelta
     )
     {
     // launch a programming cycle. We'll stall the measurement FSM here while
@@ -422,9 +1478,34 @@ cMeasurementLoop::updateFromSd(
             File firmwareFile;
             cDownload::Status_t status;
             cDownload::Request_t request;
+            cSdPrefetchReader *pReader;
+            cSdDeltaReader *pDelta;
+            cCrc32 crc;
+            std::uint32_t nBytes;
+            bool fMismatch;
             };
+    // the prefetch buffers take 1K; rather than put them on the stack,
+    // or keep them for the whole run, borrow the SD writer's buffers,
+    // which are idle while we're here. The dictionary is lost.
+    struct UpdateReaders
+            {
+            cSdPrefetchReader reader;
+            cSdDeltaReader delta;
+            };
+    static_assert(
+        sizeof(UpdateReaders) <= sizeof(SdBuffers::update),
+        "kSdUpdateBufferSize is too small"
+        );
+    this->m_fSdLzPrevValid = false;
+    auto const pReaders = new (this->m_sdBuffers.update) UpdateReaders;
+    auto & sReader = pReaders->reader;
+    auto & sDelta = pReaders->delta;
     context_t context { this, true };
 
+    context.pReader = &sReader;
+    context.pDelta = nullptr;
+    context.fMismatch = false;
+
     this->m_fFwUpdate = true;
 
     gLog.printf(gLog.kInfo, "Attempting to load firmware from %s\n", sUpdate);
@@ -458,6 +1539,66 @@ cMeasurementLoop::updateFromSd(
         return false;
         }
 
+    // a delta must apply to the image we're running, and produce what
+    // it says it does; check before touching the flash.
+    if (fDelta)
+        {
+        if (! sDelta.begin(&context.firmwareFile, &sReader) || ! sDelta.validate())
+            {
+            gLog.printf(gLog.kError, "%s: can't apply %s, removing it\n", FUNCTION, sUpdate);
+            context.firmwareFile.close();
+            gSD.remove(sUpdate);
+            return false;
+            }
+
+        // don't wear out the flash loading the image we're running.
+        if (isRunningImage(sDelta.getNewLength(), sDelta.getNewCrc()))
+            {
+            gLog.printf(gLog.kInfo, "%s: %s is already running, skipping\n", FUNCTION, sUpdate);
+            context.firmwareFile.close();
+            gSD.remove(sUpdate);
+            return false;
+            }
+
+        // rewind.
+        sDelta.begin(&context.firmwareFile, &sReader);
+        context.pDelta = &sDelta;
+        }
+    // someone left update.bin on the card; don't erase and reload the
+    // flash if it's the image we're running. Reading the card is much
+    // cheaper than erasing the flash.
+    else if (rq == cDownload::DownloadRq_t::GetUpdate)
+        {
+        std::uint8_t buf[64];
+        std::uint32_t nBytes = 0;
+        size_t n;
+
+        sReader.begin(&context.firmwareFile);
+        context.crc.begin();
+        do  {
+            sReader.fill();
+            n = sReader.read(buf, sizeof(buf));
+            context.crc.update(buf, n);
+            nBytes += n;
+            } while (n == sizeof(buf));
+
+        if (isRunningImage(nBytes, context.crc.get()))
+            {
+            gLog.printf(gLog.kInfo, "%s: %s is already running, skipping\n", FUNCTION, sUpdate);
+            context.firmwareFile.close();
+            gSD.remove(sUpdate);
+            return false;
+            }
+
+        // rewind.
+        if (! context.firmwareFile.seek(0))
+            {
+            gLog.printf(gLog.kError, "%s: can't rewind %s\n", FUNCTION, sUpdate);
+            context.firmwareFile.close();
+            return false;
+            }
+        }
+
     // the downloader requires a "request block" that tells it what to do.
     // since we loop in this function, we can allocate it as a local variable,
     // and keep it in the context object. Save some typing by defining an
@@ -500,22 +1641,39 @@ cMeasurementLoop::updateFromSd(
 
     // initialize the read-byte callback
     request.ReadBytes.init(
-        // this is called each time the downloader wants more data
+        // this is called each time the downloader wants more data;
+        // normally, the data has already been read by the prefetcher.
         [](void *pUserData, std::uint8_t *pBuffer, size_t nBuffer) -> size_t
             {
             context_t * const pCtx = (context_t *)pUserData;
 
-            gLog.printf(gLog.kInfo, ".");
-            gCatena.poll();
+            auto n = pCtx->pDelta != nullptr ? pCtx->pDelta->read(pBuffer, nBuffer)
+                                             : pCtx->pReader->read(pBuffer, nBuffer);
+            pCtx->crc.update(pBuffer, n);
+            pCtx->nBytes += n;
+
+            // check a delta's result when it ends, before the last block
+            // goes to the flash. The end of an image is its signature, so
+            // if we send blank data instead, the image is never loaded.
+            auto const pDelta = pCtx->pDelta;
+            if (pDelta != nullptr && ! pCtx->fMismatch &&
+                (n < nBuffer || pCtx->nBytes >= pDelta->getNewLength()) &&
+                (pDelta->isError() ||
+                 pCtx->nBytes != pDelta->getNewLength() ||
+                 pCtx->crc.get() != pDelta->getNewCrc()))
+                {
+                pCtx->fMismatch = true;
+                }
+
+            if (pCtx->fMismatch)
+                n = 0;
 
-            auto n = pCtx->firmwareFile.readBytes(pBuffer, nBuffer);
             if (n < nBuffer)
                 {
                 // at end of file we have spare bytes that are not
                 // used. Initialize to 0xFF because that's nice for
                 // SPI flash.
                 memset(pBuffer + n, 0xFF, nBuffer - n);
-                gLog.printf(gLog.kInfo, "\n");
                 }
 
             return nBuffer;
@@ -539,6 +1697,17 @@ cMeasurementLoop::updateFromSd(
     // set the request code in the request.
     request.rq = rq;
 
+    // start the prefetcher (already done for a delta), and get the first
+    // block in.
+    if (! fDelta)
+        context.pReader->begin(&context.firmwareFile);
+    context.pReader->fill();
+    context.crc.begin();
+    context.nBytes = 0;
+
+    std::uint32_t const fileSize = fDelta ? sDelta.getNewLength() : context.firmwareFile.size();
+    std::uint32_t const tStart = millis();
+
     // launch the request.
     if (! gDownload.evStart(request))
         {
@@ -552,11 +1721,27 @@ cMeasurementLoop::updateFromSd(
 
     // it launched: wait for transfer to complete
     while (context.fWorking)
+        {
         // give other clients a chance to look in.
         // and allow the download to be coded asynchronously
         // if necessary.
         gCatena.poll();
 
+        // read ahead while the flash is busy.
+        context.pReader->fill();
+        }
+
+    std::uint32_t const tUpdate = millis() - tStart;
+    gLog.printf(
+        gLog.kInfo,
+        "%s: %u bytes in %u ms (%u bytes/s), %u stalls\n",
+        FUNCTION,
+        unsigned(fileSize),
+        unsigned(tUpdate),
+        unsigned(tUpdate == 0 ? 0 : std::uint64_t(fileSize) * 1000 / tUpdate),
+        unsigned(context.pReader->getStalls())
+        );
+
     // download operation is complete.
     // close and remove the file
     context.firmwareFile.close();
@@ -569,6 +1754,13 @@ cMeasurementLoop::updateFromSd(
         // no need to reboot.
         return false;
         }
+    // the delta was checked up front, and again as it ended; if something
+    // changed since, the end of the image was blanked.
+    else if (context.fMismatch)
+        {
+        gLog.printf(gLog.kError, "delta update failed: image doesn't match\n");
+        return false;
+        }
     // if it succeeeded, say so, and tell caller to reboot.
     // don't reboot here, because the outer app may need to shut things down
     // in an orderly way.
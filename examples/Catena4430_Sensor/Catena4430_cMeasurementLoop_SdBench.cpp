@@ -0,0 +1,380 @@
+/*
+
+Module: Catena4430_cMeasurementLoop_SdBench.cpp
+
+Function:
+    SD card benchmark, and persistent SD card configuration.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#include "Catena4430_cMeasurementLoop.h"
+
+#include "Catena4430_FramLayout.h"
+#include "Catena4430_Sensor.h"
+
+#include <Catena_Fram.h>
+
+#include <SD.h>
+#include <mcciadk_baselib.h>
+
+using namespace McciCatena4430;
+using namespace McciCatena;
+
+/****************************************************************************\
+|
+|   Manifest constants & typedefs.
+|
+\****************************************************************************/
+
+// the benchmark scratch file, in the root directory.
+constexpr char kSdBenchFileName[] = "SDBENCH.TMP";
+
+// size of each block in the sequential test; also size of the buffer.
+constexpr size_t kSdBenchBlockSize = 512;
+
+// number of blocks in the sequential test.
+constexpr unsigned kSdBenchSeqBlocks = 64;
+
+// size and number of records in the small-append test.
+constexpr size_t kSdBenchAppendSize = 64;
+constexpr unsigned kSdBenchAppendCount = 32;
+
+// how long to wait for the card to come ready after power-up.
+constexpr std::uint32_t kSdBenchReadyTimeoutMs = 1000;
+
+// upper limits of the histogram buckets, in microseconds; the last
+// bucket catches everything else.
+static const std::uint32_t kSdBenchBucketLimitUs[cMeasurementLoop::kSdBenchBuckets - 1] =
+    {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000,
+    };
+
+// the FRAM record holding the SD card configuration.
+struct SdConfig
+    {
+    static constexpr std::uint32_t kMagic = 0x31434453; // "SDC1"
+
+    std::uint32_t   magic;
+    std::uint8_t    sckRate;
+    std::uint8_t    sckRateCheck;   // ~sckRate
+    std::uint8_t    reserved[FramLayout::kSdConfigSize - 6];
+    };
+
+static_assert(sizeof(SdConfig) == FramLayout::kSdConfigSize, "SdConfig doesn't match FRAM layout");
+
+/****************************************************************************\
+|
+|   Code.
+|
+\****************************************************************************/
+
+/*
+
+Name:   cMeasurementLoop::loadSdConfig()
+
+Index:  Name:   cMeasurementLoop::saveSdSckRate()
+
+Function:
+    Load or save the SD card configuration in FRAM.
+
+Definition:
+    void cMeasurementLoop::loadSdConfig();
+
+    bool cMeasurementLoop::saveSdSckRate(
+        std::uint8_t sckRate
+        );
+
+Description:
+    The SPI clock used to talk to the SD card is an SD library
+    "sckRateID": 0 is fastest (25 MHz requested), each step up halves
+    the clock, and SPI_HALF_SPEED (1, or 4 MHz) is the default.
+
+    loadSdConfig() sets m_sdSckRate from FRAM, or to the default if
+    there's no valid record. saveSdSckRate() sets m_sdSckRate and writes
+    it to FRAM; if sckRate is kSdSckRateDefault, the record is erased
+    instead.
+
+Returns:
+    saveSdSckRate() returns true if FRAM was written.
+
+*/
+
+void
+cMeasurementLoop::loadSdConfig()
+    {
+    SdConfig config;
+    auto const pFram = gCatena.getFram();
+
+    this->m_sdSckRate = kSdSckRateDefault;
+
+    if (pFram == nullptr)
+        return;
+
+    pFram->read(FramLayout::kSdConfigOffset, (std::uint8_t *)&config, sizeof(config));
+
+    if (config.magic == SdConfig::kMagic &&
+        config.sckRate == std::uint8_t(~config.sckRateCheck) &&
+        config.sckRate <= kSdSckRateSlowest)
+        {
+        this->m_sdSckRate = config.sckRate;
+        }
+    }
+
+bool
+cMeasurementLoop::saveSdSckRate(
+    std::uint8_t sckRate
+    )
+    {
+    SdConfig config;
+    auto const pFram = gCatena.getFram();
+
+    if (sckRate > kSdSckRateSlowest)
+        return false;
+
+    this->m_sdSckRate = sckRate;
+
+    if (pFram == nullptr)
+        return false;
+
+    memset(&config, 0, sizeof(config));
+    if (sckRate != kSdSckRateDefault)
+        {
+        config.magic = SdConfig::kMagic;
+        config.sckRate = sckRate;
+        config.sckRateCheck = ~sckRate;
+        }
+
+    pFram->write(FramLayout::kSdConfigOffset, (const std::uint8_t *)&config, sizeof(config));
+    return true;
+    }
+
+// return the nominal SPI clock for an SD library sckRateID.
+std::uint32_t
+cMeasurementLoop::getSdSckHz(
+    std::uint8_t sckRate
+    )
+    {
+    // matches the table in Sd2Card::setSckRate().
+    return sckRate == 0 ? 25000000 : 8000000 >> sckRate;
+    }
+
+// return a printable name for a histogram bucket.
+const char *
+cMeasurementLoop::getSdBenchBucketName(
+    unsigned iBucket
+    )
+    {
+    static const char * const kNames[kSdBenchBuckets] =
+        {
+        "<1ms", "<2ms", "<5ms", "<10ms", "<20ms", "<50ms", "<100ms", ">=100ms",
+        };
+
+    return iBucket < kSdBenchBuckets ? kNames[iBucket] : "?";
+    }
+
+// fill a benchmark block with a pattern that depends on where it goes.
+static void
+fillSdBenchBlock(
+    std::uint8_t *pBuffer,
+    size_t nBuffer,
+    std::uint32_t offset,
+    std::uint8_t seed
+    )
+    {
+    for (size_t i = 0; i < nBuffer; ++i)
+        {
+        std::uint32_t const v = offset + i;
+        pBuffer[i] = std::uint8_t(v ^ (v >> 8) ^ (v >> 16) ^ seed);
+        }
+    }
+
+/*
+
+Name:   cMeasurementLoop::runSdBench()
+
+Function:
+    Benchmark the SD card at a given SPI clock.
+
+Definition:
+    bool cMeasurementLoop::runSdBench(
+        std::uint8_t sckRate,
+        cMeasurementLoop::SdBenchResult &result
+        );
+
+Description:
+    The card is powered down, then powered up and mounted at the given
+    sckRate, and the following are measured:
+
+    - time from power-up until the card mounts, and time for the
+      successful mount call;
+    - sequential write throughput, writing kSdBenchSeqBlocks blocks of
+      kSdBenchBlockSize bytes to one file;
+    - small-append throughput and latency, doing kSdBenchAppendCount
+      open/write/close cycles of kSdBenchAppendSize bytes, as the data
+      logger does; each latency is counted in a histogram.
+
+    Everything written is then read back and compared. The scratch file
+    is removed and the card is powered down.
+
+    This blocks for up to a few seconds, so it's meant for use from the
+    console only. The caller must make sure the SD writer isn't busy.
+
+Returns:
+    true if the card mounted, all the writes succeeded and the data
+    read back correctly.
+
+*/
+
+#define FUNCTION "cMeasurementLoop::runSdBench"
+
+bool
+cMeasurementLoop::runSdBench(
+    std::uint8_t sckRate,
+    cMeasurementLoop::SdBenchResult &result
+    )
+    {
+    std::uint8_t buf[kSdBenchBlockSize];
+
+    memset(&result, 0, sizeof(result));
+    result.sckRate = sckRate;
+
+    // start cold.
+    this->sdTeardown();
+    delay(kSdPowerUpMs);
+
+    // power up, and try to mount until the card is ready.
+    auto const tPowerUp = millis();
+    this->sdPrepStart();
+
+    do  {
+        auto const tMount = micros();
+        if (gSD.begin(gSPI2, sckRate, kSdCardCSpin))
+            {
+            result.mountUs = micros() - tMount;
+            result.readyMs = millis() - tPowerUp;
+            result.fMounted = true;
+            break;
+            }
+        delay(10);
+        } while (millis() - tPowerUp < kSdBenchReadyTimeoutMs);
+
+    if (! result.fMounted)
+        {
+        this->sdEnd();
+        return false;
+        }
+
+    gSD.remove(kSdBenchFileName);
+
+    bool fOk = true;
+
+    // sequential write.
+    do  {
+        File f = gSD.open(kSdBenchFileName, FILE_WRITE);
+        if (! f)
+            {
+            fOk = false;
+            break;
+            }
+
+        auto const tStart = micros();
+        for (unsigned i = 0; i < kSdBenchSeqBlocks; ++i)
+            {
+            fillSdBenchBlock(buf, sizeof(buf), i * sizeof(buf), sckRate);
+            if (f.write(buf, sizeof(buf)) != sizeof(buf))
+                {
+                fOk = false;
+                break;
+                }
+            }
+        f.close();
+
+        auto const tSeq = micros() - tStart;
+        if (tSeq != 0)
+            result.seqBytesPerSec = std::uint32_t(
+                std::uint64_t(kSdBenchSeqBlocks * sizeof(buf)) * 1000000 / tSeq
+                );
+        } while (0);
+
+    // small appends, as the data logger does them.
+    std::uint32_t const seqBytes = kSdBenchSeqBlocks * sizeof(buf);
+    std::uint32_t tAppendTotal = 0;
+
+    for (unsigned i = 0; fOk && i < kSdBenchAppendCount; ++i)
+        {
+        std::uint32_t const offset = seqBytes + i * kSdBenchAppendSize;
+
+        fillSdBenchBlock(buf, kSdBenchAppendSize, offset, sckRate);
+
+        auto const tStart = micros();
+        File f = gSD.open(kSdBenchFileName, FILE_WRITE);
+        if (! f)
+            {
+            fOk = false;
+            break;
+            }
+        if (f.write(buf, kSdBenchAppendSize) != kSdBenchAppendSize)
+            fOk = false;
+        f.close();
+        std::uint32_t const tAppend = micros() - tStart;
+
+        tAppendTotal += tAppend;
+        if (tAppend > result.appendMaxUs)
+            result.appendMaxUs = tAppend;
+
+        unsigned iBucket;
+        for (iBucket = 0; iBucket < kSdBenchBuckets - 1; ++iBucket)
+            {
+            if (tAppend < kSdBenchBucketLimitUs[iBucket])
+                break;
+            }
+        ++result.histogram[iBucket];
+        }
+
+    if (fOk && tAppendTotal != 0)
+        result.appendBytesPerSec = std::uint32_t(
+            std::uint64_t(kSdBenchAppendCount * kSdBenchAppendSize) * 1000000 / tAppendTotal
+            );
+
+    // read back and compare.
+    if (fOk)
+        {
+        std::uint32_t const nTotal = seqBytes + kSdBenchAppendCount * kSdBenchAppendSize;
+        std::uint8_t expect[kSdBenchAppendSize];
+        File f = gSD.open(kSdBenchFileName, FILE_READ);
+
+        if (! f || f.size() != nTotal)
+            {
+            gLog.printf(gLog.kError, "%s: rate %u: bad file size\n", FUNCTION, sckRate);
+            fOk = false;
+            }
+
+        for (std::uint32_t offset = 0; fOk && offset < nTotal; offset += sizeof(expect))
+            {
+            fillSdBenchBlock(expect, sizeof(expect), offset, sckRate);
+            if (f.read(buf, sizeof(expect)) != int(sizeof(expect)) ||
+                memcmp(buf, expect, sizeof(expect)) != 0)
+                {
+                gLog.printf(gLog.kError, "%s: rate %u: mismatch at %u\n", FUNCTION, sckRate, unsigned(offset));
+                fOk = false;
+                }
+            }
+
+        if (f)
+            f.close();
+        }
+
+    gSD.remove(kSdBenchFileName);
+    this->sdEnd();
+
+    result.fVerified = fOk;
+    return fOk;
+    }
+
+#undef FUNCTION
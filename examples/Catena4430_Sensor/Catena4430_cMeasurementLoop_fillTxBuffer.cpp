@@ -17,6 +17,14 @@ Author:
 
 #include <arduino_lmic.h>
 
+// arduino_lmic.h doesn't export the band plan's frame length limits;
+// getMaxUplinkPayload() needs them.
+#include <lmic/lmic_bandplan.h>
+
+#if ! defined(LMICbandplan_maxFrameLen)
+# error "LMICbandplan_maxFrameLen() isn't defined; can't size uplinks for the data rate"
+#endif
+
 using namespace McciCatena4430;
 
 /*
@@ -28,18 +36,36 @@ Function:
 
 Definition:
     void McciCatena4430::cMeasurementLoop::fillTxBuffer(
-            cMeasurementLoop::TxBuffer_t& b
+            cMeasurementLoop::TxBuffer_t& b,
+            Measurement const &mData,
+            size_t nLimit
             );
 
 Description:
     A format 0x22 message is prepared from the data in the cMeasurementLoop
-    object.
+    object; or, if fPackedActivity is set in the operating flags, a format
+    0x24 message, which is the same except for the activity field.
+
+    The message is at most nLimit bytes; when it's to be sent by itself,
+    that's the limit for the current data rate (see getTxBufferLimit()
+    and getMaxUplinkPayload()). The voltages, boot count, and
+    environmental and light readings are included if they all fit, as
+    they do at all but the lowest data rates. If not (US915 DR0 only has
+    room for 11 bytes), they're left out, least useful first, until the
+    rest fit; they're still in the SD card record. The 6-byte header
+    always goes in. The pellet counts are included if they fit (with any
+    held from earlier messages). Then as many of the newest activity
+    samples as fit are included.
+
+    Nothing else is changed, so the message can be rebuilt with another
+    limit; what was left out is noted in m_txPlan, and dealt with by
+    commitTxBuffer() once the message is on its way.
 
 */
 
 void
 cMeasurementLoop::fillTxBuffer(
-    cMeasurementLoop::TxBuffer_t& b, Measurement const &mData
+    cMeasurementLoop::TxBuffer_t& b, Measurement const &mData, size_t nLimit
     )
     {
     auto const savedLed = gLed.Set(McciCatena::LedPattern::Off);
@@ -48,21 +74,87 @@ cMeasurementLoop::fillTxBuffer(
         gLed.Set(McciCatena::LedPattern::Measuring);
         }
 
+    bool const fPacked = (gCatena.GetOperatingFlags() &
+                          static_cast<std::uint32_t>(OPERATING_FLAGS::fPackedActivity)) != 0;
+    unsigned const nActivity = mData.activity.size();
+
+    // work out what fits, starting with the fields that are normally
+    // always sent; give them up in this order if they don't all fit.
+    static const struct
+        {
+        Flags           flag;
+        std::uint8_t    nBytes;
+        } kFixedFields[] =
+        {
+        { Flags::Vbus, 2 },
+        { Flags::Boot, 1 },
+        { Flags::Light, 2 },
+        { Flags::TPH, 6 },
+        { Flags::Vbat, 2 },
+        };
+
+    Flags flags = mData.flags;
+    size_t nBytes = 1 + 4 + 1;
+
+    for (auto const &field : kFixedFields)
+        {
+        if ((flags & field.flag) != Flags(0))
+            nBytes += field.nBytes;
+        }
+
+    for (auto const &field : kFixedFields)
+        {
+        if (nBytes <= nLimit)
+            break;
+
+        if ((flags & field.flag) != Flags(0))
+            {
+            flags = Flags(std::uint8_t(flags) & ~std::uint8_t(field.flag));
+            nBytes -= field.nBytes;
+            }
+        }
+
+    if ((flags & Flags::Pellets) != Flags(0))
+        {
+        if (nBytes + 3 * kMaxPelletEntries <= nLimit)
+            nBytes += 3 * kMaxPelletEntries;
+        else
+            flags = Flags(std::uint8_t(flags) & ~std::uint8_t(Flags::Pellets));
+        }
+
+    // send the newest activity samples that fit; format 0x22 only has
+    // room for kMaxActivityEntriesSflt16 in any case.
+    unsigned iFirst = 0;
+    if ((flags & Flags::Activity) != Flags(0))
+        {
+        if (! fPacked && nActivity > kMaxActivityEntriesSflt16)
+            iFirst = nActivity - kMaxActivityEntriesSflt16;
+
+        while (iFirst < nActivity &&
+               nBytes + this->putActivity(nullptr, mData, fPacked, iFirst, nActivity - iFirst) > nLimit)
+            ++iFirst;
+
+        if (iFirst == nActivity && nActivity != 0)
+            flags = Flags(std::uint8_t(flags) & ~std::uint8_t(Flags::Activity));
+        }
+
+    this->m_txPlan = TxBufferPlan { flags, iFirst, fPacked, nLimit };
+
     // initialize the message buffer to an empty state
     b.begin();
 
     // insert format byte
-    b.put(kMessageFormat);
+    b.put(fPacked ? kMessageFormatPackedActivity : kMessageFormat);
 
     // insert the timestamp from the data
     // stuff zero if time is not valid.
     b.put4u(std::uint32_t(mData.DateTime.getGpsTime()));
 
     // the flags in Measurement correspond to the over-the-air flags.
-    b.put(std::uint8_t(mData.flags));
+    b.put(std::uint8_t(flags));
 
     // send Vbat
-    if ((mData.flags & Flags::Vbat) != Flags(0))
+    if ((flags & Flags::Vbat) != Flags(0))
         {
         float Vbat = mData.Vbat;
         gCatena.SafePrintf("Vbat:    %d mV\n", (int) (Vbat * 1000.0f));
@@ -72,7 +164,7 @@ cMeasurementLoop::fillTxBuffer(
     // send Vdd if we can measure it.
 
     // Vbus is sent as 5000 * v
-    if ((mData.flags & Flags::Vbus) != Flags(0))
+    if ((flags & Flags::Vbus) != Flags(0))
         {
         float Vbus = mData.Vbus;
         gCatena.SafePrintf("Vbus:    %d mV\n", (int) (Vbus * 1000.0f));
@@ -80,12 +172,12 @@ cMeasurementLoop::fillTxBuffer(
         }
 
     // send boot count
-    if ((mData.flags & Flags::Boot) != Flags(0))
+    if ((flags & Flags::Boot) != Flags(0))
         {
         b.putBootCountLsb(mData.BootCount);
         }
 
-    if ((mData.flags & Flags::TPH) != Flags(0))
+    if ((flags & Flags::TPH) != Flags(0))
         {
         gCatena.SafePrintf(
                 "BME280:  T: %d P: %d RH: %d\n",
@@ -100,7 +192,7 @@ cMeasurementLoop::fillTxBuffer(
         }
 
     // put light
-    if ((mData.flags & Flags::Light) != Flags(0))
+    if ((flags & Flags::Light) != Flags(0))
         {
         gCatena.SafePrintf(
                 "Si1133:  %d White\n",
@@ -110,34 +202,757 @@ cMeasurementLoop::fillTxBuffer(
         b.putLux(LMIC_f2uflt16(mData.light.White / pow(2.0, 24)));
         }
 
-    // put pellets
-    if ((mData.flags & Flags::Pellets) != Flags(0))
+    // put pellets, with any counts that didn't fit in earlier messages.
+    if ((flags & Flags::Pellets) != Flags(0))
         {
         for (unsigned i = 0; i < MeasurementFormat::kMaxPelletEntries; ++i)
             {
+            std::uint32_t const recent = mData.pellets[i].Recent + this->m_pelletsHeld[i];
+
             b.put2(mData.pellets[i].Total & 0xFFFFu);
-            b.put(mData.pellets[i].Recent);
+            b.put(std::uint8_t(recent > 0xFF ? 0xFF : recent));
             }
         }
 
     // put activity
-    if ((mData.flags & Flags::Activity) != Flags(0))
+    if ((flags & Flags::Activity) != Flags(0))
         {
-        for (unsigned i = 0; i < mData.nActivity; ++i)
+        unsigned i = 0;
+        for (auto const &activity : mData.activity)
             {
             // scale to 0..1
-            float aAvg = mData.activity[i].Avg;
+            float aAvg = activity.Avg;
 
             gCatena.SafePrintf(
-                "Activity[%u] [0..1000):  %d Avg\n",
+                "Activity[%u] [0..1000):  %d Avg%s\n",
                 i,
-                500 + int(500 * aAvg)
+                500 + int(500 * aAvg),
+                i < iFirst ? " (held)" : ""
                 );
-
-            b.put2uf(LMIC_f2sflt16(aAvg));
+            ++i;
             }
+
+        this->putActivity(&b, mData, fPacked, iFirst, nActivity - iFirst);
         }
 
     if (!(this->fDisableLED && this->m_fLowLight))
         gLed.Set(savedLed);
     }
+
+/*
+
+Name:   McciCatena4430::cMeasurementLoop::commitTxBuffer()
+
+Function:
+    Account for what the last fillTxBuffer() left out.
+
+Definition:
+    void McciCatena4430::cMeasurementLoop::commitTxBuffer(
+            Measurement const &mData
+            );
+
+Description:
+    Called once for each measurement, when the message that
+    fillTxBuffer() last built from mData is sent or queued. If the
+    message has the pellet counts, the held counts went with them; if
+    not, this measurement's counts are held for the next message. The
+    activity samples that were left out are put in the uplink queue
+    (see holdActivity()), to be sent after the next successful uplink.
+
+Returns:
+    No explicit result.
+
+*/
+
+void
+cMeasurementLoop::commitTxBuffer(
+    Measurement const &mData
+    )
+    {
+    auto const &plan = this->m_txPlan;
+    std::uint8_t const fixedFields = std::uint8_t(Flags::Vbat) | std::uint8_t(Flags::Vbus) |
+                                     std::uint8_t(Flags::Boot) | std::uint8_t(Flags::TPH) |
+                                     std::uint8_t(Flags::Light);
+
+    if ((std::uint8_t(mData.flags) & ~std::uint8_t(plan.flags) & fixedFields) != 0)
+        ++this->m_uplinkSizeStats.nShortened;
+
+    if ((mData.flags & Flags::Pellets) != Flags(0))
+        {
+        for (unsigned i = 0; i < kMaxPelletEntries; ++i)
+            {
+            if ((plan.flags & Flags::Pellets) != Flags(0))
+                this->m_pelletsHeld[i] = 0;
+            else
+                this->m_pelletsHeld[i] += mData.pellets[i].Recent;
+            }
+
+        if ((plan.flags & Flags::Pellets) == Flags(0))
+            ++this->m_uplinkSizeStats.nPelletsHeld;
+        }
+
+    if (plan.nActivityHeld != 0)
+        this->holdActivity(mData, plan.fPacked, plan.nActivityHeld, plan.nLimit);
+    }
+
+/*
+
+Name:   McciCatena4430::cMeasurementLoop::getTxBufferLimit()
+
+Function:
+    Return the largest message that fillTxBuffer() should prepare.
+
+Definition:
+    size_t McciCatena4430::cMeasurementLoop::getTxBufferLimit() const;
+
+Description:
+    If the message will be sent by itself, this is the largest uplink
+    at the current data rate; see getMaxUplinkPayload(). If we're not
+    provisioned, or measurements go out in multi-window uplinks, the
+    message is only written to the SD card, and the only limit is the
+    size of the buffer.
+
+Returns:
+    Number of bytes.
+
+*/
+
+size_t
+cMeasurementLoop::getTxBufferLimit() const
+    {
+    size_t const nBuffer = MeasurementFormat::kTxBufferSize;
+
+    if (! gLoRaWAN.IsProvisioned() ||
+        (gCatena.GetOperatingFlags() &
+         static_cast<std::uint32_t>(OPERATING_FLAGS::fMultiWindow)) != 0)
+        return nBuffer;
+
+    size_t const nMax = getMaxUplinkPayload();
+    return nMax < nBuffer ? nMax : nBuffer;
+    }
+
+/*
+
+Name:   McciCatena4430::cMeasurementLoop::putActivity()
+
+Function:
+    Put some of the activity samples in a message, or count the bytes.
+
+Definition:
+    size_t McciCatena4430::cMeasurementLoop::putActivity(
+            cMeasurementLoop::TxBuffer_t *pb,
+            Measurement const &mData,
+            bool fPacked,
+            unsigned iFirst,
+            unsigned n
+            ) const;
+
+Description:
+    Samples iFirst to iFirst + n - 1 (oldest first) are put in *pb, as
+    sflt16 values (format 0x22) or packed (format 0x24; see
+    putPackedActivity()). If pb is nullptr, nothing is put.
+
+Returns:
+    The number of bytes.
+
+*/
+
+size_t
+cMeasurementLoop::putActivity(
+    cMeasurementLoop::TxBuffer_t *pb,
+    Measurement const &mData,
+    bool fPacked,
+    unsigned iFirst,
+    unsigned n
+    ) const
+    {
+    if (fPacked)
+        return this->putPackedActivity(pb, mData, iFirst, n);
+
+    if (pb != nullptr)
+        {
+        for (unsigned i = iFirst; i < iFirst + n; ++i)
+            pb->put2uf(LMIC_f2sflt16(mData.activity[i].Avg));
+        }
+
+    return 2 * n;
+    }
+
+/*
+
+Name:   McciCatena4430::cMeasurementLoop::holdActivity()
+
+Function:
+    Queue the activity samples that didn't fit in this uplink.
+
+Definition:
+    void McciCatena4430::cMeasurementLoop::holdActivity(
+            Measurement const &mData,
+            bool fPacked,
+            unsigned nHeld,
+            size_t nLimit
+            );
+
+Description:
+    The oldest nHeld samples didn't fit in this measurement's message.
+    As many of the newest of them as fit in an activity-only message of
+    at most nLimit bytes are put in the uplink queue. The message is
+    stamped with the time of its newest sample, counting back from the
+    measurement's time, so it decodes like any other message.
+
+    Only one message is queued per measurement, because backfill sends
+    at most one per uplink; more would just push real backlog out of
+    the queue. The samples that don't fit are still in the SD card
+    record, and are counted in m_uplinkSizeStats.nActivityNotSent.
+
+Returns:
+    No explicit result.
+
+*/
+
+void
+cMeasurementLoop::holdActivity(
+    Measurement const &mData,
+    bool fPacked,
+    unsigned nHeld,
+    size_t nLimit
+    )
+    {
+    constexpr size_t nHeader = 1 + 4 + 1;
+    unsigned const nActivity = mData.activity.size();
+    std::uint32_t const tMeasurement = std::uint32_t(mData.DateTime.getGpsTime());
+    unsigned const nMax = fPacked ? nHeld : kMaxActivityEntriesSflt16;
+    TxBuffer_t b;
+
+    if (nHeld == 0)
+        return;
+
+    // always at least one sample, so we make progress.
+    unsigned iFirst = nHeld - 1;
+    while (iFirst > 0 && nHeld - iFirst < nMax &&
+           nHeader + this->putActivity(nullptr, mData, fPacked, iFirst - 1, nHeld - iFirst + 1) <= nLimit)
+        --iFirst;
+
+    unsigned const n = nHeld - iFirst;
+
+    // the newest sample is the measurement's; time 0 means no time.
+    std::uint32_t const tAgo = (nActivity - nHeld) * this->m_ActivityTimerSec;
+
+    b.begin();
+    b.put(fPacked ? kMessageFormatPackedActivity : kMessageFormat);
+    b.put4u(tMeasurement > tAgo ? tMeasurement - tAgo : 0);
+    b.put(std::uint8_t(Flags::Activity));
+    this->putActivity(&b, mData, fPacked, iFirst, n);
+
+    if (this->m_uplinkQueue.push(b.getbase(), b.getn()))
+        {
+        this->m_uplinkSizeStats.nActivityHeld += n;
+        this->m_uplinkSizeStats.nActivityNotSent += iFirst;
+        }
+    else
+        this->m_uplinkSizeStats.nActivityNotSent += nHeld;
+    }
+
+/****************************************************************************\
+|
+|   Multi-window uplinks (format 0x23)
+|
+\****************************************************************************/
+
+namespace {
+
+// the environmental readings as coded in the message: temperature is an
+// int16, pressure and humidity are uint16.
+struct EnvCodes
+    {
+    std::int32_t t;
+    std::int32_t p;
+    std::int32_t rh;
+    };
+
+template <typename TBuffer>
+void putEnv(TBuffer &b, cMeasurementLoop::Measurement::Env const &env)
+    {
+    b.putT(env.Temperature);
+    b.putP(env.Pressure);
+    // no method for 2-byte RH, directly encode it.
+    b.put2uf((env.Humidity / 100.0f) * 65535.0f);
+    }
+
+// code the readings exactly as putEnv() does, by doing it.
+EnvCodes getEnvCodes(cMeasurementLoop::Measurement::Env const &env)
+    {
+    McciCatena::AbstractTxBuffer_t<6> b;
+    b.begin();
+    putEnv(b, env);
+
+    auto const p = b.getbase();
+    return EnvCodes {
+        std::int16_t((p[0] << 8) | p[1]),
+        (p[2] << 8) | p[3],
+        (p[4] << 8) | p[5]
+        };
+    }
+
+// express the change from prev to target as an int8 count of steps;
+// prev becomes the value the decoder will reconstruct. Returns false
+// if the change is too big.
+bool codeDelta(
+    std::int32_t &prev, std::int32_t target, std::int32_t step,
+    std::int32_t vMin, std::int32_t vMax, std::int8_t &delta
+    )
+    {
+    std::int32_t const diff = target - prev;
+    std::int32_t d = (diff >= 0 ? diff + step / 2 : diff - step / 2) / step;
+
+    // rounding can step just past the end of the range.
+    if (prev + d * step > vMax)
+        --d;
+    else if (prev + d * step < vMin)
+        ++d;
+
+    if (d < -127 || d > 127)
+        return false;
+
+    prev += d * step;
+    delta = std::int8_t(d);
+    return true;
+    }
+
+// size of a window after the first.
+unsigned windowSize(cMeasurementLoop::Flags flags, unsigned nActivity)
+    {
+    using Flags = cMeasurementLoop::Flags;
+    unsigned n = 2;
+
+    if ((flags & Flags::TPH) != Flags(0))
+        n += 3;
+    if ((flags & Flags::Light) != Flags(0))
+        n += 2;
+    if ((flags & Flags::Pellets) != Flags(0))
+        n += cMeasurementLoop::kMaxPelletEntries;
+    if ((flags & Flags::Activity) != Flags(0))
+        n += 1 + 2 * nActivity;
+
+    return n;
+    }
+
+} // namespace
+
+/*
+
+Name:   McciCatena4430::cMeasurementLoop::appendUplinkWindow()
+
+Function:
+    Add a measurement to the pending format 0x23 uplink.
+
+Definition:
+    bool McciCatena4430::cMeasurementLoop::appendUplinkWindow(
+            Measurement const &mData
+            );
+
+Description:
+    A format 0x23 message carries several consecutive measurements
+    ("windows"). The first window looks like a format 0x22 message,
+    except that the activity samples are preceded by their count. The
+    voltages and boot count are only sent in the first window, and its
+    pellet counts include any held from earlier messages. Each
+    later window has the seconds since the previous window, the change
+    in temperature, pressure and humidity (one byte each), the light,
+    the pellets counted in the window, and the activity samples.
+
+    The changes are relative to the values the decoder reconstructs,
+    not to the previous measurement, so rounding errors don't add up.
+
+    A window that can't be described that way (its flags differ, the
+    time went backwards or jumped too far, a change is too big, or a
+    pellet count saturated), or that won't fit at the current data
+    rate, isn't added. The first window is added unless it won't fit
+    at the current data rate by itself; then m_uplinkFrame stays empty,
+    and the caller sends the measurement some other way.
+
+Returns:
+    true if the measurement was added to m_uplinkFrame.
+
+*/
+
+bool
+cMeasurementLoop::appendUplinkWindow(
+    Measurement const &mData
+    )
+    {
+    auto &frame = this->m_uplinkFrame;
+    auto &state = this->m_uplinkFrameState;
+    std::uint32_t const tWindow = std::uint32_t(mData.DateTime.getGpsTime());
+    unsigned const nActivity = (mData.flags & Flags::Activity) != Flags(0) ? mData.activity.size() : 0;
+
+    if (state.nWindows == 0)
+        {
+        frame.begin();
+        frame.put(kMessageFormatMultiWindow);
+        frame.put4u(tWindow);
+        frame.put(std::uint8_t(mData.flags));
+
+        if ((mData.flags & Flags::Vbat) != Flags(0))
+            frame.putV(mData.Vbat);
+        if ((mData.flags & Flags::Vbus) != Flags(0))
+            frame.putV(mData.Vbus);
+        if ((mData.flags & Flags::Boot) != Flags(0))
+            frame.putBootCountLsb(mData.BootCount);
+        if ((mData.flags & Flags::TPH) != Flags(0))
+            putEnv(frame, mData.env);
+        if ((mData.flags & Flags::Light) != Flags(0))
+            frame.putLux(LMIC_f2uflt16(mData.light.White / pow(2.0, 24)));
+        if ((mData.flags & Flags::Pellets) != Flags(0))
+            {
+            // with any counts that didn't fit in earlier messages.
+            for (unsigned i = 0; i < kMaxPelletEntries; ++i)
+                {
+                std::uint32_t const recent = mData.pellets[i].Recent + this->m_pelletsHeld[i];
+
+                frame.put2(mData.pellets[i].Total & 0xFFFFu);
+                frame.put(std::uint8_t(recent > 0xFF ? 0xFF : recent));
+                }
+            }
+        if ((mData.flags & Flags::Activity) != Flags(0))
+            {
+            frame.put(std::uint8_t(nActivity));
+            for (auto const &activity : mData.activity)
+                frame.put2uf(LMIC_f2sflt16(activity.Avg));
+            }
+
+        if (frame.getn() > getMaxUplinkPayload())
+            return false;
+
+        // the frame is always sent, or queued, once it's started.
+        if ((mData.flags & Flags::Pellets) != Flags(0))
+            {
+            for (auto &held : this->m_pelletsHeld)
+                held = 0;
+            }
+
+        auto const env = getEnvCodes(mData.env);
+        state.tCode = env.t;
+        state.pCode = env.p;
+        state.rhCode = env.rh;
+        }
+    else
+        {
+        if (mData.flags != state.flags)
+            return false;
+
+        std::uint32_t const dt = tWindow - state.lastTime;
+        if (tWindow == 0 || state.lastTime == 0 || tWindow <= state.lastTime || dt > 0xFFFF)
+            return false;
+
+        McciCatena::AbstractTxBuffer_t<kMaxUplinkFrame> b;
+        b.begin();
+        b.put2(std::uint16_t(dt));
+
+        EnvCodes codes { state.tCode, state.pCode, state.rhCode };
+        if ((mData.flags & Flags::TPH) != Flags(0))
+            {
+            auto const env = getEnvCodes(mData.env);
+            std::int8_t dT, dP, dRH;
+
+            // steps: 1/16 degree C, 0.04 millibar, and 1/256 of full scale RH.
+            if (! codeDelta(codes.t, env.t, 16, -32768, 32767, dT) ||
+                ! codeDelta(codes.p, env.p, 1, 0, 65535, dP) ||
+                ! codeDelta(codes.rh, env.rh, 256, 0, 65535, dRH))
+                return false;
+
+            b.put(std::uint8_t(dT));
+            b.put(std::uint8_t(dP));
+            b.put(std::uint8_t(dRH));
+            }
+
+        if ((mData.flags & Flags::Light) != Flags(0))
+            b.putLux(LMIC_f2uflt16(mData.light.White / pow(2.0, 24)));
+
+        if ((mData.flags & Flags::Pellets) != Flags(0))
+            {
+            // the decoder adds the recent count to the previous total.
+            for (unsigned i = 0; i < kMaxPelletEntries; ++i)
+                {
+                auto const &pellets = mData.pellets[i];
+                if (std::uint16_t(pellets.Total) != std::uint16_t(state.pelletTotal[i] + pellets.Recent))
+                    return false;
+                b.put(pellets.Recent);
+                }
+            }
+
+        if ((mData.flags & Flags::Activity) != Flags(0))
+            {
+            b.put(std::uint8_t(nActivity));
+            for (auto const &activity : mData.activity)
+                b.put2uf(LMIC_f2sflt16(activity.Avg));
+            }
+
+        if (frame.getn() + b.getn() > getMaxUplinkPayload())
+            return false;
+
+        for (std::size_t i = 0; i < b.getn(); ++i)
+            frame.put(b.getbase()[i]);
+
+        state.tCode = codes.t;
+        state.pCode = codes.p;
+        state.rhCode = codes.rh;
+        }
+
+    for (unsigned i = 0; i < kMaxPelletEntries; ++i)
+        state.pelletTotal[i] = std::uint16_t(mData.pellets[i].Total);
+
+    state.lastTime = tWindow;
+    state.flags = mData.flags;
+    state.nNextWindowBytes = std::uint8_t(windowSize(mData.flags, nActivity));
+    ++state.nWindows;
+    return true;
+    }
+
+/*
+
+Name:   McciCatena4430::cMeasurementLoop::isUplinkFrameFull()
+
+Function:
+    Decide whether the pending format 0x23 frame should be sent.
+
+Definition:
+    bool McciCatena4430::cMeasurementLoop::isUplinkFrameFull() const;
+
+Description:
+    The frame is sent once it has kMaxUplinkWindows windows, or when
+    another window like the last one wouldn't fit at the current data
+    rate.
+
+Returns:
+    true if the frame should be sent now.
+
+*/
+
+bool
+cMeasurementLoop::isUplinkFrameFull() const
+    {
+    auto const &state = this->m_uplinkFrameState;
+
+    if (state.nWindows >= kMaxUplinkWindows)
+        return true;
+
+    return this->m_uplinkFrame.getn() + state.nNextWindowBytes > getMaxUplinkPayload();
+    }
+
+/*
+
+Name:   McciCatena4430::cMeasurementLoop::getMaxUplinkPayload()
+
+Function:
+    Return the largest uplink frame to build for the current data rate.
+
+Definition:
+    static size_t McciCatena4430::cMeasurementLoop::getMaxUplinkPayload();
+
+Description:
+    The band plan's limit is for the whole frame; we take off the 13
+    bytes of MAC header, frame header, port and MIC, and assume no MAC
+    options are piggybacked. The result is also limited by the LMIC's
+    own transmit buffer, and by kMaxUplinkFrame.
+
+Returns:
+    Number of bytes.
+
+*/
+
+size_t
+cMeasurementLoop::getMaxUplinkPayload()
+    {
+    size_t nMax = kMaxUplinkFrame;
+
+    if (sizeof(LMIC.pendTxData) < nMax)
+        nMax = sizeof(LMIC.pendTxData);
+
+    size_t const nFrame = LMICbandplan_maxFrameLen(LMIC.datarate);
+    size_t const nOverhead = 13;
+
+    if (nFrame < nMax + nOverhead)
+        nMax = nFrame > nOverhead ? nFrame - nOverhead : 0;
+
+    return nMax;
+    }
+
+/****************************************************************************\
+|
+|   Packed activity (format 0x24)
+|
+\****************************************************************************/
+
+namespace {
+
+// prefix codes for the packed activity samples; see putPackedActivity().
+constexpr std::uint8_t kPackedSame = 0x0;       // 0
+constexpr std::uint8_t kPackedDelta = 0x2;      // 10 dd
+constexpr std::uint8_t kPackedRun = 0x6;        // 110 rrrr
+constexpr std::uint8_t kPackedLevel = 0x7;      // 111 then the level
+
+// runs shorter than this are cheaper as single kPackedSame codes.
+constexpr unsigned kPackedRunMin = 8;
+constexpr unsigned kPackedRunMax = 17;
+
+// writes bits into a TxBuffer, most significant bit first; or, if
+// there's no buffer, just counts the bytes.
+class cBitPacker
+    {
+public:
+    cBitPacker(cMeasurementLoop::TxBuffer_t *pb)
+        : m_pb(pb)
+        {}
+
+    void put(std::uint32_t v, unsigned nBits)
+        {
+        while (nBits > 0)
+            {
+            --nBits;
+            this->m_acc = std::uint8_t((this->m_acc << 1) | ((v >> nBits) & 1));
+            if (++this->m_nBits == 8)
+                {
+                if (this->m_pb != nullptr)
+                    this->m_pb->put(this->m_acc);
+                ++this->m_nBytes;
+                this->m_acc = 0;
+                this->m_nBits = 0;
+                }
+            }
+        }
+
+    // pad the last byte with zeros.
+    void flush()
+        {
+        if (this->m_nBits != 0)
+            this->put(0, 8 - this->m_nBits);
+        }
+
+    size_t getBytes() const
+        {
+        return this->m_nBytes;
+        }
+
+private:
+    cMeasurementLoop::TxBuffer_t *m_pb;
+    size_t m_nBytes = 0;
+    std::uint8_t m_acc = 0;
+    std::uint8_t m_nBits = 0;
+    };
+
+} // namespace
+
+/*
+
+Name:   McciCatena4430::cMeasurementLoop::putPackedActivity()
+
+Function:
+    Put the activity field of a format 0x24 message.
+
+Definition:
+    size_t McciCatena4430::cMeasurementLoop::putPackedActivity(
+            cMeasurementLoop::TxBuffer_t *pb,
+            Measurement const &mData,
+            unsigned iFirst,
+            unsigned n
+            ) const;
+
+Description:
+    The field is the number of samples and the bits per sample (each a
+    uint8), then samples iFirst to iFirst + n - 1, oldest first, packed
+    into a bit stream.
+    Each sample (-1 to 1) is first quantized to a level from 0 to
+    2^bits - 1, so that idle (-1) is level 0. Each level is then coded
+    relative to the one before (which is 0 for the first sample):
+
+        0           the same level.
+        10 dd       a change of -2, -1, +1 or +2 (dd is 0 to 3).
+        110 rrrr    rrrr + 2 samples at the same level.
+        111 level   any other level, in bits bits.
+
+    The stream is padded with zeros to a whole byte. A minute of idle
+    in a run thus takes less than a bit, and a small change takes four,
+    where format 0x22 uses 16 for every sample.
+
+    If pb is nullptr, the field is sized but not put anywhere.
+
+Returns:
+    The number of bytes in the field.
+
+*/
+
+size_t
+cMeasurementLoop::putPackedActivity(
+    cMeasurementLoop::TxBuffer_t *pb,
+    Measurement const &mData,
+    unsigned iFirst,
+    unsigned n
+    ) const
+    {
+    unsigned const bits = this->m_activityBits;
+    std::int32_t const maxLevel = (1 << bits) - 1;
+    cBitPacker packer(pb);
+
+    if (pb != nullptr)
+        {
+        pb->put(std::uint8_t(n));
+        pb->put(std::uint8_t(bits));
+        }
+
+    std::int32_t prev = 0;
+    unsigned nSame = 0;
+
+    auto const putSame = [&packer, &nSame]()
+        {
+        while (nSame >= kPackedRunMin)
+            {
+            unsigned const n = nSame < kPackedRunMax ? nSame : kPackedRunMax;
+            packer.put(kPackedRun, 3);
+            packer.put(n - 2, 4);
+            nSame -= n;
+            }
+
+        for (; nSame > 0; --nSame)
+            packer.put(kPackedSame, 1);
+        };
+
+    for (unsigned i = iFirst; i < iFirst + n; ++i)
+        {
+        float const a = mData.activity[i].Avg;
+        std::int32_t level;
+
+        if (! (a > -1.0f))
+            level = 0;
+        else if (a >= 1.0f)
+            level = maxLevel;
+        else
+            level = std::int32_t((a + 1.0f) * 0.5f * maxLevel + 0.5f);
+
+        if (level == prev)
+            {
+            ++nSame;
+            continue;
+            }
+
+        putSame();
+
+        std::int32_t const delta = level - prev;
+        if (-2 <= delta && delta <= 2)
+            {
+            packer.put(kPackedDelta, 2);
+            packer.put(delta < 0 ? delta + 2 : delta + 1, 2);
+            }
+        else
+            {
+            packer.put(kPackedLevel, 3);
+            packer.put(level, bits);
+            }
+
+        prev = level;
+        }
+
+    putSame();
+    packer.flush();
+    return 2 + packer.getBytes();
+    }
@@ -0,0 +1,158 @@
+/*
+
+Module: Catena4430_cRecordCompressor.cpp
+
+Function:
+    cRecordCompressor::compress()
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#include "Catena4430_cRecordCompressor.h"
+
+using namespace McciCatena4430;
+
+/*
+
+Name:   cRecordCompressor::compress()
+
+Function:
+    Compress a record into a frame.
+
+Definition:
+    static size_t cRecordCompressor::compress(
+        const std::uint8_t *pDict, size_t nDict,
+        const std::uint8_t *pSrc, size_t nSrc,
+        std::uint8_t *pOut, size_t nOut
+        );
+
+Description:
+    The nSrc bytes at pSrc are compressed into a frame at pOut, as
+    described in Catena4430_cRecordCompressor.h. If nDict is non-zero,
+    the nDict bytes at pDict (normally, the previous record) are used
+    as the dictionary, and the frame is marked accordingly.
+
+    The match search is a simple scan of the window, longest match
+    wins. The window is at most kMaxOffset bytes, and records are a
+    few hundred bytes, so this takes a few milliseconds at most on an
+    STM32L0, with no RAM beyond the stack frame.
+
+Returns:
+    Size of the frame in bytes, or zero if nSrc is too big or the frame
+    doesn't fit in nOut bytes. getMaxFrameSize(nSrc) is always enough.
+
+*/
+
+size_t
+cRecordCompressor::compress(
+    const std::uint8_t *pDict, size_t nDict,
+    const std::uint8_t *pSrc, size_t nSrc,
+    std::uint8_t *pOut, size_t nOut
+    )
+    {
+    if (nSrc > kRawLengthMask || nOut < kFrameHeaderSize)
+        return 0;
+    if (pDict == nullptr)
+        nDict = 0;
+
+    // only the tail of the dictionary is reachable.
+    if (nDict > kMaxOffset)
+        {
+        pDict += nDict - kMaxOffset;
+        nDict = kMaxOffset;
+        }
+
+    // the window is the dictionary followed by the source.
+    auto const windowByte =
+        [pDict, nDict, pSrc](size_t i) -> std::uint8_t
+            {
+            return i < nDict ? pDict[i] : pSrc[i - nDict];
+            };
+
+    size_t const nWindow = nDict + nSrc;
+    size_t iOut = kFrameHeaderSize;
+    size_t iControl = 0;
+    unsigned nTokens = 8;
+
+    for (size_t pos = nDict; pos < nWindow; )
+        {
+        // start a new group if needed.
+        if (nTokens == 8)
+            {
+            if (iOut >= nOut)
+                return 0;
+            iControl = iOut++;
+            pOut[iControl] = 0;
+            nTokens = 0;
+            }
+
+        // find the longest match.
+        size_t bestLength = 0;
+        size_t bestOffset = 0;
+        size_t const first = pos > kMaxOffset ? pos - kMaxOffset : 0;
+        size_t maxLength = nWindow - pos;
+
+        if (maxLength > kMaxMatch)
+            maxLength = kMaxMatch;
+
+        if (maxLength >= kMinMatch)
+            {
+            std::uint8_t const c0 = pSrc[pos - nDict];
+
+            for (size_t cand = first; cand < pos; ++cand)
+                {
+                if (windowByte(cand) != c0)
+                    continue;
+
+                size_t len = 1;
+                while (len < maxLength && windowByte(cand + len) == windowByte(pos + len))
+                    ++len;
+
+                if (len > bestLength)
+                    {
+                    bestLength = len;
+                    bestOffset = pos - cand;
+                    if (len == maxLength)
+                        break;
+                    }
+                }
+            }
+
+        if (bestLength >= kMinMatch)
+            {
+            if (iOut + 2 > nOut)
+                return 0;
+
+            pOut[iOut++] = std::uint8_t(bestOffset - 1);
+            pOut[iOut++] = std::uint8_t(((bestOffset - 1) >> 8) | ((bestLength - kMinMatch) << 1));
+            pos += bestLength;
+            }
+        else
+            {
+            if (iOut >= nOut)
+                return 0;
+
+            pOut[iControl] |= std::uint8_t(1u << nTokens);
+            pOut[iOut++] = pSrc[pos - nDict];
+            ++pos;
+            }
+
+        ++nTokens;
+        }
+
+    std::uint16_t const rawField = std::uint16_t(nSrc | (nDict != 0 ? kFlagDictionary : 0));
+    std::uint16_t const payloadLength = std::uint16_t(iOut - kFrameHeaderSize);
+
+    pOut[0] = kFrameMarker;
+    pOut[1] = std::uint8_t(rawField);
+    pOut[2] = std::uint8_t(rawField >> 8);
+    pOut[3] = std::uint8_t(payloadLength);
+    pOut[4] = std::uint8_t(payloadLength >> 8);
+
+    return iOut;
+    }
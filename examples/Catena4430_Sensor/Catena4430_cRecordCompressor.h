@@ -0,0 +1,92 @@
+/*
+
+Module: Catena4430_cRecordCompressor.h
+
+Function:
+    cRecordCompressor: compress SD card records, one record at a time.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena4430_cRecordCompressor_h_
+# define _Catena4430_cRecordCompressor_h_
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace McciCatena4430 {
+
+/*
+
+Overview:
+    Records are compressed one at a time with LZSS, using the previous
+    record (if any) as the dictionary. Successive records mostly differ
+    in a few digits, so most of each record becomes a handful of long
+    matches against the previous one. There are no tables, and no state
+    except the previous record, which the caller keeps.
+
+    A compressed file is a sequence of frames, one per record (the
+    header line is the first frame). Each frame is:
+
+        1 byte      kFrameMarker
+        2 bytes     raw length, little-endian; bit 15 is set if the
+                    frame uses the previous frame as its dictionary.
+        2 bytes     payload length, little-endian.
+        n bytes     payload.
+
+    The payload is groups of a control byte followed by up to eight
+    tokens, taken LSB first: a 1 bit is a literal byte; a 0 bit is a
+    two-byte match:
+
+        byte 0      (offset - 1) bits 7..0
+        byte 1      bit 0: (offset - 1) bit 8;
+                    bits 7..1: length - kMinMatch
+
+    The offset counts back from the current position, through the end
+    of the dictionary if needed (1..kMaxOffset); matches may overlap the
+    current position. Decoding stops after "raw length" bytes.
+
+    If a write is interrupted (say, the card is pulled), the file ends
+    with a partial frame and later frames are appended after it. The
+    writer never uses a dictionary for the first frame after an error,
+    so a reader can skip to the next kFrameMarker that starts a frame
+    without a dictionary that decodes cleanly.
+
+*/
+
+class cRecordCompressor
+    {
+public:
+    static constexpr std::uint8_t kFrameMarker = 0xA5;
+    static constexpr size_t kFrameHeaderSize = 5;
+    static constexpr size_t kMaxOffset = 512;
+    static constexpr size_t kMinMatch = 3;
+    static constexpr size_t kMaxMatch = kMinMatch + 127;
+    static constexpr std::uint16_t kRawLengthMask = 0x7FFF;
+    static constexpr std::uint16_t kFlagDictionary = 0x8000;
+
+    // worst-case frame size for a record of nRaw bytes.
+    static constexpr size_t getMaxFrameSize(size_t nRaw)
+        {
+        return kFrameHeaderSize + nRaw + (nRaw + 7) / 8;
+        }
+
+    // compress a record into a frame; returns size of frame, or zero if
+    // the frame doesn't fit in nOut bytes.
+    static size_t compress(
+        const std::uint8_t *pDict, size_t nDict,
+        const std::uint8_t *pSrc, size_t nSrc,
+        std::uint8_t *pOut, size_t nOut
+        );
+    };
+
+} // namespace McciCatena4430
+
+#endif /* _Catena4430_cRecordCompressor_h_ */
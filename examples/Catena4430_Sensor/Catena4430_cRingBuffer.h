@@ -0,0 +1,129 @@
+/*
+
+Module: Catena4430_cRingBuffer.h
+
+Function:
+    cRingBuffer: fixed-capacity circular buffer.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena4430_cRingBuffer_h_
+# define _Catena4430_cRingBuffer_h_
+
+#pragma once
+
+#include <cstdint>
+
+namespace McciCatena4430 {
+
+/*
+
+Overview:
+    cRingBuffer holds the most recent entries pushed into it, up to a
+    depth that's set at run time (and is at most a_kCapacity). When
+    it's full, push() drops the oldest entry; nothing is moved.
+
+    Entries are indexed from oldest (0) to newest (size() - 1), and
+    can be walked in that order with a range-for.
+
+    It's trivially copyable and has no constructor, so it can live in a
+    structure that's cleared with memset(); call setDepth() afterwards,
+    since a depth of zero means "hold nothing".
+
+*/
+
+template <typename T, unsigned a_kCapacity>
+class cRingBuffer
+    {
+public:
+    static constexpr unsigned kCapacity = a_kCapacity;
+    static_assert(kCapacity >= 1 && kCapacity <= 255, "capacity must fit in a byte");
+
+    class const_iterator
+        {
+    public:
+        const_iterator(const cRingBuffer *pRing, unsigned i)
+            : m_pRing(pRing), m_i(i)
+            {}
+
+        const T &operator*() const { return (*this->m_pRing)[this->m_i]; }
+        const T *operator->() const { return &(*this->m_pRing)[this->m_i]; }
+        const_iterator &operator++() { ++this->m_i; return *this; }
+        bool operator!=(const const_iterator &rhs) const { return this->m_i != rhs.m_i; }
+        bool operator==(const const_iterator &rhs) const { return this->m_i == rhs.m_i; }
+
+    private:
+        const cRingBuffer *m_pRing;
+        unsigned m_i;
+        };
+
+    // empty the buffer, and set the depth (clamped to kCapacity).
+    void setDepth(unsigned depth)
+        {
+        this->m_depth = std::uint8_t(depth > kCapacity ? kCapacity : depth);
+        this->clear();
+        }
+
+    void clear()
+        {
+        this->m_head = 0;
+        this->m_count = 0;
+        }
+
+    // add v as the newest entry, dropping the oldest if full; returns
+    // true if an entry was dropped.
+    bool push(const T &v)
+        {
+        if (this->m_depth == 0)
+            return false;
+
+        unsigned tail = this->m_head + this->m_count;
+        if (tail >= this->m_depth)
+            tail -= this->m_depth;
+
+        this->m_buf[tail] = v;
+
+        if (this->m_count < this->m_depth)
+            {
+            ++this->m_count;
+            return false;
+            }
+
+        if (++this->m_head == this->m_depth)
+            this->m_head = 0;
+        return true;
+        }
+
+    // the i-th oldest entry; i must be less than size().
+    const T &operator[](unsigned i) const
+        {
+        unsigned j = this->m_head + i;
+        if (j >= this->m_depth)
+            j -= this->m_depth;
+        return this->m_buf[j];
+        }
+
+    unsigned size() const { return this->m_count; }
+    unsigned depth() const { return this->m_depth; }
+    bool empty() const { return this->m_count == 0; }
+    bool isFull() const { return this->m_count == this->m_depth; }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, this->m_count); }
+
+private:
+    T               m_buf[kCapacity];
+    std::uint8_t    m_head;
+    std::uint8_t    m_count;
+    std::uint8_t    m_depth;
+    };
+
+} // namespace McciCatena4430
+
+#endif // !defined(_Catena4430_cRingBuffer_h_)
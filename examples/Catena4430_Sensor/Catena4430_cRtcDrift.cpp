@@ -0,0 +1,68 @@
+/*
+
+Module: Catena4430_cRtcDrift.cpp
+
+Function:
+    cRtcDrift: estimate RTC drift from network time.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#include "Catena4430_cRtcDrift.h"
+
+using namespace McciCatena4430;
+
+bool cRtcDrift::addSample(std::int64_t tRtc, std::int64_t tNetwork)
+    {
+    if (! this->m_fReference || tNetwork <= this->m_tReference)
+        return false;
+
+    std::int64_t const interval = tNetwork - this->m_tReference;
+    if (interval > kMaxIntervalSec)
+        return false;
+
+    std::int32_t const error = std::int32_t(tRtc - tNetwork);
+
+    // the Offset register made the RTC run faster by offset * ppbPerStep;
+    // take that out. ppb times seconds is nanoseconds.
+    std::int64_t const correctionMs =
+        std::int64_t(this->m_offset) * this->m_ppbPerStep * interval / 1000000;
+
+    this->m_sumErrorMs += std::int64_t(error) * 1000 - correctionMs;
+    this->m_sumIntervalSec += std::uint32_t(interval);
+    this->m_lastErrorSec = error;
+    ++this->m_nSamples;
+    return true;
+    }
+
+std::int32_t cRtcDrift::getDriftPpb() const
+    {
+    if (this->m_sumIntervalSec == 0)
+        return 0;
+
+    // ms per second, times a million, is ppb.
+    return std::int32_t(this->m_sumErrorMs * 1000000 / std::int64_t(this->m_sumIntervalSec));
+    }
+
+std::int8_t cRtcDrift::getBestOffset() const
+    {
+    if (! this->isCharacterized())
+        return this->m_offset;
+
+    // a fast clock (positive drift) needs a negative offset; round to nearest.
+    std::int32_t const drift = this->getDriftPpb();
+    std::int32_t const half = this->m_ppbPerStep / 2;
+    std::int32_t offset = -((drift >= 0 ? drift + half : drift - half) / this->m_ppbPerStep);
+
+    if (offset < -64)
+        offset = -64;
+    else if (offset > 63)
+        offset = 63;
+
+    return std::int8_t(offset);
+    }
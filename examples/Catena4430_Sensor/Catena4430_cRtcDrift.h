@@ -0,0 +1,116 @@
+/*
+
+Module: Catena4430_cRtcDrift.h
+
+Function:
+    cRtcDrift: estimate RTC drift from network time.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena4430_cRtcDrift_h_
+# define _Catena4430_cRtcDrift_h_
+
+#pragma once
+
+#include <cstdint>
+
+namespace McciCatena4430 {
+
+/*
+
+Overview:
+    Each time network time arrives, the RTC is compared with it, and then
+    set. The difference, divided by the time since the RTC was last set
+    from the network, is the drift rate over that interval.
+
+    The RTC only reports whole seconds, so a single interval of a few
+    hours can't resolve more than tens of ppm. Instead, every sample is
+    converted back to what an uncorrected RTC would have done (by
+    removing the effect of the Offset register in force at the time),
+    and the estimate is the total error over the total time. The
+    resolution improves as time accumulates, and the Offset register
+    can be changed without throwing away old samples.
+
+    Times are in seconds; the drift is in parts per billion, positive
+    if the RTC runs fast.
+
+*/
+
+class cRtcDrift
+    {
+public:
+    // minimum time covered by samples before the estimate is used.
+    static constexpr std::uint32_t kMinSpanSec = 24 * 60 * 60;
+    // samples from longer intervals are ignored; the RTC may have been
+    // set some other way without our knowing.
+    static constexpr std::uint32_t kMaxIntervalSec = 30 * 24 * 60 * 60;
+
+    cRtcDrift(std::int32_t ppbPerStep)
+        : m_ppbPerStep(ppbPerStep)
+        {}
+
+    // start over, with the Offset register currently programmed.
+    void begin(std::int8_t offset)
+        {
+        this->m_offset = offset;
+        this->m_fReference = false;
+        this->m_sumErrorMs = 0;
+        this->m_sumIntervalSec = 0;
+        this->m_nSamples = 0;
+        this->m_lastErrorSec = 0;
+        }
+
+    // the RTC was just set to tReference.
+    void setReference(std::int64_t tReference)
+        {
+        this->m_tReference = tReference;
+        this->m_fReference = true;
+        }
+
+    // the RTC was set from something we can't trust (e.g. by hand).
+    void clearReference()
+        {
+        this->m_fReference = false;
+        }
+
+    // add a sample: the RTC read tRtc when the network said tNetwork.
+    // Returns true if the sample was used.
+    bool addSample(std::int64_t tRtc, std::int64_t tNetwork);
+
+    // the Offset register setting that cancels the estimated drift.
+    std::int8_t getBestOffset() const;
+
+    // the Offset register is now programmed to offset.
+    void setOffset(std::int8_t offset)
+        {
+        this->m_offset = offset;
+        }
+
+    std::int8_t getOffset() const { return this->m_offset; }
+    bool isCharacterized() const { return this->m_sumIntervalSec >= kMinSpanSec; }
+    std::int32_t getDriftPpb() const;
+    std::int32_t getLastErrorSec() const { return this->m_lastErrorSec; }
+    std::uint32_t getSpanSec() const { return this->m_sumIntervalSec; }
+    std::uint32_t getSampleCount() const { return this->m_nSamples; }
+
+private:
+    std::int32_t m_ppbPerStep;
+    std::int64_t m_tReference = 0;
+    // total uncorrected error, in milliseconds, and total time.
+    std::int64_t m_sumErrorMs = 0;
+    std::uint32_t m_sumIntervalSec = 0;
+    std::uint32_t m_nSamples = 0;
+    std::int32_t m_lastErrorSec = 0;
+    std::int8_t m_offset = 0;
+    bool m_fReference = false;
+    };
+
+} // namespace McciCatena4430
+
+#endif // !defined(_Catena4430_cRtcDrift_h_)
@@ -0,0 +1,252 @@
+/*
+
+Module: Catena4430_cUplinkQueue.cpp
+
+Function:
+    cUplinkQueue: FRAM-backed queue of uplinks that didn't get through.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#include "Catena4430_cUplinkQueue.h"
+
+#include "Catena4430_Crc32.h"
+#include <Catena_Fram.h>
+#include <algorithm>
+
+using namespace McciCatena4430;
+using namespace McciCatena;
+
+namespace {
+
+constexpr std::uint32_t kMagic = 0x32305155; // "UQ02"
+
+// header layout: magic, head, used, count, (reserved), nDropped, then
+// the CRC of those.
+constexpr unsigned kHeaderCrcOffset = 16;
+
+void put16(std::uint8_t *p, std::uint16_t v)
+    {
+    p[0] = std::uint8_t(v);
+    p[1] = std::uint8_t(v >> 8);
+    }
+
+void put32(std::uint8_t *p, std::uint32_t v)
+    {
+    put16(p, std::uint16_t(v));
+    put16(p + 2, std::uint16_t(v >> 16));
+    }
+
+std::uint16_t get16(const std::uint8_t *p)
+    {
+    return std::uint16_t(p[0] | (p[1] << 8));
+    }
+
+std::uint32_t get32(const std::uint8_t *p)
+    {
+    return get16(p) | (std::uint32_t(get16(p + 2)) << 16);
+    }
+
+std::uint32_t headerCrc(const std::uint8_t *pHeader)
+    {
+    cCrc32 crc;
+
+    crc.begin();
+    crc.update(pHeader, kHeaderCrcOffset);
+    return crc.get();
+    }
+
+} // namespace
+
+static_assert(kHeaderCrcOffset + 4 == cUplinkQueue::kHeaderSize, "header layout doesn't match kHeaderSize");
+
+bool cUplinkQueue::begin(cFram *pFram, std::uint32_t offset, std::uint32_t nBytes)
+    {
+    this->m_pFram = nullptr;
+    this->m_head = this->m_used = this->m_count = this->m_ringSize = 0;
+    this->m_nDropped = 0;
+
+    if (pFram == nullptr || nBytes < kHeaderSize + 1 + kMaxPayload)
+        return false;
+
+    std::uint32_t const ringSize = nBytes - kHeaderSize;
+
+    this->m_pFram = pFram;
+    this->m_offset = offset;
+    this->m_ringSize = std::uint16_t(ringSize > 0xFFFF ? 0xFFFF : ringSize);
+
+    std::uint8_t header[kHeaderSize];
+    pFram->read(offset, header, sizeof(header));
+
+    std::uint16_t const head = get16(header + 4);
+    std::uint16_t const used = get16(header + 6);
+    std::uint16_t const count = get16(header + 8);
+
+    if (get32(header + 0) == kMagic &&
+        get32(header + kHeaderCrcOffset) == headerCrc(header) &&
+        head < this->m_ringSize &&
+        used <= this->m_ringSize &&
+        count <= used)
+        {
+        this->m_head = head;
+        this->m_used = used;
+        this->m_count = count;
+        this->m_nDropped = get32(header + 12);
+        }
+    else
+        {
+        // never written, damaged, or from another layout.
+        this->writeHeader();
+        }
+
+    this->m_stats.maxDepth = this->m_count;
+    return true;
+    }
+
+void cUplinkQueue::writeHeader()
+    {
+    std::uint8_t header[kHeaderSize];
+
+    put32(header + 0, kMagic);
+    put16(header + 4, this->m_head);
+    put16(header + 6, this->m_used);
+    put16(header + 8, this->m_count);
+    put16(header + 10, 0);
+    put32(header + 12, this->m_nDropped);
+    put32(header + kHeaderCrcOffset, headerCrc(header));
+
+    this->m_pFram->write(this->m_offset, header, sizeof(header));
+    }
+
+void cUplinkQueue::readRing(std::uint32_t pos, std::uint8_t *pBuffer, std::size_t n) const
+    {
+    std::uint32_t const base = this->m_offset + kHeaderSize;
+
+    if (pos >= this->m_ringSize)
+        pos -= this->m_ringSize;
+
+    std::size_t const nFirst = std::min<std::size_t>(n, this->m_ringSize - pos);
+    this->m_pFram->read(base + pos, pBuffer, nFirst);
+    if (nFirst < n)
+        this->m_pFram->read(base, pBuffer + nFirst, n - nFirst);
+    }
+
+void cUplinkQueue::writeRing(std::uint32_t pos, const std::uint8_t *pBuffer, std::size_t n)
+    {
+    std::uint32_t const base = this->m_offset + kHeaderSize;
+
+    if (pos >= this->m_ringSize)
+        pos -= this->m_ringSize;
+
+    std::size_t const nFirst = std::min<std::size_t>(n, this->m_ringSize - pos);
+    this->m_pFram->write(base + pos, pBuffer, nFirst);
+    if (nFirst < n)
+        this->m_pFram->write(base, pBuffer + nFirst, n - nFirst);
+    }
+
+// forget the oldest payload; the caller writes the header.
+void cUplinkQueue::dropOldest()
+    {
+    std::uint8_t nData;
+
+    this->readRing(this->m_head, &nData, 1);
+
+    // a length that runs past what's queued means the ring is damaged;
+    // drop everything.
+    std::uint32_t const nEntry = 1u + nData;
+    if (nData == 0 || nEntry > this->m_used || this->m_count <= 1)
+        {
+        this->m_head = 0;
+        this->m_used = 0;
+        this->m_count = 0;
+        return;
+        }
+
+    std::uint32_t head = this->m_head + nEntry;
+    if (head >= this->m_ringSize)
+        head -= this->m_ringSize;
+
+    this->m_head = std::uint16_t(head);
+    this->m_used -= std::uint16_t(nEntry);
+    --this->m_count;
+    }
+
+bool cUplinkQueue::push(const std::uint8_t *pData, std::size_t nData)
+    {
+    if (this->m_pFram == nullptr || nData == 0 || nData > kMaxPayload)
+        return false;
+
+    // make room first, so a reset during the write can't leave a
+    // half-overwritten payload in the queue.
+    if (this->m_used + 1u + nData > this->m_ringSize)
+        {
+        do  {
+            this->dropOldest();
+            ++this->m_nDropped;
+            } while (this->m_used + 1u + nData > this->m_ringSize);
+
+        this->writeHeader();
+        }
+
+    std::uint8_t const len = std::uint8_t(nData);
+    std::uint32_t const tail = this->m_head + this->m_used;
+
+    this->writeRing(tail, &len, 1);
+    this->writeRing(tail + 1, pData, nData);
+
+    this->m_used += std::uint16_t(1 + nData);
+    ++this->m_count;
+    this->writeHeader();
+
+    ++this->m_stats.nQueued;
+    if (this->m_count > this->m_stats.maxDepth)
+        this->m_stats.maxDepth = this->m_count;
+
+    return true;
+    }
+
+std::size_t cUplinkQueue::peek(std::uint8_t *pBuffer)
+    {
+    while (this->m_count != 0)
+        {
+        std::uint8_t nData;
+
+        this->readRing(this->m_head, &nData, 1);
+        if (nData != 0 && 1u + nData <= this->m_used)
+            {
+            this->readRing(this->m_head + 1u, pBuffer, nData);
+            return nData;
+            }
+
+        // not a payload we could have written.
+        this->dropOldest();
+        this->writeHeader();
+        }
+
+    return 0;
+    }
+
+void cUplinkQueue::pop()
+    {
+    if (this->m_count == 0)
+        return;
+
+    this->dropOldest();
+    this->writeHeader();
+    ++this->m_stats.nSent;
+    }
+
+void cUplinkQueue::clear()
+    {
+    if (this->m_pFram == nullptr)
+        return;
+
+    this->m_head = this->m_used = this->m_count = 0;
+    this->m_nDropped = 0;
+    this->writeHeader();
+    }
@@ -0,0 +1,122 @@
+/*
+
+Module: Catena4430_cUplinkQueue.h
+
+Function:
+    cUplinkQueue: FRAM-backed queue of uplinks that didn't get through.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena4430_cUplinkQueue_h_
+# define _Catena4430_cUplinkQueue_h_
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace McciCatena {
+class cFram;
+} // namespace McciCatena
+
+namespace McciCatena4430 {
+
+/*
+
+Overview:
+    cUplinkQueue keeps encoded uplink payloads in an area of FRAM, so
+    they survive a reset, and gives them back oldest first. The payloads
+    already carry their own timestamp (see fillTxBuffer()), so the queue
+    stores only the bytes.
+
+    The area starts with a header (where the oldest payload starts, how
+    many bytes and payloads are queued, and how many payloads have been
+    dropped, with a CRC). The rest is a circular byte buffer of payloads,
+    each preceded by its length, so short payloads don't waste space.
+    When there's no room, push() drops the oldest payloads. The header is
+    always written after the bytes it refers to, so losing power during
+    a write can at worst lose the payload being written; if the header
+    itself is damaged, the queue starts over empty.
+
+*/
+
+class cUplinkQueue
+    {
+public:
+    // largest payload that can be queued.
+    static constexpr std::size_t kMaxPayload = 242;
+    static constexpr std::size_t kHeaderSize = 20;
+
+    struct Stats
+        {
+        // payloads added since boot
+        std::uint32_t nQueued;
+        // payloads removed after being sent, since boot
+        std::uint32_t nSent;
+        // most payloads held at once, since boot
+        std::uint32_t maxDepth;
+        };
+
+    cUplinkQueue() {}
+
+    // neither copyable nor movable
+    cUplinkQueue(const cUplinkQueue&) = delete;
+    cUplinkQueue& operator=(const cUplinkQueue&) = delete;
+    cUplinkQueue(const cUplinkQueue&&) = delete;
+    cUplinkQueue& operator=(const cUplinkQueue&&) = delete;
+
+    // use nBytes of FRAM at offset; picks up whatever was queued before
+    // the last reset. Returns false (and queues nothing) if pFram is null
+    // or the area can't hold a payload of kMaxPayload bytes.
+    bool begin(McciCatena::cFram *pFram, std::uint32_t offset, std::uint32_t nBytes);
+
+    // add a payload, dropping the oldest if full.
+    bool push(const std::uint8_t *pData, std::size_t nData);
+
+    // copy the oldest payload to pBuffer, which must hold kMaxPayload
+    // bytes, and return its length; 0 if the queue is empty.
+    std::size_t peek(std::uint8_t *pBuffer);
+
+    // remove the oldest payload, after it has been sent.
+    void pop();
+
+    // throw away everything, and reset the drop count.
+    void clear();
+
+    bool isEnabled() const { return this->m_pFram != nullptr; }
+    unsigned size() const { return this->m_count; }
+    bool empty() const { return this->m_count == 0; }
+    // bytes in use (including the length bytes) and available.
+    std::uint32_t getBytesUsed() const { return this->m_used; }
+    std::uint32_t getBytesTotal() const { return this->m_ringSize; }
+
+    // payloads dropped because the queue was full, since it was cleared.
+    std::uint32_t getDropped() const { return this->m_nDropped; }
+    const Stats &getStats() const { return this->m_stats; }
+
+private:
+    // read or write the ring, wrapping at the end.
+    void readRing(std::uint32_t pos, std::uint8_t *pBuffer, std::size_t n) const;
+    void writeRing(std::uint32_t pos, const std::uint8_t *pBuffer, std::size_t n);
+    void dropOldest();
+    void writeHeader();
+
+    McciCatena::cFram *m_pFram = nullptr;
+    std::uint32_t m_offset = 0;
+    std::uint32_t m_nDropped = 0;
+    std::uint16_t m_ringSize = 0;
+    std::uint16_t m_head = 0;
+    std::uint16_t m_used = 0;
+    std::uint16_t m_count = 0;
+    Stats m_stats {};
+    };
+
+} // namespace McciCatena4430
+
+#endif // !defined(_Catena4430_cUplinkQueue_h_)
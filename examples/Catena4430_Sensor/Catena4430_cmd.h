@@ -20,8 +20,13 @@ Author:
 
 #include <Catena_CommandStream.h>
 
+McciCatena::cCommandStream::CommandFn cmdActivity;
 McciCatena::cCommandStream::CommandFn cmdDate;
+McciCatena::cCommandStream::CommandFn cmdLight;
 McciCatena::cCommandStream::CommandFn cmdLog;
 McciCatena::cCommandStream::CommandFn cmdDir;
+McciCatena::cCommandStream::CommandFn cmdSdBench;
+McciCatena::cCommandStream::CommandFn cmdSdMigrate;
+McciCatena::cCommandStream::CommandFn cmdStats;
 
 #endif /* _Catena4430_cmd_h_ */
@@ -0,0 +1,101 @@
+/*
+
+Module:	cmdActivity.cpp
+
+Function:
+    Process the "activity" command.
+
+Copyright and License:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation	May 2021
+
+*/
+
+#include "Catena4430_cmd.h"
+
+#include "Catena4430_Sensor.h"
+
+using namespace McciCatena;
+using namespace McciCatena4430;
+
+/*
+
+Name:   ::cmdActivity()
+
+Function:
+    Command dispatcher for "activity" command.
+
+Definition:
+    McciCatena::cCommandStream::CommandFn cmdActivity;
+
+    McciCatena::cCommandStream::CommandStatus cmdActivity(
+        cCommandStream *pThis,
+        void *pContext,
+        int argc,
+        char **argv
+        );
+
+Description:
+    The "activity" command has the following syntax:
+
+    activity
+        Display the number of activity samples kept for each uplink,
+        and the bits per sample for packed activity (format 0x24).
+
+    activity {depth} [{bits}]
+        Set the number of samples, and optionally the bits per sample.
+        Both take effect at the next uplink.
+
+Returns:
+    cCommandStream::CommandStatus::kSuccess if successful.
+    Some other value for failure.
+
+*/
+
+// argv[0] is "activity"
+// argv[1] is the new depth; if omitted, the settings are printed
+// argv[2] is the new bits per sample
+cCommandStream::CommandStatus cmdActivity(
+    cCommandStream *pThis,
+    void *pContext,
+    int argc,
+    char **argv
+    )
+    {
+    if (argc > 3)
+        return cCommandStream::CommandStatus::kInvalidParameter;
+
+    if (argc >= 2)
+        {
+        cCommandStream::CommandStatus status;
+        std::uint32_t depth;
+        std::uint32_t bits;
+
+        status = cCommandStream::getuint32(argc, argv, 1, /*radix*/ 0, depth, /* default */ 0);
+        if (status != cCommandStream::CommandStatus::kSuccess)
+            return status;
+
+        status = cCommandStream::getuint32(argc, argv, 2, /*radix*/ 0, bits, gMeasurementLoop.getActivityBits());
+        if (status != cCommandStream::CommandStatus::kSuccess)
+            return status;
+
+        if (! (1 <= depth && depth <= cMeasurementLoop::kMaxActivityEntries))
+            return cCommandStream::CommandStatus::kInvalidParameter;
+        if (! (cMeasurementLoop::kActivityBitsMin <= bits && bits <= cMeasurementLoop::kActivityBitsMax))
+            return cCommandStream::CommandStatus::kInvalidParameter;
+
+        gMeasurementLoop.setActivityDepth(depth);
+        gMeasurementLoop.setActivityBits(bits);
+        }
+
+    pThis->printf(
+        "activity: %u samples per uplink (at most %u in this format); %u bits per packed sample\n",
+        gMeasurementLoop.getActivityDepth(),
+        gMeasurementLoop.getMaxActivityDepth(),
+        gMeasurementLoop.getActivityBits()
+        );
+
+    return cCommandStream::CommandStatus::kSuccess;
+    }
@@ -16,6 +16,7 @@ Author:
 #include "Catena4430_cmd.h"
 
 #include "Catena4430.h"
+#include "Catena4430_Sensor.h"
 #include <Catena_Date.h>
 
 using namespace McciCatena;
@@ -152,6 +153,9 @@ cCommandStream::CommandStatus cmdDate(
                     pThis->printf("couldn't set clock: %u\n", errCode);
                     return cCommandStream::CommandStatus::kIoError;
                     }
+
+                // this isn't a good reference for drift estimation.
+                gMeasurementLoop.clearRtcDriftReference();
                 }
             }
 
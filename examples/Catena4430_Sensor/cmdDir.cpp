@@ -94,6 +94,13 @@ cCommandStream::CommandStatus cmdDir(
     else
         sFile = argv[1];
 
+    // the measurement loop powers the card up and down as it writes.
+    if (gMeasurementLoop.isSdBusy())
+        {
+        pThis->printf("%s: SD card busy, try again\n", argv[0]);
+        return cCommandStream::CommandStatus::kIoError;
+        }
+
     bool fHaveCard = gMeasurementLoop.checkSdCard();
     if (! fHaveCard)
         {
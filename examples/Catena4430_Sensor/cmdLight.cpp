@@ -0,0 +1,92 @@
+/*
+
+Module:	cmdLight.cpp
+
+Function:
+    Process the "light" command.
+
+Copyright and License:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation	May 2021
+
+*/
+
+#include "Catena4430_cmd.h"
+
+#include "Catena4430_Sensor.h"
+
+using namespace McciCatena;
+using namespace McciCatena4430;
+
+/*
+
+Name:   ::cmdLight()
+
+Function:
+    Command dispatcher for "light" command.
+
+Definition:
+    McciCatena::cCommandStream::CommandFn cmdLight;
+
+    McciCatena::cCommandStream::CommandStatus cmdLight(
+        cCommandStream *pThis,
+        void *pContext,
+        int argc,
+        char **argv
+        );
+
+Description:
+    The "light" command has the following syntax:
+
+    light
+        Display the last light reading, the low-light state, and the
+        background check interval.
+
+    light {seconds}
+        Set the background check interval; 0 turns the checks off.
+
+Returns:
+    cCommandStream::CommandStatus::kSuccess if successful.
+    Some other value for failure.
+
+*/
+
+// argv[0] is "light"
+// argv[1] is the new check interval; if omitted, the state is printed
+cCommandStream::CommandStatus cmdLight(
+    cCommandStream *pThis,
+    void *pContext,
+    int argc,
+    char **argv
+    )
+    {
+    if (argc > 2)
+        return cCommandStream::CommandStatus::kInvalidParameter;
+
+    if (argc == 2)
+        {
+        cCommandStream::CommandStatus status;
+        std::uint32_t sec;
+
+        status = cCommandStream::getuint32(argc, argv, 1, /*radix*/ 0, sec, /* default */ 0);
+        if (status != cCommandStream::CommandStatus::kSuccess)
+            return status;
+
+        gMeasurementLoop.setLightCheckSec(sec);
+        }
+
+    auto const &light = gMeasurementLoop.getLightStats();
+
+    pThis->printf(
+        "light: %u (%s); checked every %u s; %u checks, %u changes\n",
+        unsigned(light.lastLight),
+        gMeasurementLoop.isLowLight() ? "low" : "normal",
+        unsigned(gMeasurementLoop.getLightCheckSec()),
+        unsigned(light.nChecks),
+        unsigned(light.nChanges)
+        );
+
+    return cCommandStream::CommandStatus::kSuccess;
+    }
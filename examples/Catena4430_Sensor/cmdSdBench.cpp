@@ -0,0 +1,191 @@
+/*
+
+Module:	cmdSdBench.cpp
+
+Function:
+    Process the "sdbench" command.
+
+Copyright and License:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation	May 2021
+
+*/
+
+#include "Catena4430_cmd.h"
+
+#include "Catena4430_Sensor.h"
+
+#include <cstring>
+
+using namespace McciCatena;
+using namespace McciCatena4430;
+
+// the SPI clock rate IDs to try, fastest first.
+static const std::uint8_t kBenchRates[] = { 0, 1, 2, 3 };
+
+// number of times each rate must pass to be considered stable.
+constexpr unsigned kBenchPasses = 2;
+
+static void printBenchResult(cCommandStream *pThis, const cMeasurementLoop::SdBenchResult &r);
+
+/*
+
+Name:   ::cmdSdBench()
+
+Function:
+    Command dispatcher for "sdbench" command.
+
+Definition:
+    McciCatena::cCommandStream::CommandFn cmdSdBench;
+
+    McciCatena::cCommandStream::CommandStatus cmdSdBench(
+        cCommandStream *pThis,
+        void *pContext,
+        int argc,
+        char **argv
+        );
+
+Description:
+    The "sdbench" command has the following syntax:
+
+    sdbench
+        Benchmark the SD card at each SPI clock, fastest first, and
+        save the fastest clock that passed every run in FRAM. The
+        data logger uses that clock from then on.
+
+    sdbench -n
+        Benchmark, but don't change the saved clock.
+
+    sdbench default
+        Go back to the default clock (SPI_HALF_SPEED).
+
+    Each clock is tried kBenchPasses times. A run writes a scratch file
+    in the root directory, reads it back to check it, and removes it.
+    The whole thing takes several seconds; the data logger waits.
+
+Returns:
+    cCommandStream::CommandStatus::kSuccess if successful.
+    Some other value for failure.
+
+*/
+
+// argv[0] is "sdbench"
+// argv[1] is optional "-n" or "default"
+cCommandStream::CommandStatus cmdSdBench(
+    cCommandStream *pThis,
+    void *pContext,
+    int argc,
+    char **argv
+    )
+    {
+    bool fSave = true;
+
+    if (argc > 2)
+        return cCommandStream::CommandStatus::kInvalidParameter;
+
+    if (argc == 2)
+        {
+        if (std::strcmp(argv[1], "default") == 0)
+            {
+            gMeasurementLoop.saveSdSckRate(cMeasurementLoop::kSdSckRateDefault);
+            pThis->printf("%s: SD clock reset to default\n", argv[0]);
+            return cCommandStream::CommandStatus::kSuccess;
+            }
+        else if (std::strcmp(argv[1], "-n") == 0)
+            fSave = false;
+        else
+            return cCommandStream::CommandStatus::kInvalidParameter;
+        }
+
+    if (gMeasurementLoop.isSdBusy())
+        {
+        pThis->printf("%s: SD card busy, try again\n", argv[0]);
+        return cCommandStream::CommandStatus::kIoError;
+        }
+
+    bool fFound = false;
+    std::uint8_t bestRate = 0;
+
+    for (auto const rate : kBenchRates)
+        {
+        bool fStable = true;
+
+        for (unsigned iPass = 0; iPass < kBenchPasses; ++iPass)
+            {
+            cMeasurementLoop::SdBenchResult r;
+
+            if (! gMeasurementLoop.runSdBench(rate, r))
+                fStable = false;
+
+            printBenchResult(pThis, r);
+
+            if (! r.fMounted)
+                break;
+            }
+
+        if (fStable && ! fFound)
+            {
+            fFound = true;
+            bestRate = rate;
+            }
+        }
+
+    if (! fFound)
+        {
+        pThis->printf("%s: no SD card, or no clock worked\n", argv[0]);
+        return cCommandStream::CommandStatus::kIoError;
+        }
+
+    pThis->printf(
+        "%s: fastest stable clock: rate %u (%u kHz)\n",
+        argv[0], bestRate, unsigned(cMeasurementLoop::getSdSckHz(bestRate) / 1000)
+        );
+
+    if (fSave)
+        {
+        if (gMeasurementLoop.saveSdSckRate(bestRate))
+            pThis->printf("%s: saved\n", argv[0]);
+        else
+            pThis->printf("%s: not saved (no FRAM)\n", argv[0]);
+        }
+
+    return cCommandStream::CommandStatus::kSuccess;
+    }
+
+static void
+printBenchResult(
+    cCommandStream *pThis,
+    const cMeasurementLoop::SdBenchResult &r
+    )
+    {
+    pThis->printf(
+        "rate %u (%u kHz): ",
+        r.sckRate, unsigned(cMeasurementLoop::getSdSckHz(r.sckRate) / 1000)
+        );
+
+    if (! r.fMounted)
+        {
+        pThis->printf("no mount\n");
+        return;
+        }
+
+    pThis->printf(
+        "ready %u ms, mount %u us, seq %u B/s, append %u B/s (max %u us), %s\n",
+        unsigned(r.readyMs),
+        unsigned(r.mountUs),
+        unsigned(r.seqBytesPerSec),
+        unsigned(r.appendBytesPerSec),
+        unsigned(r.appendMaxUs),
+        r.fVerified ? "verified" : "FAILED"
+        );
+
+    pThis->printf("  append latency:");
+    for (unsigned i = 0; i < cMeasurementLoop::kSdBenchBuckets; ++i)
+        {
+        if (r.histogram[i] != 0)
+            pThis->printf(" %s:%u", cMeasurementLoop::getSdBenchBucketName(i), r.histogram[i]);
+        }
+    pThis->printf("\n");
+    }
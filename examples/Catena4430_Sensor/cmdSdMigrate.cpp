@@ -0,0 +1,83 @@
+/*
+
+Module:	cmdSdMigrate.cpp
+
+Function:
+    Process the "sdmigrate" command.
+
+Copyright and License:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation	May 2021
+
+*/
+
+#include "Catena4430_cmd.h"
+
+#include "Catena4430_Sensor.h"
+
+using namespace McciCatena;
+
+/*
+
+Name:   ::cmdSdMigrate()
+
+Function:
+    Command dispatcher for "sdmigrate" command.
+
+Definition:
+    McciCatena::cCommandStream::CommandFn cmdSdMigrate;
+
+    McciCatena::cCommandStream::CommandStatus cmdSdMigrate(
+        cCommandStream *pThis,
+        void *pContext,
+        int argc,
+        char **argv
+        );
+
+Description:
+    The "sdmigrate" command has the following syntax:
+
+    sdmigrate
+        Move any data files in the old flat layout (Data/YYYYMMDD.DAT)
+        to the per-month layout (Data/YYYY/MM/DD.DAT).
+
+Returns:
+    cCommandStream::CommandStatus::kSuccess if successful.
+    Some other value for failure.
+
+*/
+
+// argv[0] is "sdmigrate"
+cCommandStream::CommandStatus cmdSdMigrate(
+    cCommandStream *pThis,
+    void *pContext,
+    int argc,
+    char **argv
+    )
+    {
+    unsigned nMoved, nFailed;
+
+    if (argc > 1)
+        return cCommandStream::CommandStatus::kInvalidParameter;
+
+    // the measurement loop powers the card up and down as it writes.
+    if (gMeasurementLoop.isSdBusy())
+        {
+        pThis->printf("%s: SD card busy, try again\n", argv[0]);
+        return cCommandStream::CommandStatus::kIoError;
+        }
+
+    if (! gMeasurementLoop.migrateSdData(nMoved, nFailed))
+        {
+        pThis->printf("%s: no SD card found\n", argv[0]);
+        return cCommandStream::CommandStatus::kIoError;
+        }
+
+    pThis->printf("%s: %u files moved, %u failed\n", argv[0], nMoved, nFailed);
+
+    return nFailed == 0 ? cCommandStream::CommandStatus::kSuccess
+                        : cCommandStream::CommandStatus::kWriteError
+                        ;
+    }
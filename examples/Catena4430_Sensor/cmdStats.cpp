@@ -0,0 +1,194 @@
+/*
+
+Module:	cmdStats.cpp
+
+Function:
+    Process the "stats" command.
+
+Copyright and License:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation	May 2021
+
+*/
+
+#include "Catena4430_cmd.h"
+
+#include "Catena4430_Sensor.h"
+
+using namespace McciCatena;
+using namespace McciCatena4430;
+
+/*
+
+Name:   ::cmdStats()
+
+Function:
+    Command dispatcher for "stats" command.
+
+Definition:
+    McciCatena::cCommandStream::CommandFn cmdStats;
+
+    McciCatena::cCommandStream::CommandStatus cmdStats(
+        cCommandStream *pThis,
+        void *pContext,
+        int argc,
+        char **argv
+        );
+
+Description:
+    The "stats" command has the following syntax:
+
+    stats
+        Display run-time statistics.
+
+Returns:
+    cCommandStream::CommandStatus::kSuccess if successful.
+    Some other value for failure.
+
+*/
+
+// argv[0] is "stats"
+cCommandStream::CommandStatus cmdStats(
+    cCommandStream *pThis,
+    void *pContext,
+    int argc,
+    char **argv
+    )
+    {
+    if (argc > 1)
+        return cCommandStream::CommandStatus::kInvalidParameter;
+
+    auto const &sd = gMeasurementLoop.getSdWriterStats();
+
+    pThis->printf(
+        "SD writer: %u writes, %u errors, last write %u ms, longest step %u us (%s)%s\n",
+        unsigned(sd.nCycles),
+        unsigned(sd.nErrors),
+        unsigned(sd.lastCycleMs),
+        unsigned(sd.maxStepUs),
+        cMeasurementLoop::getStateName(sd.maxStepState),
+        gMeasurementLoop.isSdBusy() ? ", busy" : ""
+        );
+    if (sd.nCompressed != 0 && sd.compressOutBytes != 0)
+        {
+        pThis->printf(
+            "SD compression: %u records, %u -> %u bytes (ratio %u.%02u), %u us/record (max %u us)\n",
+            unsigned(sd.nCompressed),
+            unsigned(sd.compressRawBytes),
+            unsigned(sd.compressOutBytes),
+            unsigned(sd.compressRawBytes / sd.compressOutBytes),
+            unsigned((std::uint64_t(sd.compressRawBytes) * 100 / sd.compressOutBytes) % 100),
+            unsigned(sd.compressUsTotal / sd.nCompressed),
+            unsigned(sd.compressUsMax)
+            );
+        }
+
+    auto const &meas = gMeasurementLoop.getMeasureStats();
+
+    if (meas.nMeasurements != 0)
+        pThis->printf(
+            "Measure: %u measurements, last %u ms, average %u ms, longest %u ms, %u light timeouts\n",
+            unsigned(meas.nMeasurements),
+            unsigned(meas.lastDwellMs),
+            unsigned(meas.totalDwellMs / meas.nMeasurements),
+            unsigned(meas.maxDwellMs),
+            unsigned(meas.nLightTimeouts)
+            );
+
+    auto const &uq = gMeasurementLoop.getUplinkQueue();
+
+    if (uq.isEnabled())
+        pThis->printf(
+            "Uplink queue: %u waiting (%u of %u bytes), most %u; %u queued, %u backfilled since boot; %u dropped; %u activity samples dropped\n",
+            uq.size(),
+            unsigned(uq.getBytesUsed()),
+            unsigned(uq.getBytesTotal()),
+            unsigned(uq.getStats().maxDepth),
+            unsigned(uq.getStats().nQueued),
+            unsigned(uq.getStats().nSent),
+            unsigned(uq.getDropped()),
+            unsigned(meas.nActivityDropped)
+            );
+
+    auto const &sizes = gMeasurementLoop.getUplinkSizeStats();
+
+    pThis->printf(
+        "Uplink size: %u bytes at this data rate; %u activity samples and %u pellet counts held for later uplinks, %u samples only on SD; %u uplinks shortened\n",
+        unsigned(gMeasurementLoop.getTxBufferLimit()),
+        unsigned(sizes.nActivityHeld),
+        unsigned(sizes.nPelletsHeld),
+        unsigned(sizes.nActivityNotSent),
+        unsigned(sizes.nShortened)
+        );
+
+    pThis->printf(
+        "SD card: %s, SPI clock rate %u (%u kHz)\n",
+        gMeasurementLoop.isSdMounted() ? "kept mounted (USB power)" : "powered down between writes",
+        gMeasurementLoop.getSdSckRate(),
+        unsigned(cMeasurementLoop::getSdSckHz(gMeasurementLoop.getSdSckRate()) / 1000)
+        );
+
+    auto const &io = gpio.getStats();
+    auto const &mirror = gLedMirror.getStats();
+
+    pThis->printf(
+        "GPIO: %u output changes requested, %u I2C writes done; %u input changes, %u LED updates\n",
+        unsigned(io.nRequests),
+        unsigned(io.nWrites),
+        unsigned(mirror.nInterrupts),
+        unsigned(mirror.nUpdates)
+        );
+
+    auto const printI2c =
+        [pThis](const char *pName, const cI2cBus::DeviceStats &i2c)
+            {
+            pThis->printf(
+                "I2C %s: %u transactions, %u bytes, %u NACKs, %u errors, %u us on the bus\n",
+                pName,
+                unsigned(i2c.nTransactions),
+                unsigned(i2c.nBytes),
+                unsigned(i2c.nNacks),
+                unsigned(i2c.nErrors),
+                unsigned(i2c.busTimeUs)
+                );
+            };
+
+    printI2c("PCA9570", i2cgpio.getI2cStats());
+    printI2c("PCF8523", gPcf8523.getI2cStats());
+
+    auto const &clk = gClock.getStats();
+
+    pThis->printf(
+        "Clock: %u reads from the MCU RTC (no I2C), %u sets, %u loads from the PCF8523\n",
+        unsigned(clk.nGets),
+        unsigned(clk.nSets),
+        unsigned(clk.nMasterSyncs)
+        );
+
+    auto const &drift = gMeasurementLoop.getRtcDrift();
+
+    pThis->printf(
+        "RTC drift: %d ppb (%s, %u samples over %u h), last error %d s, offset %d; time request every %u h\n",
+        int(drift.getDriftPpb()),
+        drift.isCharacterized() ? "in use" : "still measuring",
+        unsigned(drift.getSampleCount()),
+        unsigned(drift.getSpanSec() / 3600),
+        int(drift.getLastErrorSec()),
+        int(drift.getOffset()),
+        unsigned(gMeasurementLoop.getRtcSetSec() / 3600)
+        );
+
+    auto const &nw = gMeasurementLoop.getNwTimeStats();
+
+    if (nw.nSyncs != 0)
+        pThis->printf(
+            "Network time: %u syncs; at the last one, the MCU RTC was off by %d ms and the clocks were set %u ms after the second\n",
+            unsigned(nw.nSyncs),
+            int(nw.lastRtcErrorMs),
+            unsigned(nw.lastLateMs)
+            );
+
+    return cCommandStream::CommandStatus::kSuccess;
+    }
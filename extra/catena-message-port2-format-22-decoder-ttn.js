@@ -3,7 +3,7 @@
 Name:   catena-message-port2-format-22-decoder-ttn.js
 
 Function:
-    Decode port 0x02 format 0x22 messages for TTN console.
+    Decode port 0x02 format 0x22, 0x23 and 0x24 messages for TTN console.
 
 Copyright and License:
     See accompanying LICENSE file at https://github.com/mcci-catena/MCCI-Catena-4430/
@@ -239,16 +239,228 @@ function DecodeV(Parse) {
     return DecodeI16(Parse) / 4096.0;
 }
 
+function DecodeBits(Parse, nBits) {
+    var result = 0;
+
+    for (var i = 0; i < nBits; ++i) {
+        var byte = Parse.bytes[Parse.i + (Parse.iBit >> 3)];
+        result = (result << 1) | ((byte >> (7 - (Parse.iBit & 7))) & 1);
+        ++Parse.iBit;
+    }
+
+    return result;
+}
+
+/*
+
+Name:   DecodePackedActivity()
+
+Function:
+    Decode the activity field of a format 0x24 message.
+
+Definition:
+    function DecodePackedActivity(Parse) -> array
+
+Description:
+    The field is a count and a bit depth, then a bit stream (most
+    significant bit first) with one code per sample:
+
+        0           the same level as before (the level before the
+                    first sample is 0)
+        10 dd       a change of -2, -1, +1, +2
+        110 rrrr    rrrr + 2 samples at the same level
+        111 level   any level
+
+    Levels 0 to 2^bits - 1 are mapped onto -1 to 1.
+
+*/
+
+function DecodePackedActivity(Parse) {
+    var nActivity = Parse.bytes[Parse.i++];
+    var bits = Parse.bytes[Parse.i++];
+    var maxLevel = (1 << bits) - 1;
+    var activity = [];
+    var level = 0;
+
+    Parse.iBit = 0;
+    while (activity.length < nActivity) {
+        var nSame = 1;
+
+        if (DecodeBits(Parse, 1) === 0) {
+            // same level
+        } else if (DecodeBits(Parse, 1) === 0) {
+            var code = DecodeBits(Parse, 2);
+            level += code < 2 ? code - 2 : code - 1;
+        } else if (DecodeBits(Parse, 1) === 0) {
+            nSame = DecodeBits(Parse, 4) + 2;
+        } else {
+            level = DecodeBits(Parse, bits);
+        }
+
+        for (; nSame > 0 && activity.length < nActivity; --nSame)
+            activity.push(level * 2 / maxLevel - 1);
+    }
+
+    Parse.i += (Parse.iBit + 7) >> 3;
+    return activity;
+}
+
+function DecodeI8(Parse) {
+    var result = Parse.bytes[Parse.i++];
+
+    // interpret uint8 as an int8 instead.
+    if (result & 0x80)
+        result += -0x100;
+
+    return result;
+}
+
+function DecodeTime(tGps) {
+    // convert to database time (which is UTC-like ignoring leap seconds)
+    return new Date((tGps + /* gps epoch to posix */ 315964800 - /* leap seconds */ 17) * 1000);
+}
+
+function DecodeEnv(decoded, tCode, pCode, rhCode) {
+    decoded.tempC = tCode / 256;
+    decoded.p = pCode * 4 / 100.0;
+    decoded.rh = rhCode * 100 / 65535.0;
+    decoded.tDewC = dewpoint(decoded.tempC, decoded.rh);
+    var tHeat = CalculateHeatIndex(decoded.tempC * 1.8 + 32, decoded.rh);
+    if (tHeat !== null)
+        decoded.tHeatIndexC = tHeat;
+}
+
+/*
+
+Name:   DecodeMultiWindow()
+
+Function:
+    Decode a format 0x23 message, which carries several measurement
+    windows.
+
+Definition:
+    function DecodeMultiWindow(bytes, port) -> object
+
+Description:
+    The fields that are sent once (voltages and boot count) are put at
+    the top level; each window's time and readings are put in an entry
+    of decoded.windows[], oldest first. After the first window, the
+    time and environmental readings are changes from the previous
+    window, and the pellet totals are the previous totals plus the
+    window's counts.
+
+*/
+
+function DecodeMultiWindow(bytes, port) {
+    var decoded = {};
+
+    // an object to help us parse.
+    var Parse = {};
+    Parse.bytes = bytes;
+    // i is used as the index into the message. Start with the time.
+    Parse.i = 1;
+
+    var tGps = DecodeU32(Parse);
+    if (port === 4)
+        decoded.backfill = true;
+
+    // fetch the bitmap.
+    var flags = bytes[Parse.i++];
+
+    if (flags & 0x1) {
+        decoded.Vbat = DecodeV(Parse);
+    }
+
+    if (flags & 0x2) {
+        decoded.Vsys = DecodeV(Parse);
+    }
+
+    if (flags & 0x4) {
+        decoded.Vbus = DecodeV(Parse);
+    }
+
+    if (flags & 0x8) {
+        var iBoot = bytes[Parse.i++];
+        decoded.boot = iBoot;
+    }
+
+    decoded.windows = [];
+
+    var tCode = 0;
+    var pCode = 0;
+    var rhCode = 0;
+    var totals = [0, 0];
+
+    for (var iWindow = 0; iWindow === 0 || RemainingBytes(Parse) > 0; ++iWindow) {
+        var window = {};
+
+        if (iWindow > 0)
+            tGps += DecodeU16(Parse);
+        window.time = DecodeTime(tGps);
+
+        if (flags & 0x10) {
+            // we have temp, pressure, RH
+            if (iWindow === 0) {
+                tCode = DecodeI16(Parse);
+                pCode = DecodeU16(Parse);
+                rhCode = DecodeU16(Parse);
+            } else {
+                tCode += DecodeI8(Parse) * 16;
+                pCode += DecodeI8(Parse);
+                rhCode += DecodeI8(Parse) * 256;
+            }
+            DecodeEnv(window, tCode, pCode, rhCode);
+        }
+
+        if (flags & 0x20) {
+            // we have light
+            window.irradiance = {};
+            window.irradiance.White = DecodeLight(Parse) * Math.pow(2.0, 24);
+        }
+
+        if (flags & 0x40) {
+            // we have gpio counts
+            window.pellets = [];
+            for (var i = 0; i < 2; ++i) {
+                window.pellets[i] = {};
+                if (iWindow === 0)
+                    totals[i] = DecodeU16(Parse);
+                var delta = bytes[Parse.i++];
+                if (iWindow > 0)
+                    totals[i] = (totals[i] + delta) & 0xFFFF;
+                window.pellets[i].Total = totals[i];
+                window.pellets[i].Delta = delta;
+            }
+        }
+
+        if (flags & 0x80) {
+            // we have Activity, preceded by the count.
+            window.activity = [];
+            var nActivity = bytes[Parse.i++];
+            for (var j = 0; j < nActivity; ++j)
+                window.activity[j] = DecodeActivity(Parse);
+        }
+
+        decoded.windows.push(window);
+    }
+
+    return decoded;
+}
+
 function Decoder(bytes, port) {
     // Decode an uplink message from a buffer
     // (array) of bytes to an object of fields.
     var decoded = {};
 
-    if (! (port === 2))
+    // port 4 carries uplinks that were queued while the network was
+    // unreachable, and sent later.
+    if (! (port === 2 || port === 4))
         return null;
 
     var uFormat = bytes[0];
-    if (! (uFormat === 0x22))
+    if (uFormat === 0x23)
+        return DecodeMultiWindow(bytes, port);
+    if (! (uFormat === 0x22 || uFormat === 0x24))
         return null;
 
     // an object to help us parse.
@@ -259,6 +471,8 @@ function Decoder(bytes, port) {
 
     // fetch time; convert to database time (which is UTC-like ignoring leap seconds)
     decoded.time = new Date((DecodeU32(Parse) + /* gps epoch to posix */ 315964800 - /* leap seconds */ 17) * 1000);
+    if (port === 4)
+        decoded.backfill = true;
 
     // fetch the bitmap.
     var flags = bytes[Parse.i++];
@@ -307,7 +521,10 @@ function Decoder(bytes, port) {
         }
     }
 
-    if (flags & 0x80) {
+    if ((flags & 0x80) && uFormat === 0x24) {
+        // we have packed Activity
+        decoded.activity = DecodePackedActivity(Parse);
+    } else if (flags & 0x80) {
         // we have Activity
         decoded.activity = [];
         var i = 0;
@@ -0,0 +1,786 @@
+/*
+
+Name:   catena-message-port2-format-23-test.cpp
+
+Function:
+    Generate test vectors for port 0x02 format 0x23 messages.
+
+Copyright and License:
+    See accompanying LICENSE file at https://github.com/mcci-catena/MCCI-Catena-4430/
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+enum class OutputFormat
+    {
+    Bytes, Yaml
+    };
+
+template <typename T>
+struct val
+    {
+    bool fValid;
+    T v;
+    };
+
+struct env
+    {
+    float t;
+    float p;
+    float rh;
+    };
+
+struct light
+    {
+    float White;
+    };
+
+struct activity
+    {
+    static constexpr unsigned knAvg = 16;
+    unsigned nAvg;
+    float Avg[knAvg];
+    };
+
+struct pellets
+    {
+    static constexpr unsigned knCounter = 2;
+    struct
+        {
+        std::uint16_t Total;
+        std::uint8_t Delta;
+        } counter[knCounter];
+    };
+
+// one measurement window.
+struct Window
+    {
+    val<std::uint32_t> Time;
+    val<env> Env;
+    val<light> Light;
+    val<activity> Activity;
+    val<pellets> Pellets;
+    };
+
+// the voltages and boot count are sent once; the rest is per window.
+struct Measurements
+    {
+    static constexpr unsigned knWindows = 16;
+    val<float> Vbat;
+    val<float> Vsys;
+    val<float> Vbus;
+    val<std::uint8_t> Boot;
+    unsigned nWindows;
+    Window window[knWindows];
+    };
+
+//--- globals
+OutputFormat gOutputFormat = OutputFormat::Bytes;
+
+//--- code
+uint16_t
+LMIC_f2uflt16(
+        float f
+        )
+        {
+        if (f < 0.0)
+                return 0;
+        else if (f >= 1.0)
+                return 0xFFFF;
+        else
+                {
+                int iExp;
+                float normalValue;
+
+                normalValue = std::frexp(f, &iExp);
+
+                // f is supposed to be in [0..1), so useful exp
+                // is [0..-15]
+                iExp += 15;
+                if (iExp < 0)
+                        // underflow.
+                        iExp = 0;
+
+                // bits 15..12 are the exponent
+                // bits 11..0 are the fraction
+                // we conmpute the fraction and then decide if we need to round.
+                uint16_t outputFraction = std::ldexp(normalValue, 12) + 0.5;
+                if (outputFraction >= (1 << 12u))
+                        {
+                        // reduce output fraction
+                        outputFraction = 1 << 11;
+                        // increase exponent
+                        ++iExp;
+                        }
+
+                // check for overflow and return max instead.
+                if (iExp > 15)
+                        return 0xFFFF;
+
+                return (uint16_t)((iExp << 12u) | outputFraction);
+                }
+        }
+
+/*
+
+Name:   LMIC_f2sflt16()
+
+Function:
+        Encode a floating point number into a uint16_t.
+
+Definition:
+        uint16_t LMIC_f2sflt16(
+                float f
+                );
+
+Description:
+        The float to be transmitted must be a number in the range (-1.0, 1.0).
+        It is converted to 16-bit integer formatted as follows:
+
+                bits 15: sign
+                bits 14..11: biased exponent
+                bits 10..0: mantissa
+
+        The float is properly rounded, and saturates.
+
+        Note that the encoded value is sign/magnitude format, rather than
+        two's complement for negative values.
+
+Returns:
+        0xFFFF for negative values <= 1.0;
+        0x7FFF for positive values >= 1.0;
+        Otherwise an appropriate float.
+
+*/
+
+uint16_t
+LMIC_f2sflt16(
+        float f
+        )
+        {
+        if (f <= -1.0)
+                return 0xFFFF;
+        else if (f >= 1.0)
+                return 0x7FFF;
+        else
+                {
+                int iExp;
+                float normalValue;
+                uint16_t sign;
+
+                normalValue = frexpf(f, &iExp);
+
+                sign = 0;
+                if (normalValue < 0)
+                        {
+                        // set the "sign bit" of the result
+                        // and work with the absolute value of normalValue.
+                        sign = 0x8000;
+                        normalValue = -normalValue;
+                        }
+
+                // abs(f) is supposed to be in [0..1), so useful exp
+                // is [0..-15]
+                iExp += 15;
+                if (iExp < 0)
+                        iExp = 0;
+
+                // bit 15 is the sign
+                // bits 14..11 are the exponent
+                // bits 10..0 are the fraction
+                // we conmpute the fraction and then decide if we need to round.
+                uint16_t outputFraction = ldexpf(normalValue, 11) + 0.5;
+                if (outputFraction >= (1 << 11u))
+                        {
+                        // reduce output fraction
+                        outputFraction = 1 << 10;
+                        // increase exponent
+                        ++iExp;
+                        }
+
+                // check for overflow and return max instead.
+                if (iExp > 15)
+                        return 0x7FFF | sign;
+
+                return (uint16_t)(sign | (iExp << 11u) | outputFraction);
+                }
+        }
+
+std::uint16_t encode16s(float v)
+    {
+    float nv = std::floor(v + 0.5f);
+
+    if (nv > 32767.0f)
+        return 0x7FFFu;
+    else if (nv < -32768.0f)
+        return 0x8000u;
+    else
+        {
+        return (std::uint16_t) std::int16_t(nv);
+        }
+    }
+
+std::uint16_t encode16u(float v)
+    {
+    float nv = std::floor(v + 0.5f);
+    if (nv > 65535.0f)
+        return 0xFFFFu;
+    else if (nv < 0.0f)
+        return 0;
+    else
+        {
+        return std::uint16_t(nv);
+        }
+    }
+
+std::uint16_t encodeV(float v)
+    {
+    return encode16s(v * 4096.0f);
+    }
+
+std::uint16_t encodeT(float v)
+    {
+    return encode16s(v * 256.0f);
+    }
+
+std::uint16_t encodeP(float v)
+    {
+    return encode16u(v * 25.0f);
+    }
+
+std::uint16_t encodeRH(float v)
+    {
+    return encode16u(v * 65535.0f / 100.0f);
+    }
+
+std::uint16_t encodeLight(float v)
+    {
+    return LMIC_f2uflt16(v / 16777216.0f);
+    }
+
+std::uint16_t encodeActivity(float v)
+    {
+    return encode16u(LMIC_f2sflt16(v));
+    }
+
+class Buffer : public std::vector<std::uint8_t>
+    {
+public:
+    Buffer() : std::vector<std::uint8_t>() {};
+
+    void push_back_be(std::uint16_t v)
+        {
+        this->push_back(std::uint8_t(v >> 8));
+        this->push_back(std::uint8_t(v & 0xFF));
+        }
+
+    void push_back_be4(std::uint32_t v)
+        {
+        this->push_back(std::uint8_t(v >> 24));
+        this->push_back(std::uint8_t(v >> 16));
+        this->push_back(std::uint8_t(v >> 8));
+        this->push_back(std::uint8_t(v & 0xFF));
+        }
+    };
+
+// put the activity samples, preceded by their count.
+void encodeActivityField(Buffer &buf, const activity &a)
+    {
+    buf.push_back(std::uint8_t(a.nAvg));
+    for (unsigned i = 0; i < a.nAvg; ++i)
+        buf.push_back_be(encodeActivity(a.Avg[i]));
+    }
+
+// express the change from prev to target as an int8 count of steps;
+// prev becomes the value the decoder will reconstruct.
+bool encodeDelta(
+    std::int32_t &prev, std::int32_t target, std::int32_t step,
+    std::int32_t vMin, std::int32_t vMax, std::uint8_t &delta
+    )
+    {
+    std::int32_t const diff = target - prev;
+    std::int32_t d = (diff >= 0 ? diff + step / 2 : diff - step / 2) / step;
+
+    if (prev + d * step > vMax)
+        --d;
+    else if (prev + d * step < vMin)
+        ++d;
+
+    if (d < -127 || d > 127)
+        return false;
+
+    prev += d * step;
+    delta = std::uint8_t(std::int8_t(d));
+    return true;
+    }
+
+std::uint8_t windowFlags(const Window &w)
+    {
+    std::uint8_t flags = 0;
+
+    if (w.Env.fValid)
+        flags |= 1 << 4;
+    if (w.Light.fValid)
+        flags |= 1 << 5;
+    if (w.Pellets.fValid)
+        flags |= 1 << 6;
+    if (w.Activity.fValid)
+        flags |= 1 << 7;
+
+    return flags;
+    }
+
+bool encodeMeasurement(Buffer &buf, Measurements &m)
+    {
+    auto const &w0 = m.window[0];
+    std::uint8_t flags = windowFlags(w0);
+
+    // send the type byte
+    buf.clear();
+    buf.push_back(0x23);
+
+    // send the timestamp of the first window
+    buf.push_back_be4(w0.Time.fValid ? w0.Time.v : 0);
+
+    // send the flag byte
+    buf.push_back(0u); // flag byte.
+    auto const iFlags = buf.size() - 1;
+
+    // put the fields that are only sent once
+    if (m.Vbat.fValid)
+        {
+        flags |= 1 << 0;
+        buf.push_back_be(encodeV(m.Vbat.v));
+        }
+
+    if (m.Vsys.fValid)
+        {
+        flags |= 1 << 1;
+        buf.push_back_be(encodeV(m.Vsys.v));
+        }
+
+    if (m.Vbus.fValid)
+        {
+        flags |= 1 << 2;
+        buf.push_back_be(encodeV(m.Vbus.v));
+        }
+
+    if (m.Boot.fValid)
+        {
+        flags |= 1 << 3;
+        buf.push_back(m.Boot.v);
+        }
+
+    // put the first window
+    if (w0.Env.fValid)
+        {
+        buf.push_back_be(encodeT(w0.Env.v.t));
+        buf.push_back_be(encodeP(w0.Env.v.p));
+        buf.push_back_be(encodeRH(w0.Env.v.rh));
+        }
+
+    if (w0.Light.fValid)
+        buf.push_back_be(encodeLight(w0.Light.v.White));
+
+    if (w0.Pellets.fValid)
+        {
+        for (unsigned i = 0; i < pellets::knCounter; ++i)
+            {
+            buf.push_back_be(encode16u(w0.Pellets.v.counter[i].Total));
+            buf.push_back(w0.Pellets.v.counter[i].Delta);
+            }
+        }
+
+    if (w0.Activity.fValid)
+        encodeActivityField(buf, w0.Activity.v);
+
+    // update the flags
+    buf.data()[iFlags] = flags;
+
+    // the later windows are changes from the previous one, as decoded.
+    std::int32_t tCode = std::int16_t(encodeT(w0.Env.v.t));
+    std::int32_t pCode = encodeP(w0.Env.v.p);
+    std::int32_t rhCode = encodeRH(w0.Env.v.rh);
+
+    for (unsigned iWindow = 1; iWindow < m.nWindows; ++iWindow)
+        {
+        auto const &wPrev = m.window[iWindow - 1];
+        auto const &w = m.window[iWindow];
+
+        if (windowFlags(w) != windowFlags(w0))
+            {
+            std::cerr << "window " << iWindow << ": fields differ from the first window\n";
+            return false;
+            }
+
+        if (! (w.Time.fValid && wPrev.Time.fValid &&
+               w.Time.v > wPrev.Time.v && w.Time.v - wPrev.Time.v <= 0xFFFF))
+            {
+            std::cerr << "window " << iWindow << ": time must be 1 to 65535 seconds after the previous window\n";
+            return false;
+            }
+
+        buf.push_back_be(std::uint16_t(w.Time.v - wPrev.Time.v));
+
+        if (w.Env.fValid)
+            {
+            std::uint8_t dT, dP, dRH;
+
+            if (! encodeDelta(tCode, std::int16_t(encodeT(w.Env.v.t)), 16, -32768, 32767, dT) ||
+                ! encodeDelta(pCode, encodeP(w.Env.v.p), 1, 0, 65535, dP) ||
+                ! encodeDelta(rhCode, encodeRH(w.Env.v.rh), 256, 0, 65535, dRH))
+                {
+                std::cerr << "window " << iWindow << ": Env changed too much\n";
+                return false;
+                }
+
+            buf.push_back(dT);
+            buf.push_back(dP);
+            buf.push_back(dRH);
+            }
+
+        if (w.Light.fValid)
+            buf.push_back_be(encodeLight(w.Light.v.White));
+
+        if (w.Pellets.fValid)
+            {
+            for (unsigned i = 0; i < pellets::knCounter; ++i)
+                {
+                auto const &c = w.Pellets.v.counter[i];
+
+                if (std::uint16_t(wPrev.Pellets.v.counter[i].Total + c.Delta) != c.Total)
+                    {
+                    std::cerr << "window " << iWindow << ": Pellets total must be the previous total plus the delta\n";
+                    return false;
+                    }
+                buf.push_back(c.Delta);
+                }
+            }
+
+        if (w.Activity.fValid)
+            encodeActivityField(buf, w.Activity.v);
+        }
+
+    return true;
+    }
+
+void logMeasurement(Measurements &m)
+    {
+    class Padder {
+    public:
+        Padder() : m_first(true) {}
+        const char *get() {
+            if (this->m_first)
+                {
+                this->m_first = false;
+                return "";
+                }
+            else
+                return " ";
+            }
+        const char *nl() {
+            return this->m_first ? "" : "\n";
+            }
+    private:
+        bool m_first;
+    } pad;
+
+    // put the fields
+    if (m.Vbat.fValid)
+        {
+        std::cout << pad.get() << "Vbat " << m.Vbat.v;
+        }
+
+    if (m.Vsys.fValid)
+        {
+        std::cout << pad.get() << "Vsys " << m.Vsys.v;
+        }
+
+    if (m.Vbus.fValid)
+        {
+        std::cout << pad.get() << "Vbus " << m.Vbus.v;
+        }
+
+    if (m.Boot.fValid)
+        {
+        std::cout << pad.get() << "Boot " << unsigned(m.Boot.v);
+        }
+
+    for (unsigned iWindow = 0; iWindow < m.nWindows; ++iWindow)
+        {
+        auto const &w = m.window[iWindow];
+
+        if (iWindow != 0)
+            std::cout << pad.get() << "Next";
+
+        if (w.Time.fValid)
+            {
+            std::cout << pad.get() << "Time " << w.Time.v;
+            }
+
+        if (w.Env.fValid)
+            {
+            std::cout << pad.get() << "Env " << w.Env.v.t << " "
+                                             << w.Env.v.p << " "
+                                             << w.Env.v.rh;
+            }
+
+        if (w.Light.fValid)
+            {
+            std::cout << pad.get() << "Light " << w.Light.v.White;
+            }
+
+        if (w.Pellets.fValid)
+            {
+            std::cout << pad.get() << "Pellets";
+
+            for (unsigned i = 0; i < std::size(w.Pellets.v.counter); ++i)
+                {
+                std::cout << " " << w.Pellets.v.counter[i].Total
+                          << " " << (unsigned) w.Pellets.v.counter[i].Delta;
+                }
+            }
+
+        if (w.Activity.fValid)
+            {
+            std::cout << pad.get() << "Activity [";
+
+            for (unsigned i = 0; i < w.Activity.v.nAvg; ++i)
+                std::cout << " " << w.Activity.v.Avg[i];
+
+            std::cout << " ]";
+            }
+        }
+
+    // make the syntax cut/pastable.
+    std::cout << pad.get() << ".\n";
+    }
+
+void putTestVector(Measurements &m)
+    {
+    Buffer buf {};
+    logMeasurement(m);
+    if (! encodeMeasurement(buf, m))
+        {
+        std::cout << "(not encoded)\n";
+        return;
+        }
+    bool fFirst;
+
+    fFirst = true;
+    if (gOutputFormat == OutputFormat::Bytes)
+        {
+        for (auto v : buf)
+            {
+            if (! fFirst)
+                std::cout << ' ';
+            fFirst = false;
+            std::cout.width(2);
+            std::cout.fill('0');
+            std::cout << std::hex << unsigned(v);
+            }
+        std::cout << '\n';
+        std::cout << "length: " << std::dec << buf.end() - buf.begin() << '\n';
+        }
+    else if (gOutputFormat == OutputFormat::Yaml)
+        {
+        auto const sLeft = "  ";
+        std::cout << "  examples:" << '\n'
+                  << "    - description: XXX\n"
+                  << "      input:\n"
+                  << "        fPort: XXX\n"
+                  << "        bytes: [";
+
+        for (auto v : buf)
+            {
+            if (! fFirst)
+                std::cout << ", ";
+            fFirst = false;
+            std::cout << std::dec << unsigned(v);
+            }
+
+        std::cout << "]\n"
+                  << "      output:\n"
+                  << "        data:\n"
+                  << "          JSON-HERE\n"
+                  ;
+        }
+    }
+
+int main(int argc, char **argv)
+    {
+    Measurements m {};
+    Measurements m0 {};
+    bool fAny;
+    std::string key;
+
+    if (argc > 1)
+        {
+        std::string opt;
+        opt = argv[1];
+        if (opt == "--yaml")
+            {
+            std::cout << "(output in yaml format)\n";
+            gOutputFormat = OutputFormat::Yaml;
+            }
+        else
+            {
+            std::cout << "invalid option ignored: " << opt << '\n';
+            }
+        }
+
+    std::cout << "Input one or more lines of name/value tuples, with 'Next' between windows, ended by '.'\n";
+
+    m0.nWindows = 1;
+    m = m0;
+
+    fAny = false;
+    while (std::cin.good())
+        {
+        bool fUpdate = true;
+        key.clear();
+
+        std::cin >> key;
+
+        auto &w = m.window[m.nWindows - 1];
+
+        if (key == "Next")
+            {
+            if (m.nWindows == Measurements::knWindows)
+                {
+                std::cerr << "too many windows\n";
+                return 1;
+                }
+            ++m.nWindows;
+            }
+        else if (key == "Time")
+            {
+            std::cin >> w.Time.v;
+            w.Time.fValid = true;
+            }
+        else if (key == "Vbat")
+            {
+            std::cin >> m.Vbat.v;
+            m.Vbat.fValid = true;
+            }
+        else if (key == "Vsys")
+            {
+            std::cin >> m.Vsys.v;
+            m.Vsys.fValid = true;
+            }
+        else if (key == "Vbus")
+            {
+            std::cin >> m.Vbus.v;
+            m.Vbus.fValid = true;
+            }
+        else if (key == "Boot")
+            {
+            std::uint32_t nonce;
+            std::cin >> nonce;
+            m.Boot.v = (std::uint8_t) nonce;
+            m.Boot.fValid = true;
+            }
+        else if (key == "Env")
+            {
+            std::cin >> w.Env.v.t >> w.Env.v.p >> w.Env.v.rh;
+            w.Env.fValid = true;
+            }
+        else if (key == "Light")
+            {
+            std::cin >> w.Light.v.White;
+            w.Light.fValid = true;
+            }
+        else if (key == "Activity")
+            {
+            std::string token;
+            std::cin >> token;
+            if (token != "[")
+                {
+                std::cerr << "Activity parse error: expected '[': " << token << "\n";
+                return 1;
+                }
+
+            unsigned i = 0;
+            for (;i < std::size(w.Activity.v.Avg); ++i)
+                {
+                // read a word.
+                std::cin.clear();
+                std::cin >> w.Activity.v.Avg[i];
+
+                auto const state = std::cin.rdstate();
+
+                if (state & (std::cin.eofbit | std::cin.failbit | std::cin.badbit))
+                    {
+                    std::cin.clear(state & ~std::cin.failbit);
+                    break;
+                    }
+                }
+
+            w.Activity.fValid = true;
+            w.Activity.v.nAvg = i;
+
+            std::cin >> token;
+            if (token != "]")
+                {
+                std::cerr << "Activity parse error: expected ']': " << token << "\n";
+                return 1;
+                }
+
+            }
+        else if (key == "Pellets")
+            {
+            for (unsigned i = 0 ; i < w.Pellets.v.knCounter; ++i)
+                {
+                std::uint32_t nonce;
+
+                std::cin >> w.Pellets.v.counter[i].Total
+                         >> nonce;
+
+                if (nonce > 255)
+                    nonce = 255;
+                w.Pellets.v.counter[i].Delta = uint8_t(nonce);
+                }
+            w.Pellets.fValid = true;
+            }
+        else if (key == ".")
+            {
+            putTestVector(m);
+            m = m0;
+            fAny = false;
+            fUpdate = false;
+            }
+        else if (key == "")
+            /* ignore empty keys */
+            fUpdate = false;
+        else
+            {
+            std::cerr << "unknown key: " << key << "\n";
+            fUpdate = false;
+            }
+
+        fAny |= fUpdate;
+        }
+
+    if (!std::cin.eof() && std::cin.fail())
+        {
+        std::string nextword;
+
+        std::cin.clear(std::cin.goodbit);
+        std::cin >> nextword;
+        std::cerr << "parse error: " << nextword << "\n";
+        return 1;
+        }
+
+    if (fAny)
+        putTestVector(m);
+
+    return 0;
+    }
@@ -0,0 +1,361 @@
+/*
+
+Name:   catena4430-fwdelta.cpp
+
+Function:
+    Make, apply and check update.delta files for Catena4430_Sensor.
+
+Copyright and License:
+    See accompanying LICENSE file at https://github.com/mcci-catena/MCCI-Catena-4430/
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//--- types
+
+using Bytes = std::vector<std::uint8_t>;
+
+// the delta format; see cSdDeltaReader in
+// examples/Catena4430_Sensor/Catena4430_cMeasurementLoop_SDcard.cpp.
+constexpr std::uint32_t kMagic = 0x4C443443; // "C4DL"
+constexpr std::uint16_t kVersion = 1;
+constexpr std::size_t kHeaderSize = 32;
+constexpr std::uint8_t kOpEnd = 0;
+constexpr std::uint8_t kOpCopy = 1;
+constexpr std::uint8_t kOpInsert = 2;
+
+// shortest copy worth emitting: a copy op is 9 bytes, an insert op 5.
+constexpr std::size_t kMinCopy = 16;
+
+// block size used to index the old image.
+constexpr std::size_t kBlock = 8;
+
+//--- code
+
+// CRC-32, same as zlib and cCrc32 in the sketch.
+static std::uint32_t crc32(const Bytes &b, std::size_t n)
+    {
+    std::uint32_t crc = 0xFFFFFFFFu;
+
+    for (std::size_t i = 0; i < n; ++i)
+        {
+        crc ^= b[i];
+        for (int k = 0; k < 8; ++k)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    return ~crc;
+    }
+
+static void put16(Bytes &b, std::uint16_t v)
+    {
+    b.push_back(std::uint8_t(v));
+    b.push_back(std::uint8_t(v >> 8));
+    }
+
+static void put32(Bytes &b, std::uint32_t v)
+    {
+    put16(b, std::uint16_t(v));
+    put16(b, std::uint16_t(v >> 16));
+    }
+
+static std::uint32_t get32(const Bytes &b, std::size_t i)
+    {
+    return b[i] | (b[i + 1] << 8) | (b[i + 2] << 16) | (std::uint32_t(b[i + 3]) << 24);
+    }
+
+static std::uint64_t blockKey(const Bytes &b, std::size_t i)
+    {
+    std::uint64_t v = 0;
+    std::memcpy(&v, b.data() + i, kBlock);
+    return v;
+    }
+
+static bool readFile(const std::string &name, Bytes &b)
+    {
+    std::ifstream f(name, std::ios::binary);
+
+    if (! f)
+        {
+        std::cerr << "can't read " << name << "\n";
+        return false;
+        }
+
+    b.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    return true;
+    }
+
+static bool writeFile(const std::string &name, const Bytes &b)
+    {
+    std::ofstream f(name, std::ios::binary);
+
+    f.write((const char *)b.data(), b.size());
+    if (! f)
+        {
+        std::cerr << "can't write " << name << "\n";
+        return false;
+        }
+    return true;
+    }
+
+// make a delta. Greedy: at each position of the new image, take the
+// longest match in the old image, trying the continuation of the last
+// copy first (code that didn't move), then every old position with the
+// same leading block.
+static Bytes makeDelta(const Bytes &oldImage, const Bytes &newImage)
+    {
+    Bytes delta;
+    std::unordered_map<std::uint64_t, std::vector<std::uint32_t>> index;
+
+    for (std::size_t i = 0; i + kBlock <= oldImage.size(); i += 1)
+        {
+        auto &v = index[blockKey(oldImage, i)];
+        // don't let runs of 0xFF and the like make the search quadratic.
+        if (v.size() < 64)
+            v.push_back(std::uint32_t(i));
+        }
+
+    put32(delta, kMagic);
+    put16(delta, kVersion);
+    put16(delta, kHeaderSize);
+    put32(delta, std::uint32_t(oldImage.size()));
+    put32(delta, crc32(oldImage, oldImage.size()));
+    put32(delta, std::uint32_t(newImage.size()));
+    put32(delta, crc32(newImage, newImage.size()));
+    put32(delta, 0);
+    put32(delta, 0);
+
+    Bytes literal;
+    auto flushLiteral = [&]()
+        {
+        if (literal.empty())
+            return;
+        delta.push_back(kOpInsert);
+        put32(delta, std::uint32_t(literal.size()));
+        delta.insert(delta.end(), literal.begin(), literal.end());
+        literal.clear();
+        };
+
+    auto matchLength = [&](std::size_t iOld, std::size_t iNew)
+        {
+        std::size_t n = 0;
+        while (iOld + n < oldImage.size() && iNew + n < newImage.size() &&
+               oldImage[iOld + n] == newImage[iNew + n])
+            ++n;
+        return n;
+        };
+
+    std::size_t nextOld = 0;
+    std::size_t pos = 0;
+
+    while (pos < newImage.size())
+        {
+        std::size_t bestLength = matchLength(nextOld, pos);
+        std::size_t bestOffset = nextOld;
+
+        if (bestLength < kMinCopy && pos + kBlock <= newImage.size())
+            {
+            auto it = index.find(blockKey(newImage, pos));
+            if (it != index.end())
+                {
+                for (auto iOld : it->second)
+                    {
+                    auto n = matchLength(iOld, pos);
+                    if (n > bestLength)
+                        {
+                        bestLength = n;
+                        bestOffset = iOld;
+                        }
+                    }
+                }
+            }
+
+        if (bestLength >= kMinCopy)
+            {
+            flushLiteral();
+            delta.push_back(kOpCopy);
+            put32(delta, std::uint32_t(bestOffset));
+            put32(delta, std::uint32_t(bestLength));
+            pos += bestLength;
+            nextOld = bestOffset + bestLength;
+            }
+        else
+            {
+            literal.push_back(newImage[pos]);
+            ++pos;
+            ++nextOld;
+            }
+        }
+
+    flushLiteral();
+    delta.push_back(kOpEnd);
+    return delta;
+    }
+
+// apply a delta, checking everything the device checks.
+static bool applyDelta(const Bytes &oldImage, const Bytes &delta, Bytes &newImage)
+    {
+    if (delta.size() < kHeaderSize ||
+        get32(delta, 0) != kMagic ||
+        (delta[4] | (delta[5] << 8)) != kVersion ||
+        (delta[6] | (delta[7] << 8)) != kHeaderSize)
+        {
+        std::cerr << "not a delta file\n";
+        return false;
+        }
+
+    std::uint32_t const oldLength = get32(delta, 8);
+    std::uint32_t const oldCrc = get32(delta, 12);
+    std::uint32_t const newLength = get32(delta, 16);
+    std::uint32_t const newCrc = get32(delta, 20);
+
+    if (oldLength > oldImage.size() || crc32(oldImage, oldLength) != oldCrc)
+        {
+        std::cerr << "delta is not for this old image\n";
+        return false;
+        }
+
+    newImage.clear();
+    std::size_t i = kHeaderSize;
+
+    while (true)
+        {
+        if (i >= delta.size())
+            {
+            std::cerr << "delta truncated\n";
+            return false;
+            }
+
+        auto const op = delta[i++];
+
+        if (op == kOpEnd)
+            break;
+        else if (op == kOpCopy && delta.size() - i >= 8)
+            {
+            std::uint32_t const offset = get32(delta, i);
+            std::uint32_t const length = get32(delta, i + 4);
+            i += 8;
+            if (offset > oldLength || length > oldLength - offset)
+                {
+                std::cerr << "copy out of range at " << (i - 9) << "\n";
+                return false;
+                }
+            newImage.insert(newImage.end(), oldImage.begin() + offset, oldImage.begin() + offset + length);
+            }
+        else if (op == kOpInsert && delta.size() - i >= 4)
+            {
+            std::uint32_t const length = get32(delta, i);
+            i += 4;
+            if (delta.size() - i < length)
+                {
+                std::cerr << "insert truncated at " << (i - 5) << "\n";
+                return false;
+                }
+            newImage.insert(newImage.end(), delta.begin() + i, delta.begin() + i + length);
+            i += length;
+            }
+        else
+            {
+            std::cerr << "bad op at " << (i - 1) << "\n";
+            return false;
+            }
+
+        if (newImage.size() > newLength)
+            {
+            std::cerr << "delta produces too much data\n";
+            return false;
+            }
+        }
+
+    if (newImage.size() != newLength || crc32(newImage, newImage.size()) != newCrc)
+        {
+        std::cerr << "result doesn't match the CRC in the header\n";
+        return false;
+        }
+
+    return true;
+    }
+
+static int usage(const char *pName)
+    {
+    std::cerr << "usage:\n"
+              << "    " << pName << " make {old.bin} {new.bin} {update.delta}\n"
+              << "        Make a delta that turns old.bin (the image running on the\n"
+              << "        Catena) into new.bin.\n"
+              << "    " << pName << " apply {old.bin} {update.delta} {new.bin}\n"
+              << "        Apply a delta, as the Catena would.\n"
+              << "    " << pName << " verify {old.bin} {new.bin} {update.delta}\n"
+              << "        Check that the delta turns old.bin into new.bin.\n";
+    return 1;
+    }
+
+int main(int argc, char **argv)
+    {
+    if (argc != 5)
+        return usage(argv[0]);
+
+    std::string const cmd = argv[1];
+    Bytes oldImage, newImage, delta, result;
+
+    if (cmd == "make")
+        {
+        if (! readFile(argv[2], oldImage) || ! readFile(argv[3], newImage))
+            return 1;
+
+        delta = makeDelta(oldImage, newImage);
+
+        // never ship a delta we can't apply.
+        if (! applyDelta(oldImage, delta, result) || result != newImage)
+            {
+            std::cerr << "internal error: delta doesn't reproduce the new image\n";
+            return 1;
+            }
+
+        if (! writeFile(argv[4], delta))
+            return 1;
+
+        std::cerr << argv[4] << ": " << delta.size() << " bytes, for a "
+                  << newImage.size() << "-byte image\n";
+        return 0;
+        }
+    else if (cmd == "apply")
+        {
+        if (! readFile(argv[2], oldImage) || ! readFile(argv[3], delta))
+            return 1;
+
+        if (! applyDelta(oldImage, delta, result) || ! writeFile(argv[4], result))
+            return 1;
+
+        return 0;
+        }
+    else if (cmd == "verify")
+        {
+        if (! readFile(argv[2], oldImage) || ! readFile(argv[3], newImage) || ! readFile(argv[4], delta))
+            return 1;
+
+        if (! applyDelta(oldImage, delta, result))
+            return 1;
+
+        if (result != newImage)
+            {
+            std::cerr << "delta doesn't produce " << argv[3] << "\n";
+            return 1;
+            }
+
+        std::cerr << "ok\n";
+        return 0;
+        }
+
+    return usage(argv[0]);
+    }
@@ -0,0 +1,271 @@
+/*
+
+Name:   catena4430-regcache-test.cpp
+
+Function:
+    Host test for cRegisterCache and cBitFields, counting the transfers
+    on a fake TwoWire.
+
+Copyright and License:
+    See accompanying LICENSE file at https://github.com/mcci-catena/MCCI-Catena-4430/
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+Description:
+    Build and run from the top of the repository:
+
+        g++ -std=c++14 -I extra/host -I src -o catena4430-regcache-test \
+            extra/catena4430-regcache-test.cpp src/lib/Catena4430_cI2cBus.cpp \
+            src/lib/Catena4430_cPCA9570.cpp
+        ./catena4430-regcache-test
+
+    extra/host has just enough of the Arduino and Catena headers to
+    build the library's register cache on a PC; its Wire.h is a fake
+    TwoWire with one device, which counts the transfers. Each check
+    prints "ok" or "FAIL"; the exit status is the number of failures.
+
+*/
+
+#include <Catena4430_cRegisterCache.h>
+#include <Catena4430_cI2cBus.h>
+#include <Catena4430_cPCA9570.h>
+
+#include <cstdint>
+#include <cstdio>
+
+using namespace McciCatena4430;
+
+//--- the device: a few registers, modeled on the PCF8523.
+enum class Reg : std::uint8_t
+    {
+    kControl1 = 0,
+    kControl2 = 1,
+    kControl3 = 2,
+    kSeconds = 3,
+    kMinutes = 4,
+    kHours = 5,
+    };
+
+constexpr std::uint8_t kI2cAddr = 0x68;
+
+// fields in kControl1.
+constexpr std::uint8_t kControl1_CAP = 1u << 7;
+constexpr std::uint8_t kControl1_STOP = 1u << 5;
+constexpr std::uint8_t kControl1_SIE = 1u << 2;
+constexpr std::uint8_t kControl1_AIE = 1u << 1;
+constexpr std::uint8_t kControl1_CIE = 1u << 0;
+constexpr std::uint8_t kControl1_IE = kControl1_SIE | kControl1_AIE | kControl1_CIE;
+
+// kSeconds counts by itself.
+constexpr std::uint32_t kVolatileMask = 1u << unsigned(Reg::kSeconds);
+
+using Cache = cRegisterCache<Reg, Reg::kControl1, Reg::kHours>;
+
+//--- globals
+TwoWire gWire { kI2cAddr };
+unsigned gnFailures;
+
+//--- code
+
+static void check(bool fOk, const char *pName)
+    {
+    std::printf("%s: %s\n", fOk ? "ok" : "FAIL", pName);
+    if (! fOk)
+        ++gnFailures;
+    }
+
+static void setDevice(const std::uint8_t (&regs)[6])
+    {
+    for (unsigned i = 0; i < 6; ++i)
+        gWire.regs[i] = regs[i];
+    }
+
+// reads from the cache cost nothing once it's loaded.
+static void testCachedReads()
+    {
+    static const std::uint8_t regs[6] = { 0x80, 0x01, 0xE0, 0x45, 0x30, 0x12 };
+    Cache cache { &gWire, kI2cAddr, kVolatileMask };
+
+    setDevice(regs);
+
+    unsigned const nStart = gWire.getTransfers();
+    check(cache.read(), "read() succeeds");
+    check(gWire.getTransfers() - nStart == 2, "read() is one write of the pointer and one read");
+
+    unsigned const nLoaded = gWire.getTransfers();
+    bool fMatch = true;
+    for (unsigned pass = 0; pass < 10; ++pass)
+        {
+        fMatch = fMatch && cache.get(Reg::kControl1) == 0x80;
+        fMatch = fMatch && cache.get(Reg::kHours) == 0x12;
+        fMatch = fMatch && cBitFields::getField(cache.get(Reg::kControl1), kControl1_CAP) == 1;
+        }
+
+    check(fMatch, "cached values match the device");
+    check(gWire.getTransfers() == nLoaded, "cached reads cost no transfers");
+    check(cache.isValid(Reg::kControl1) && ! cache.isValid(Reg::kSeconds), "volatile registers aren't valid");
+    }
+
+// flushing a clean cache does nothing.
+static void testCleanFlush()
+    {
+    static const std::uint8_t regs[6] = { 0x00, 0x00, 0xE0, 0x00, 0x00, 0x00 };
+    Cache cache { &gWire, kI2cAddr, kVolatileMask };
+    cI2cBus bus { &gWire };
+
+    setDevice(regs);
+    (void) cache.read();
+
+    unsigned const nStart = gWire.getTransfers();
+    check(cache.flush() && gWire.getTransfers() == nStart, "flush() after read() does nothing");
+
+    // put() of the value that's there doesn't make it dirty.
+    cache.put(Reg::kControl3, std::uint8_t(0xE0));
+    cache.modify(Reg::kControl1, kControl1_STOP, 0);
+    check(! cache.isDirty(), "put() of an unchanged value stays clean");
+    check(cache.getStats().nPutsUnchanged == 2, "both puts are counted as unchanged");
+    check(cache.flush() && gWire.getTransfers() == nStart, "flush() of unchanged puts does nothing");
+
+    // the asynchronous flush completes at once, without queueing.
+    cache.getDevice().setBus(&bus);
+    bool result[2] = { false, false };
+    check(
+        cache.startFlush(
+            [](void *pUserData, bool fOk)
+                {
+                auto const pResult = static_cast<bool *>(pUserData);
+                pResult[0] = true;
+                pResult[1] = fOk;
+                },
+            result
+            ),
+        "startFlush() of a clean cache succeeds"
+        );
+    check(result[0] && result[1] && ! bus.isBusy(), "startFlush() of a clean cache completes at once");
+    check(gWire.getTransfers() == nStart, "startFlush() of a clean cache does nothing");
+    }
+
+// changing fields in a register is one read and one write.
+static void testReadModifyWrite()
+    {
+    static const std::uint8_t regs[6] = { 0x80, 0x01, 0xE0, 0x45, 0x30, 0x12 };
+    Cache cache { &gWire, kI2cAddr, kVolatileMask };
+
+    setDevice(regs);
+
+    unsigned const nWritesStart = gWire.nWrites;
+    unsigned const nReadsStart = gWire.nReads;
+
+    // read just the register we're changing, then set two fields.
+    (void) cache.read(Reg::kControl1, Reg::kControl1);
+    cache.modify(Reg::kControl1, kControl1_STOP, kControl1_STOP);
+    cache.put(
+        Reg::kControl1,
+        cBitFields::setField(cache.get(Reg::kControl1), kControl1_IE, std::uint8_t(kControl1_AIE))
+        );
+    check(cache.isDirty(), "changing fields makes the register dirty");
+    check(cache.flush(), "flush() succeeds");
+
+    std::uint8_t const expect = 0x80 | kControl1_STOP | kControl1_AIE;
+    check(gWire.regs[0] == expect, "device register has both fields");
+    check(gWire.regs[1] == 0x01 && gWire.regs[2] == 0xE0, "neighbouring registers aren't touched");
+    check(gWire.nReads - nReadsStart == 1, "one read transfer");
+    check(gWire.nWrites - nWritesStart == 2, "one pointer write and one data write");
+    check(
+        cache.getStats().nReadTransactions == 1 && cache.getStats().nWriteTransactions == 1,
+        "cache counts one read and one write transaction"
+        );
+
+    // once valid, the next update is just the write.
+    unsigned const nStart = gWire.getTransfers();
+    cache.modify(Reg::kControl1, kControl1_STOP, 0);
+    (void) cache.flush();
+    check(gWire.getTransfers() - nStart == 1 && gWire.regs[0] == (expect & ~kControl1_STOP),
+          "update of a valid register is one write");
+
+    // contiguous dirty registers go in one write.
+    cache.put(Reg::kMinutes, std::uint8_t(0x31));
+    cache.put(Reg::kHours, std::uint8_t(0x13));
+    unsigned const nRun = gWire.getTransfers();
+    (void) cache.flush();
+    check(gWire.getTransfers() - nRun == 1 && gWire.regs[4] == 0x31 && gWire.regs[5] == 0x13,
+          "contiguous dirty registers are one write");
+    }
+
+// the same update, queued on a bus.
+static void testAsyncReadModifyWrite()
+    {
+    static const std::uint8_t regs[6] = { 0x00, 0x00, 0xE0, 0x00, 0x00, 0x00 };
+    Cache cache { &gWire, kI2cAddr, kVolatileMask };
+    cI2cBus bus { &gWire };
+    bool fDone = false;
+
+    setDevice(regs);
+    cache.getDevice().setBus(&bus);
+
+    unsigned const nStart = gWire.getTransfers();
+    check(cache.startRead(Reg::kControl1, Reg::kControl1, nullptr, nullptr), "startRead() queues");
+    check(gWire.getTransfers() == nStart && cache.isBusy(), "nothing is sent until the bus is polled");
+    bus.poll();
+    check(! cache.isBusy() && cache.isValid(Reg::kControl1), "poll() completes the read");
+
+    cache.modify(Reg::kControl1, kControl1_CAP | kControl1_SIE, kControl1_CAP | kControl1_SIE);
+    check(
+        cache.startFlush(
+            [](void *pUserData, bool fOk)
+                {
+                *static_cast<bool *>(pUserData) = fOk;
+                },
+            &fDone
+            ),
+        "startFlush() queues"
+        );
+    bus.poll();
+    check(fDone && ! cache.isDirty(), "poll() completes the flush");
+    check(gWire.regs[0] == (kControl1_CAP | kControl1_SIE), "device register has both fields");
+    check(gWire.getTransfers() - nStart == 3, "async read-modify-write is one read and one write");
+    }
+
+// an output set while a PCA9570 write is queued is written after it.
+static void testPca9570QueuedFlush()
+    {
+    TwoWire wire { cPCA9570::kI2cAddress };
+    cI2cBus bus { &wire };
+    cPCA9570 pca { &wire };
+
+    wire.fRegisterPointer = false;
+    (void) pca.begin();
+    pca.setBus(&bus);
+    (void) pca.setWriteBack(true);
+
+    unsigned const nStart = wire.getTransfers();
+    pca.set(0x1);
+    check(pca.startFlush() && bus.isBusy(), "startFlush() queues the write");
+
+    // the LED mirror may set a new value before the bus gets to it.
+    pca.set(0x3);
+    check(pca.startFlush(), "startFlush() while busy succeeds");
+
+    bus.poll();
+    check(bus.isBusy(), "the first write's completion queues the change");
+    bus.poll();
+    check(! bus.isBusy() && wire.regs[0] == 0x3, "device has the last value");
+    check(wire.getTransfers() - nStart == 2 && pca.getStats().nWrites == 3,
+          "two writes (after the one in begin())");
+
+    bus.poll();
+    check(wire.getTransfers() - nStart == 2, "nothing more once clean");
+    }
+
+int main()
+    {
+    testCachedReads();
+    testCleanFlush();
+    testReadModifyWrite();
+    testAsyncReadModifyWrite();
+    testPca9570QueuedFlush();
+
+    std::printf("%u failure%s\n", gnFailures, gnFailures == 1 ? "" : "s");
+    return int(gnFailures);
+    }
@@ -0,0 +1,423 @@
+/*
+
+Name:   catena4430-sdcat.cpp
+
+Function:
+    Concatenate the data files from a Catena4430_Sensor SD card.
+
+Copyright and License:
+    See accompanying LICENSE file at https://github.com/mcci-catena/MCCI-Catena-4430/
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+//--- types
+
+// a data file, and the day it represents (as YYYYMMDD).
+struct DataFile
+    {
+    std::uint32_t day;
+    fs::path path;
+    bool fFlat;
+    };
+
+//--- globals
+bool gfMigrate = false;
+
+//--- code
+
+// case-insensitive string compare, because FAT doesn't care.
+static bool equalNoCase(const std::string &a, const std::string &b)
+    {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(),
+                [](char x, char y) { return std::tolower((unsigned char)x) == std::tolower((unsigned char)y); }
+                );
+    }
+
+// parse a string of exactly n decimal digits.
+static bool parseDigits(const std::string &s, std::size_t n, std::uint32_t &v)
+    {
+    if (s.size() != n)
+        return false;
+
+    v = 0;
+    for (auto c : s)
+        {
+        if (! std::isdigit((unsigned char)c))
+            return false;
+        v = v * 10 + (c - '0');
+        }
+    return true;
+    }
+
+// match "{digits}.dat", returning the value of the digits.
+static bool parseDataName(const fs::path &p, std::size_t nDigits, std::uint32_t &v)
+    {
+    return equalNoCase(p.extension().string(), ".dat") &&
+           parseDigits(p.stem().string(), nDigits, v);
+    }
+
+// match "{digits}.dlz" (a compressed data file).
+static bool parseCompressedDataName(const fs::path &p, std::size_t nDigits, std::uint32_t &v)
+    {
+    return equalNoCase(p.extension().string(), ".dlz") &&
+           parseDigits(p.stem().string(), nDigits, v);
+    }
+
+// find the Data directory at the root of the card.
+static bool findDataDir(const fs::path &root, fs::path &dataDir)
+    {
+    for (auto const &e : fs::directory_iterator(root))
+        {
+        if (e.is_directory() && equalNoCase(e.path().filename().string(), "Data"))
+            {
+            dataDir = e.path();
+            return true;
+            }
+        }
+    return false;
+    }
+
+// collect the data files, in both the flat layout (Data/YYYYMMDD.DAT)
+// and the per-month layout (Data/YYYY/MM/DD.DAT).
+static void collectDataFiles(const fs::path &dataDir, std::vector<DataFile> &files)
+    {
+    for (auto const &eYear : fs::directory_iterator(dataDir))
+        {
+        std::uint32_t v;
+
+        if (eYear.is_regular_file())
+            {
+            if (parseDataName(eYear.path(), 8, v))
+                files.push_back(DataFile { v, eYear.path(), true });
+            continue;
+            }
+
+        std::uint32_t year;
+        if (! eYear.is_directory() || ! parseDigits(eYear.path().filename().string(), 4, year))
+            continue;
+
+        for (auto const &eMonth : fs::directory_iterator(eYear.path()))
+            {
+            std::uint32_t month;
+            if (! eMonth.is_directory() || ! parseDigits(eMonth.path().filename().string(), 2, month))
+                continue;
+
+            for (auto const &eDay : fs::directory_iterator(eMonth.path()))
+                {
+                if (eDay.is_regular_file() &&
+                    (parseDataName(eDay.path(), 2, v) || parseCompressedDataName(eDay.path(), 2, v)))
+                    files.push_back(DataFile { year * 10000 + month * 100 + v, eDay.path(), false });
+                }
+            }
+        }
+
+    std::sort(files.begin(), files.end(),
+        [](const DataFile &a, const DataFile &b) { return a.day < b.day; }
+        );
+    }
+
+// decode one frame of a compressed data file (see
+// Catena4430_cRecordCompressor.h in the sketch for the format), starting
+// at in[i]. prev is the previous frame's output, used if the frame says so.
+// On success, sets out to the record and i to the start of the next frame.
+static bool decodeFrame(
+    const std::vector<std::uint8_t> &in,
+    std::size_t &i,
+    const std::vector<std::uint8_t> &prev,
+    bool fAllowDict,
+    std::vector<std::uint8_t> &out
+    )
+    {
+    if (in.size() - i < 5 || in[i] != 0xA5)
+        return false;
+
+    unsigned const rawField = in[i + 1] | (in[i + 2] << 8);
+    std::size_t const nRaw = rawField & 0x7FFF;
+    bool const fDict = (rawField & 0x8000) != 0;
+    std::size_t const nPayload = in[i + 3] | (in[i + 4] << 8);
+    std::size_t j = i + 5;
+
+    if (in.size() - j < nPayload || (fDict && ! fAllowDict))
+        return false;
+
+    // window is the dictionary (if used), followed by the output.
+    std::vector<std::uint8_t> window;
+    if (fDict)
+        window = prev;
+    std::size_t const nDict = window.size();
+
+    std::size_t const iEnd = j + nPayload;
+    unsigned control = 0;
+    unsigned nTokens = 8;
+
+    while (window.size() - nDict < nRaw)
+        {
+        if (nTokens == 8)
+            {
+            if (j >= iEnd)
+                return false;
+            control = in[j++];
+            nTokens = 0;
+            }
+
+        if (control & (1u << nTokens))
+            {
+            if (j >= iEnd)
+                return false;
+            window.push_back(in[j++]);
+            }
+        else
+            {
+            if (iEnd - j < 2)
+                return false;
+            std::size_t const offset = (in[j] | ((in[j + 1] & 1) << 8)) + 1;
+            std::size_t const len = (in[j + 1] >> 1) + 3;
+            j += 2;
+
+            if (offset > window.size())
+                return false;
+            for (std::size_t k = 0; k < len; ++k)
+                window.push_back(window[window.size() - offset]);
+            }
+        ++nTokens;
+        }
+
+    if (window.size() - nDict != nRaw || j != iEnd)
+        return false;
+
+    out.assign(window.begin() + nDict, window.end());
+    i = iEnd;
+    return true;
+    }
+
+// decode a compressed data file. If a frame is damaged (because a write
+// was interrupted), skip to the next frame that doesn't need a dictionary
+// and decodes to a complete line.
+static bool decodeCompressedFile(const std::vector<std::uint8_t> &in, std::string &out, const fs::path &p)
+    {
+    std::vector<std::uint8_t> prev;
+    std::vector<std::uint8_t> record;
+    std::size_t i = 0;
+
+    while (i < in.size())
+        {
+        if (decodeFrame(in, i, prev, true, record))
+            {
+            prev = record;
+            out.append(record.begin(), record.end());
+            continue;
+            }
+
+        std::size_t const iBad = i;
+        for (++i; i < in.size(); ++i)
+            {
+            std::size_t iNext = i;
+            if (decodeFrame(in, iNext, prev, false, record) &&
+                ! record.empty() && record.back() == '\n')
+                break;
+            }
+
+        std::cerr << p << ": skipped " << (i - iBad) << " damaged bytes at offset " << iBad << "\n";
+        }
+
+    return true;
+    }
+
+// read a file; the first line is the header, the rest are records.
+static bool readDataFile(const fs::path &p, std::string &header, std::vector<std::string> &records)
+    {
+    std::ifstream f(p, std::ios::binary);
+    std::string text;
+    std::string line;
+
+    if (! f)
+        return false;
+
+    if (equalNoCase(p.extension().string(), ".dlz"))
+        {
+        std::vector<std::uint8_t> raw(
+            (std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>()
+            );
+        if (! decodeCompressedFile(raw, text, p))
+            return false;
+        }
+    else
+        {
+        text.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        }
+
+    std::istringstream s(text);
+    bool fFirst = true;
+    while (std::getline(s, line))
+        {
+        if (! line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty())
+            continue;
+
+        if (fFirst)
+            header = line;
+        else
+            records.push_back(line);
+
+        fFirst = false;
+        }
+    return true;
+    }
+
+// move a flat file into the per-month layout, the same way the
+// "sdmigrate" command does it on the device.
+static bool migrateFile(const fs::path &dataDir, const DataFile &df)
+    {
+    char sYear[8], sMonth[4], sDay[8];
+
+    std::snprintf(sYear, sizeof(sYear), "%04u", unsigned(df.day / 10000));
+    std::snprintf(sMonth, sizeof(sMonth), "%02u", unsigned(df.day / 100 % 100));
+    std::snprintf(sDay, sizeof(sDay), "%02u.DAT", unsigned(df.day % 100));
+
+    fs::path newDir = dataDir / sYear / sMonth;
+    fs::path newPath = newDir / sDay;
+    std::error_code ec;
+
+    fs::create_directories(newDir, ec);
+    if (ec)
+        return false;
+
+    if (! fs::exists(newPath))
+        {
+        fs::rename(df.path, newPath, ec);
+        return ! ec;
+        }
+
+    // append the old records to the existing file, without the header.
+    std::string header;
+    std::vector<std::string> records;
+
+    if (! readDataFile(df.path, header, records))
+        return false;
+
+    std::ofstream f(newPath, std::ios::binary | std::ios::app);
+    for (auto const &r : records)
+        f << r << "\r\n";
+
+    if (! f)
+        return false;
+
+    f.close();
+    return fs::remove(df.path, ec);
+    }
+
+static int usage(const char *pName)
+    {
+    std::cerr << "usage: " << pName << " [--migrate] {card-root}\n"
+              << "    Write all records from the card's data files (.DAT, or compressed .DLZ)\n"
+              << "    to stdout, as one CSV file.\n"
+              << "    --migrate moves files in the old flat layout to Data/YYYY/MM/DD.DAT first.\n";
+    return 1;
+    }
+
+int main(int argc, char **argv)
+    {
+    fs::path root;
+
+    for (int i = 1; i < argc; ++i)
+        {
+        std::string opt = argv[i];
+
+        if (opt == "--migrate")
+            gfMigrate = true;
+        else if (opt.size() > 1 && opt[0] == '-')
+            return usage(argv[0]);
+        else if (root.empty())
+            root = opt;
+        else
+            return usage(argv[0]);
+        }
+
+    if (root.empty())
+        return usage(argv[0]);
+
+    fs::path dataDir;
+    if (! findDataDir(root, dataDir))
+        {
+        std::cerr << "no Data directory found in " << root << "\n";
+        return 1;
+        }
+
+    std::vector<DataFile> files;
+    collectDataFiles(dataDir, files);
+
+    if (gfMigrate)
+        {
+        unsigned nMoved = 0, nFailed = 0;
+
+        for (auto const &df : files)
+            {
+            if (! df.fFlat)
+                continue;
+
+            if (migrateFile(dataDir, df))
+                ++nMoved;
+            else
+                {
+                std::cerr << "couldn't move " << df.path << "\n";
+                ++nFailed;
+                }
+            }
+
+        std::cerr << nMoved << " files moved, " << nFailed << " failed\n";
+
+        files.clear();
+        collectDataFiles(dataDir, files);
+        }
+
+    // the same day might appear in both layouts, so group records by day
+    // and sort each day by the timestamp (ISO format sorts as text).
+    std::map<std::uint32_t, std::vector<std::string>> days;
+    std::string header;
+
+    for (auto const &df : files)
+        {
+        std::string thisHeader;
+
+        if (! readDataFile(df.path, thisHeader, days[df.day]))
+            {
+            std::cerr << "can't read " << df.path << "\n";
+            return 1;
+            }
+
+        if (header.empty())
+            header = thisHeader;
+        }
+
+    if (! header.empty())
+        std::cout << header << '\n';
+
+    for (auto &day : days)
+        {
+        std::stable_sort(day.second.begin(), day.second.end());
+        for (auto const &r : day.second)
+            std::cout << r << '\n';
+        }
+
+    return 0;
+    }
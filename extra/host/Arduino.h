@@ -0,0 +1,26 @@
+/*
+
+Module: Arduino.h
+
+Function:
+    Host build: just enough of Arduino.h for the library tests in extra.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Arduino_h_
+# define _Arduino_h_
+
+#pragma once
+
+#include <cstdint>
+
+inline std::uint32_t micros() { return 0; }
+inline std::uint32_t millis() { return 0; }
+
+#endif // !defined(_Arduino_h_)
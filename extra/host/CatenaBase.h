@@ -0,0 +1,34 @@
+/*
+
+Module: CatenaBase.h
+
+Function:
+    Host build: CatenaBase, for the library tests in extra.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _CatenaBase_h_
+# define _CatenaBase_h_
+
+#pragma once
+
+#include "CatenaBase_types.h"
+#include "Catena_PollableInterface.h"
+
+namespace McciCatena {
+
+class CatenaBase
+    {
+public:
+    void registerObject(cPollableObject *) {}
+    };
+
+} // namespace McciCatena
+
+#endif // !defined(_CatenaBase_h_)
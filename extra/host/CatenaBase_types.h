@@ -0,0 +1,27 @@
+/*
+
+Module: CatenaBase_types.h
+
+Function:
+    Host build: forward declarations for the library tests in extra.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _CatenaBase_types_h_
+# define _CatenaBase_types_h_
+
+#pragma once
+
+namespace McciCatena {
+
+class CatenaBase;
+
+} // namespace McciCatena
+
+#endif // !defined(_CatenaBase_types_h_)
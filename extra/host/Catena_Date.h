@@ -0,0 +1,36 @@
+/*
+
+Module: Catena_Date.h
+
+Function:
+    Host build: cNumericLimits, for the library tests in extra.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena_Date_h_
+# define _Catena_Date_h_
+
+#pragma once
+
+#include <limits>
+
+namespace McciCatena {
+
+template <typename T>
+struct cNumericLimits
+    {
+    static constexpr T numeric_limits_max()
+        {
+        return std::numeric_limits<T>::max();
+        }
+    };
+
+} // namespace McciCatena
+
+#endif // !defined(_Catena_Date_h_)
@@ -0,0 +1,32 @@
+/*
+
+Module: Catena_PollableInterface.h
+
+Function:
+    Host build: cPollableObject, for the library tests in extra.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena_PollableInterface_h_
+# define _Catena_PollableInterface_h_
+
+#pragma once
+
+namespace McciCatena {
+
+class cPollableObject
+    {
+public:
+    virtual ~cPollableObject() {}
+    virtual void poll() = 0;
+    };
+
+} // namespace McciCatena
+
+#endif // !defined(_Catena_PollableInterface_h_)
@@ -0,0 +1,130 @@
+/*
+
+Module: Wire.h
+
+Function:
+    Host build: a fake TwoWire, with one device that has a register
+    pointer, for the library tests in extra.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+Description:
+    Each endTransmission() and requestFrom() is one transfer on the bus,
+    and is counted. The first byte written selects a register, and the
+    rest are written from there; reads start at the selected register.
+    The pointer increments after each byte, as on the PCF8523. If
+    fRegisterPointer is false, the device has just regs[0], as on the
+    PCA9570.
+
+*/
+
+#ifndef _Wire_h_
+# define _Wire_h_
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class TwoWire
+    {
+public:
+    static constexpr unsigned kNumRegs = 32;
+
+    explicit TwoWire(std::uint8_t i2caddr)
+        : m_i2caddr(i2caddr)
+        {}
+
+    void begin() {}
+    void setClock(std::uint32_t) {}
+
+    void beginTransmission(std::uint8_t i2caddr)
+        {
+        this->m_txAddr = i2caddr;
+        this->m_nTx = 0;
+        }
+
+    std::size_t write(std::uint8_t b)
+        {
+        if (this->m_nTx < sizeof(this->m_tx))
+            this->m_tx[this->m_nTx++] = b;
+        return 1;
+        }
+
+    std::size_t write(const std::uint8_t *p, std::size_t n)
+        {
+        for (std::size_t i = 0; i < n; ++i)
+            this->write(p[i]);
+        return n;
+        }
+
+    std::uint8_t endTransmission(bool = true)
+        {
+        ++this->nWrites;
+        if (this->m_txAddr != this->m_i2caddr)
+            return 2;
+
+        for (unsigned i = 0; i < this->m_nTx; ++i)
+            {
+            if (! this->fRegisterPointer)
+                this->regs[0] = this->m_tx[i];
+            else if (i == 0)
+                this->m_ptr = this->m_tx[0] % kNumRegs;
+            else
+                {
+                this->regs[this->m_ptr] = this->m_tx[i];
+                this->m_ptr = (this->m_ptr + 1) % kNumRegs;
+                }
+            }
+        return 0;
+        }
+
+    std::uint8_t requestFrom(std::uint8_t i2caddr, std::uint8_t n)
+        {
+        ++this->nReads;
+        if (i2caddr != this->m_i2caddr)
+            return 0;
+
+        this->m_nRx = n;
+        return n;
+        }
+
+    int read()
+        {
+        if (this->m_nRx == 0)
+            return -1;
+
+        --this->m_nRx;
+        if (! this->fRegisterPointer)
+            return this->regs[0];
+
+        std::uint8_t const b = this->regs[this->m_ptr];
+        this->m_ptr = (this->m_ptr + 1) % kNumRegs;
+        return b;
+        }
+
+    unsigned getTransfers() const
+        {
+        return this->nWrites + this->nReads;
+        }
+
+    // the device's registers, and the transfer counts.
+    std::uint8_t regs[kNumRegs] {};
+    bool fRegisterPointer = true;
+    unsigned nWrites = 0;
+    unsigned nReads = 0;
+
+private:
+    std::uint8_t m_i2caddr;
+    std::uint8_t m_txAddr = 0;
+    std::uint8_t m_tx[kNumRegs + 1];
+    unsigned m_nTx = 0;
+    unsigned m_nRx = 0;
+    unsigned m_ptr = 0;
+    };
+
+#endif // !defined(_Wire_h_)
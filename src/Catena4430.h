@@ -22,6 +22,8 @@ Author:
 #include <Catena_FSM.h>
 #include <Catena_PollableInterface.h>
 #include <Catena4430_cClockDriver_PCF8523.h>
+#include <Catena4430_cClockDriver_Cached.h>
+#include <Catena4430_cClockDriver_Stm32Rtc.h>
 
 namespace McciCatena4430 {
 
@@ -84,6 +86,6 @@ private:
 } // namespace McciCatena4430
 
 extern McciCatena4430::Catena4430           gCatena4430;
-extern McciCatena4430::cClockDriver_PCF8523 gClock;
+extern McciCatena4430::cClockDriver_Stm32Rtc gClock;
 
 #endif // defined _Catena4430_h_
@@ -26,6 +26,10 @@ namespace McciCatena4430 {
 |
 |   The 4430 GPIO cluster -- I2C GPIOs plus other LEDs
 |
+|   In write-back mode, the LEDs on the PCA9570 are only written by
+|   flush(); the power controls (Vout1, Vsdcard) always take effect
+|   before their set method returns.
+|
 \****************************************************************************/
 
 class c4430Gpios
@@ -68,14 +72,22 @@ public:
     bool setRed(bool fOn)   { digitalWrite(kRedLed, fOn); return true; }
     bool setDisplay(bool fOn) { digitalWrite(kDisplayLed, fOn); return true; }
 
-    bool setVout1(bool fOn) { return this->m_gpio->modify(kVout1Mask, fOn ? 0xFF : 0); }
+    bool setVout1(bool fOn) { return this->m_gpio->modify(kVout1Mask, fOn ? 0xFF : 0) && this->m_gpio->flush(); }
     bool getVout1() const   { return this->m_gpio->get() & kVout1Mask; }
-    bool setVsdcard(bool fOn) { return this->m_gpio->modify(kVout2Mask, fOn ? 0xFF : 0); }
+    bool setVsdcard(bool fOn) { return this->m_gpio->modify(kVout2Mask, fOn ? 0xFF : 0) && this->m_gpio->flush(); }
     bool getVsdcard() const { return this->m_gpio->get() & kVout2Mask; }
 
     bool setLeds(std::uint8_t mask, std::uint8_t v);
     std::uint8_t getLeds();
 
+    // defer LED writes to flush(), or not.
+    bool setWriteBack(bool fWriteBack) { return this->m_gpio->setWriteBack(fWriteBack); }
+    // write any LED changes to the PCA9570; call once per loop.
+    bool flush() { return this->m_gpio->flush(); }
+    // like flush(), but queue the write if the PCA9570 is on a cI2cBus.
+    bool startFlush() { return this->m_gpio->startFlush(); }
+    const cPCA9570::Stats &getStats() const { return this->m_gpio->getStats(); }
+
 private:
     cPCA9570 *m_gpio;
     };
@@ -0,0 +1,126 @@
+/*
+
+Module: Catena4430_cBitFields.h
+
+Function:
+    The Catena4430 library: bit field and register image helpers.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   November 2019
+
+*/
+
+#ifndef _Catena4430_cBitFields_h_
+# define _Catena4430_cBitFields_h_
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include <Catena_Date.h>
+
+namespace McciCatena4430 {
+
+class cBitFields
+    {
+public:
+    template <typename Tout, typename Tin>
+    static Tout constexpr getField(Tin v, Tin mask)
+            {
+            using Tu = typename std::make_unsigned<Tin>::type;
+            const Tu uMask = (Tu)(mask);
+            return static_cast<Tout>((static_cast<Tu>(v) & uMask) / (uMask & (~uMask + 1u)));
+            }
+
+    template <typename T>
+    static T constexpr getField(T v, T mask) { return getField<T, T>(v, mask); }
+
+    template <typename Tout, typename Tfield>
+    static Tout constexpr setField(
+            Tout oldv, Tout mask, Tfield fv
+            )
+            {
+            using Tu = typename std::make_unsigned<Tout>::type;
+            using Tf = typename std::make_unsigned<Tfield>::type;
+            const Tu uMask = (Tu)(mask);
+            return (Tout)(((Tu)(oldv) & ~uMask) +
+                          ((Tf)(fv) * (uMask & (~uMask + 1u))));
+            }
+
+    template <typename T>
+    static T constexpr setField(
+            T oldv, T fv, T mask
+            )
+            {
+            return setField<T, T>(oldv, fv, mask);
+            }
+
+    // get the maximum value for a field
+    template <typename Tout, typename Tin>
+    static Tout constexpr getMaxValue(Tin mask)
+            {
+            return getField<Tout, Tin>(mask, mask);
+            }
+
+    template <typename T>
+    static T constexpr getMaxValue(T mask)
+            {
+            return getMaxValue<T, T>(mask);
+            }
+
+    template <typename T, T firstReg, T lastReg>
+    class RegisterImage
+        {
+    private:
+        static constexpr unsigned nRegs = unsigned(lastReg) - unsigned(firstReg) + 1;
+        static_assert(nRegs < McciCatena::cNumericLimits<std::uint8_t>::numeric_limits_max(),
+            "number of registers must fit in uint8_t");
+
+    public:
+        RegisterImage(){};
+
+        std::uint8_t length() const { return nRegs; }
+        const std::uint8_t *buffer() const { return &m_buf[0]; }
+        std::uint8_t *buffer() { return &m_buf[0]; }
+        void putraw(unsigned index, std::uint8_t b)
+            {
+            if (index < nRegs)
+                this->m_buf[index] = b;
+            }
+        std::uint8_t getraw(unsigned index) const
+            {
+            if (index < nRegs)
+                return this->m_buf[index];
+            else
+                return 0;
+            }
+
+        template <typename Tresult = std::uint8_t>
+        Tresult get(T regname) const
+            {
+            if (firstReg <= regname && regname <= lastReg)
+                {
+                return (Tresult)(this->m_buf[unsigned(regname) - unsigned(firstReg)]);
+                }
+            else
+                return (Tresult) 0;
+            }
+
+        template <typename Tvalue = std::uint8_t>
+        void put(T regname, Tvalue v)
+            {
+            if (firstReg <= regname && regname <= lastReg)
+                this->m_buf[unsigned(regname) - unsigned(firstReg)] = (std::uint8_t)v;
+            }
+
+    private:
+        std::uint8_t m_buf[nRegs];
+        };
+    };
+
+} // namespace McciCatena4430
+
+#endif // !defined(_Catena4430_cBitFields_h_)
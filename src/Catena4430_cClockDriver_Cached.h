@@ -0,0 +1,129 @@
+/*
+
+Module: Catena4430_cClockDriver_Cached.h
+
+Function:
+    The Catena4430 library: clock driver that caches another clock.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena4430_cClockDriver_Cached_h_
+# define _Catena4430_cClockDriver_Cached_h_
+
+#pragma once
+
+#include "Catena4430_cClockDriver.h"
+#include <cstdint>
+
+namespace McciCatena4430 {
+
+/****************************************************************************\
+|
+|   cClockDriver_Cached reads the time from a master clock (normally the
+|   PCF8523) once, remembers the value of millis() at that moment, and then
+|   answers get() by adding the elapsed time to the saved reading. It goes
+|   back to the master when the resync interval expires; the interval is
+|   shortened when a resync finds that millis() and the master disagree,
+|   and lengthened again while they agree.
+|
+|   The cached time is kept in milliseconds, as a window that the time
+|   is known to be in; get() reports the middle. The master only reports
+|   whole seconds, so the first reading gives a window of a second. Each
+|   resync narrows the window to the part that's in the second the master
+|   reports, after widening it for the drift that millis() might have had
+|   since; so the cached time settles on the master's second boundary.
+|   If the master's second is outside the window, millis() has drifted
+|   more than allowed, and the window starts over.
+|
+|   millis() must keep counting (or be compensated) across sleep. Call
+|   invalidate() after anything that stops it.
+|
+\****************************************************************************/
+
+class cClockDriver_Cached : public cClockDriver
+    {
+public:
+    // shortest resync interval, used after drift is seen.
+    static constexpr std::uint32_t kResyncMinMs = 60 * 1000;
+    // default (and longest) resync interval.
+    static constexpr std::uint32_t kResyncMaxMs = 15 * 60 * 1000;
+    // how far millis() may drift from the master, in parts per million,
+    // before a resync counts it as drift. The MCU clock is within 100 ppm
+    // when it's trimmed from the LSE.
+    static constexpr std::uint32_t kDriftAllowancePpm = 100;
+
+    struct Stats
+        {
+        std::uint32_t nGets;        // calls to get()
+        std::uint32_t nCacheHits;   // get() calls answered without the master
+        std::uint32_t nMasterReads; // get() calls that read the master
+        std::uint32_t nDrift;       // resyncs that found drift
+        std::int32_t lastErrorMs;   // correction at last resync
+        std::uint32_t maxErrorMs;   // largest |lastErrorMs| seen
+        std::uint32_t windowMs;     // width of the window at last resync
+        std::uint32_t resyncMs;     // current resync interval
+        };
+
+    cClockDriver_Cached(cClockDriver *pMaster, std::uint32_t resyncMaxMs = kResyncMaxMs)
+        : m_pMaster(pMaster)
+        , m_resyncMaxMs(resyncMaxMs < kResyncMinMs ? kResyncMinMs : resyncMaxMs)
+        , m_resyncMs(m_resyncMaxMs)
+        {}
+
+    // neither copyable nor movable
+    cClockDriver_Cached(const cClockDriver_Cached&) = delete;
+    cClockDriver_Cached& operator=(const cClockDriver_Cached&) = delete;
+    cClockDriver_Cached(const cClockDriver_Cached&&) = delete;
+    cClockDriver_Cached& operator=(const cClockDriver_Cached&&) = delete;
+
+    virtual bool begin() override;
+    virtual void end() override;
+    virtual bool isInitialized() override;
+    virtual bool get(McciCatena::cDate &d, unsigned *pError = nullptr) override;
+    virtual bool set(const McciCatena::cDate &d, unsigned *pError = nullptr) override;
+
+    // like get(), but also return the milliseconds into the second.
+    bool getWithMs(McciCatena::cDate &d, std::uint16_t &ms, unsigned *pError = nullptr);
+
+    // forget the cached reading; the next get() reads the master.
+    void invalidate()
+        {
+        this->m_fAnchorValid = false;
+        }
+
+    // return a snapshot of the statistics.
+    const Stats &getStats()
+        {
+        this->m_stats.resyncMs = this->m_resyncMs;
+        return this->m_stats;
+        }
+
+    // get the master clock.
+    cClockDriver *getMaster() const
+        {
+        return this->m_pMaster;
+        }
+
+private:
+    void setAnchor(std::int64_t tFirstMs, std::int64_t tLastMs, std::uint32_t nowMs);
+    bool resync(std::uint32_t nowMs, unsigned *pError);
+
+    cClockDriver *m_pMaster;
+    std::int64_t m_anchorFirstMs;   // earliest the time was at m_anchorMs (common time, ms)
+    std::uint32_t m_anchorSpanMs;   // width of the window, less 1
+    std::uint32_t m_anchorMs;       // millis() at the anchor
+    std::uint32_t m_resyncMaxMs;
+    std::uint32_t m_resyncMs;
+    bool m_fAnchorValid = false;
+    Stats m_stats {};
+    };
+
+} // namespace McciCatena4430
+
+#endif // !defined(_Catena4430_cClockDriver_Cached_h_)
@@ -19,111 +19,17 @@ Author:
 #pragma once
 
 #include "Catena4430_cClockDriver.h"
+#include "Catena4430_cRegisterCache.h"
 #include <Wire.h>
-#include <type_traits>
 
 namespace McciCatena4430 {
 
-class cBitFields
-    {
-public:
-    template <typename Tout, typename Tin>
-    static Tout constexpr getField(Tin v, Tin mask)
-            {
-            using Tu = typename std::make_unsigned<Tin>::type;
-            const Tu uMask = (Tu)(mask);
-            return static_cast<Tout>((static_cast<Tu>(v) & uMask) / (uMask & (~uMask + 1u)));
-            }
-
-    template <typename T>
-    static T constexpr getField(T v, T mask) { return getField<T, T>(v, mask); }
-
-    template <typename Tout, typename Tfield>
-    static Tout constexpr setField(
-            Tout oldv, Tout mask, Tfield fv
-            )
-            {
-            using Tu = typename std::make_unsigned<Tout>::type;
-            using Tf = typename std::make_unsigned<Tfield>::type;
-            const Tu uMask = (Tu)(mask);
-            return (Tout)(((Tu)(oldv) & ~uMask) +
-                          ((Tf)(fv) * (uMask & (~uMask + 1u))));
-            }
-
-    template <typename T>
-    static T constexpr setField(
-            T oldv, T fv, T mask
-            )
-            {
-            return setField<T, T>(oldv, fv, mask);
-            }
-
-    // get the maximum value for a field
-    template <typename Tout, typename Tin>
-    static Tout constexpr getMaxValue(Tin mask)
-            {
-            return getField<Tout, Tin>(mask, mask);
-            }
-
-    template <typename T>
-    static T constexpr getMaxValue(T mask)
-            {
-            return getMaxValue<T, T>(mask);
-            }
-
-    template <typename T, T firstReg, T lastReg>
-    class RegisterImage
-        {
-    private:
-        static constexpr unsigned nRegs = unsigned(lastReg) - unsigned(firstReg) + 1;
-        static_assert(nRegs < McciCatena::cNumericLimits<std::uint8_t>::numeric_limits_max(),
-            "number of registers must fit in uint8_t");
-
-    public:
-        RegisterImage(){};
-
-        std::uint8_t length() const { return nRegs; }
-        std::uint8_t buffer() const { return &m_buf[0]; }
-        void putraw(unsigned index, std::uint8_t b)
-            {
-            if (index < nRegs)
-                this->m_buf[index] = b;
-            }
-        std::uint8_t getraw(unsigned index)
-            {
-            if (index < nRegs)
-                return this->m_buf[index];
-            else
-                return 0;
-            }
-
-        template <typename Tresult = std::uint8_t>
-        Tresult get(T regname)
-            {
-            if (firstReg <= regname && regname <= lastReg)
-                {
-                return (Tresult)(this->m_buf[unsigned(regname) - unsigned(firstReg)]);
-                }
-            else
-                return (Tresult) 0;
-            }
-
-        template <typename Tvalue = std::uint8_t>
-        void put(T regname, Tvalue v)
-            {
-            if (firstReg <= regname && regname <= lastReg)
-                this->m_buf[unsigned(regname) - unsigned(firstReg)] = (std::uint8_t)v;
-            }
-
-    private:
-        std::uint8_t m_buf[nRegs];
-        };
-    };
-
 class cClockDriver_PCF8523 : public cClockDriver, cBitFields
     {
 public:
     static constexpr std::uint8_t kI2cAddress = 0x68;
+    // the device supports Fast-mode Plus.
+    static constexpr std::uint32_t kMaxClockHz = 1000000;
     // register indices, using datasheet names.
     enum class kReg : std::uint8_t {
         Control_1 = 0,
@@ -231,10 +137,83 @@ public:
         MONTHS = 0x1F,
         };
 
+    // the alarm registers (Minute_alarm .. Weekday_alarm) all have the
+    // same layout: an active-low enable, and a BCD value.
+    enum class kRegAlarm : std::uint8_t
+        {
+        AEN = 1 << 7,
+        VALUE = 0x7F,
+        };
+
+    enum class kRegOffset : std::uint8_t
+        {
+        MODE = 1 << 7,
+        OFFSET = 0x7F,
+        };
+
+    // each step of the Offset register, in parts per billion, when
+    // MODE is 0 (correction every two hours, the low-power mode).
+    static constexpr std::int32_t kOffsetPpbPerStep = 4340;
+    static constexpr std::int8_t kOffsetMin = -64;
+    static constexpr std::int8_t kOffsetMax = 63;
+
+    enum class kRegTmr_CLKOUT_ctrl : std::uint8_t
+        {
+        TAM = 1 << 7,
+        TBM = 1 << 6,
+        COF = 7 << 3,
+        TAC = 3 << 1,
+        TBC = 1 << 0,
+        };
+
+    enum class kRegTmr_CLKOUT_ctrl_TAC : std::uint8_t
+        {
+        Disabled = 0,
+        Countdown = 1,
+        Watchdog = 2,
+        Rsv3 = 3,
+        };
+
+    // COF value that turns off CLKOUT, so the pin can be used as INT1.
+    static constexpr std::uint8_t kCofDisabled = 7;
+
+    enum class kRegTmr_freq_ctrl : std::uint8_t
+        {
+        TQ = 7 << 0,
+        };
+
+    enum class kRegTmr_freq_ctrl_TQ : std::uint8_t
+        {
+        Hz4096 = 0,
+        Hz64 = 1,
+        Hz1 = 2,
+        PerMinute = 3,
+        PerHour = 4,
+        };
+
     // TODO(tmm@mcci.com) add remaining bits (that we don't use)
 
 public:
-    cClockDriver_PCF8523(TwoWire *pWire) : m_i2caddr(kI2cAddress), m_wire(pWire) {};
+    // the register cache; these registers change on their own (time,
+    // flags and counters), so they're always written when put.
+    using RegisterCache = cRegisterCache<kReg, kReg::Control_1, kReg::Tmr_B_reg>;
+    static constexpr std::uint32_t kVolatileRegs =
+        (1u << unsigned(kReg::Control_2)) |
+        (1u << unsigned(kReg::Control_3)) |
+        (1u << unsigned(kReg::Seconds)) |
+        (1u << unsigned(kReg::Minutes)) |
+        (1u << unsigned(kReg::Hours)) |
+        (1u << unsigned(kReg::Days)) |
+        (1u << unsigned(kReg::Weekdays)) |
+        (1u << unsigned(kReg::Months)) |
+        (1u << unsigned(kReg::Years)) |
+        (1u << unsigned(kReg::Tmr_A_reg)) |
+        (1u << unsigned(kReg::Tmr_B_reg));
+
+    cClockDriver_PCF8523(TwoWire *pWire)
+        : m_wire(pWire)
+        , m_regs(pWire, kI2cAddress, kVolatileRegs, RegisterCache::AddressMode::kRegisterPointer, kMaxClockHz)
+        {};
     // neither copyable nor movable
     cClockDriver_PCF8523(const cClockDriver_PCF8523&) = delete;
     cClockDriver_PCF8523& operator=(const cClockDriver_PCF8523&) = delete;
@@ -248,14 +227,66 @@ public:
     virtual bool get(McciCatena::cDate &d, unsigned *pError = nullptr) override;
     virtual bool set(const McciCatena::cDate &d, unsigned *pError = nullptr) override;
 
+    // Wake-up sources. These drive the INT1 pin low (and keep it low
+    // until the flag is cleared), so CLKOUT is turned off while either
+    // is armed.
+
+    // start countdown timer A. The source clock is picked to suit the
+    // interval: 1 Hz up to 255 seconds, then 1/60 Hz, then 1/3600 Hz.
+    // Longer intervals are rounded down, so the timer never fires late,
+    // but the first period of the slower clocks may be short, so the
+    // timer can fire up to one period early.
+    bool startCountdown(std::uint32_t seconds, unsigned *pError = nullptr);
+    // stop timer A and disable its interrupt.
+    bool stopCountdown(unsigned *pError = nullptr);
+    // fire when the minutes register matches minute (0..59).
+    bool setMinuteAlarm(std::uint8_t minute, unsigned *pError = nullptr);
+    // disable the alarm and its interrupt.
+    bool clearMinuteAlarm(unsigned *pError = nullptr);
+    // read Control_2 into flags, and clear CTAF, CTBF and AF.
+    bool getAndClearFlags(kRegControl_2 &flags, unsigned *pError = nullptr);
+
+    // Aging offset. A positive offset makes the clock run faster, by
+    // kOffsetPpbPerStep per step. setOffset() always selects MODE 0.
+    bool getOffset(std::int8_t &offset, unsigned *pError = nullptr);
+    bool setOffset(std::int8_t offset, unsigned *pError = nullptr);
+
+    // Asynchronous get: startGet() queues the read of the time
+    // registers, and calls pDoneFn when it's done; then getResult()
+    // decodes them, just as get() would.
+    bool startGet(RegisterCache::DoneFn *pDoneFn, void *pUserData)
+        {
+        return this->m_regs.startRead(kReg::Control_1, kReg::Years, pDoneFn, pUserData);
+        }
+    bool getResult(McciCatena::cDate &d, unsigned *pError = nullptr);
+
+    // queue transfers on pBus, rather than using Wire directly.
+    void setBus(cI2cBus *pBus)
+        {
+        this->m_regs.getDevice().setBus(pBus);
+        }
+
+    // I2C transaction counts.
+    const RegisterCache::Stats &getRegisterStats() const
+        {
+        return this->m_regs.getStats();
+        }
+
+    // I2C bus statistics.
+    const cI2cBus::DeviceStats &getI2cStats() const
+        {
+        return this->m_regs.getDevice().getStats();
+        }
+
 protected:
     static bool checkInitialized(kRegControl_1 rControl1, kRegControl_3 rControl3);
-    bool readBuffer(std::uint8_t *pBuffer, unsigned nBytes);
-    bool writeBuffer(std::uint8_t const *pBuffer, unsigned nBytes);
+    bool readIfNeeded(kReg reg);
+    bool setInterruptEnables(kRegControl_1 setControl_1, kRegControl_1 clearControl_1, kRegControl_2 setControl_2, kRegControl_2 clearControl_2);
+    bool disableClkout();
 
 private:
     TwoWire *m_wire;
-    std::uint8_t m_i2caddr;
+    RegisterCache m_regs;
     };
 
 } // namespace McciCatena4430
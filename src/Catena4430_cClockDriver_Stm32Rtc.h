@@ -0,0 +1,118 @@
+/*
+
+Module: Catena4430_cClockDriver_Stm32Rtc.h
+
+Function:
+    The Catena4430 library: clock driver for the STM32L0 internal RTC.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena4430_cClockDriver_Stm32Rtc_h_
+# define _Catena4430_cClockDriver_Stm32Rtc_h_
+
+#pragma once
+
+#include "Catena4430_cClockDriver.h"
+#include <cstdint>
+
+namespace McciCatena4430 {
+
+/****************************************************************************\
+|
+|   cClockDriver_Stm32Rtc keeps calendar time using the STM32L0's own
+|   RTC, which runs from the LSE and keeps running in stop and standby
+|   modes. get() reads the RTC registers directly, so it costs a few
+|   cycles instead of an I2C transaction.
+|
+|   The Catena platform owns the RTC, including the calendar, which its
+|   sleep alarms are based on; so this class never writes it. Instead,
+|   it keeps the difference, in milliseconds, between the calendar and
+|   the time it was given, and get() adds that to the calendar.
+|
+|   The difference is lost when the MCU resets, so the RTC is paired
+|   with a battery-backed master clock (normally the PCF8523). begin()
+|   takes the time from the master; set() sets both. get() fails until
+|   the time has been set one way or the other.
+|
+\****************************************************************************/
+
+class cClockDriver_Stm32Rtc : public cClockDriver
+    {
+public:
+    // error codes; the master's codes are passed through unchanged.
+    enum Error : unsigned
+        {
+        kErrNotSet = 100,       // RTC hasn't been set since power-up
+        kErrNoRtc,              // RTC isn't enabled
+        kErrSyncTimeout,        // shadow registers didn't resync
+        kErrInvalidDate,        // date is invalid
+        kErrBadRegisters,       // RTC registers hold an invalid date
+        };
+
+    struct Stats
+        {
+        std::uint32_t nGets;        // successful calls to get()
+        std::uint32_t nSets;        // successful calls to set()
+        std::uint32_t nMasterSyncs; // times the RTC was loaded from the master
+        };
+
+    cClockDriver_Stm32Rtc(cClockDriver *pMaster = nullptr)
+        : m_pMaster(pMaster)
+        {}
+
+    // neither copyable nor movable
+    cClockDriver_Stm32Rtc(const cClockDriver_Stm32Rtc&) = delete;
+    cClockDriver_Stm32Rtc& operator=(const cClockDriver_Stm32Rtc&) = delete;
+    cClockDriver_Stm32Rtc(const cClockDriver_Stm32Rtc&&) = delete;
+    cClockDriver_Stm32Rtc& operator=(const cClockDriver_Stm32Rtc&&) = delete;
+
+    virtual bool begin() override;
+    virtual void end() override;
+    virtual bool isInitialized() override;
+    virtual bool get(McciCatena::cDate &d, unsigned *pError = nullptr) override;
+    virtual bool set(const McciCatena::cDate &d, unsigned *pError = nullptr) override;
+
+    // like get(), but also return the milliseconds into the second.
+    bool getWithMs(McciCatena::cDate &d, std::uint16_t &ms, unsigned *pError = nullptr);
+
+    // take the time from the master clock, lining up the second boundary.
+    bool syncFromMaster(unsigned *pError = nullptr);
+
+    // call after waking from stop or standby mode; the next get() waits
+    // for the shadow registers to catch up with the RTC.
+    void wakeup()
+        {
+        this->m_fNeedShadowSync = true;
+        }
+
+    const Stats &getStats() const
+        {
+        return this->m_stats;
+        }
+
+    cClockDriver *getMaster() const
+        {
+        return this->m_pMaster;
+        }
+
+private:
+    bool setRtc(const McciCatena::cDate &d, unsigned *pError);
+    // read the RTC calendar, in milliseconds of common time.
+    bool readRtc(std::int64_t &tMs, unsigned *pError);
+
+    cClockDriver *m_pMaster;
+    std::int64_t m_offsetMs = 0;
+    bool m_fSet = false;
+    bool m_fNeedShadowSync = true;
+    Stats m_stats {};
+    };
+
+} // namespace McciCatena4430
+
+#endif // !defined(_Catena4430_cClockDriver_Stm32Rtc_h_)
@@ -0,0 +1,254 @@
+/*
+
+Module: Catena4430_cI2cBus.h
+
+Function:
+    The Catena4430 library: I2C transaction manager.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena4430_cI2cBus_h_
+# define _Catena4430_cI2cBus_h_
+
+#pragma once
+
+#include <CatenaBase_types.h>
+#include <Catena_PollableInterface.h>
+#include <Wire.h>
+#include <cstdint>
+
+namespace McciCatena4430 {
+
+/****************************************************************************\
+|
+|   cI2cBus runs I2C transactions for the devices on one TwoWire bus.
+|
+|   A transaction is a write, a read, or a write followed by a read, to
+|   one device. It can be run at once (execute()), or queued (submit())
+|   and run later from poll(), one per call, with a completion callback.
+|   Queued transactions let other pollable objects run between
+|   transfers, rather than the whole sequence blocking the loop.
+|
+|   Wire itself blocks while a transfer is on the bus; this class
+|   doesn't change that, it only schedules the transfers.
+|
+|   Each cDevice has a maximum clock rate; the bus runs each transaction
+|   at the lower of that and the bus maximum, and then puts the clock
+|   back to kDefaultClockHz, so code that uses Wire directly (the
+|   sensor libraries) always sees the default.
+|
+|   A cDevice that isn't attached to a bus still works; its transactions
+|   run at once, at whatever clock Wire is using.
+|
+|   Transactions are owned by the caller, and must not be changed or
+|   reused until they complete.
+|
+\****************************************************************************/
+
+class cI2cBus : public McciCatena::cPollableObject
+    {
+public:
+    static constexpr std::uint32_t kDefaultClockHz = 100000;
+    static constexpr std::uint32_t kFastClockHz = 400000;
+
+    class cDevice;
+    struct Transaction;
+
+    enum class Status : std::uint8_t
+        {
+        kIdle,          // not yet submitted
+        kQueued,        // waiting for poll()
+        kDone,          // completed successfully
+        kNack,          // device didn't acknowledge
+        kError,         // other bus error, or short read
+        };
+
+    // completion callback; called from poll(), or from submit() if the
+    // device isn't attached to a bus.
+    typedef void (DoneFn)(void *pUserData, Transaction *pTxn);
+
+    struct Transaction
+        {
+        cDevice             *pDevice;
+        const std::uint8_t  *pWrite;
+        std::uint8_t        *pRead;
+        DoneFn              *pDoneFn;
+        void                *pUserData;
+        Transaction         *pNext;
+        std::uint8_t        nWrite;
+        std::uint8_t        nRead;
+        Status              status;
+
+        bool isPending() const
+            {
+            return this->status == Status::kQueued;
+            }
+        };
+
+    struct DeviceStats
+        {
+        std::uint32_t nTransactions;    // transactions run
+        std::uint32_t nBytes;           // bytes written plus bytes read
+        std::uint32_t nNacks;           // transactions NACKed
+        std::uint32_t nErrors;          // other failures
+        std::uint32_t busTimeUs;        // total time in Wire calls
+        };
+
+    struct Stats
+        {
+        std::uint32_t nSubmitted;       // transactions queued
+        std::uint32_t nClockChanges;    // calls to Wire.setClock()
+        std::uint8_t  maxQueueDepth;    // deepest queue seen
+        };
+
+    /************************************************************************\
+    |
+    |   cDevice: one device on the bus
+    |
+    \************************************************************************/
+
+    class cDevice
+        {
+    public:
+        cDevice(TwoWire *pWire, std::uint8_t i2caddr, std::uint32_t maxClockHz = kDefaultClockHz)
+            : m_wire(pWire)
+            , m_i2caddr(i2caddr)
+            , m_maxClockHz(maxClockHz)
+            {}
+
+        // neither copyable nor movable
+        cDevice(const cDevice&) = delete;
+        cDevice& operator=(const cDevice&) = delete;
+        cDevice(const cDevice&&) = delete;
+        cDevice& operator=(const cDevice&&) = delete;
+
+        // route transactions through pBus (nullptr to go direct).
+        void setBus(cI2cBus *pBus)
+            {
+            this->m_pBus = pBus;
+            }
+
+        cI2cBus *getBus() const
+            {
+            return this->m_pBus;
+            }
+
+        // write nWrite bytes, then read nRead bytes; either may be zero.
+        // Blocks until done.
+        bool writeRead(
+            const std::uint8_t *pWrite, std::uint8_t nWrite,
+            std::uint8_t *pRead, std::uint8_t nRead
+            );
+
+        // queue a transaction; pDoneFn is called when it finishes.
+        bool submit(
+            Transaction &txn,
+            const std::uint8_t *pWrite, std::uint8_t nWrite,
+            std::uint8_t *pRead, std::uint8_t nRead,
+            DoneFn *pDoneFn, void *pUserData
+            );
+
+        std::uint8_t getAddress() const
+            {
+            return this->m_i2caddr;
+            }
+
+        std::uint32_t getMaxClockHz() const
+            {
+            return this->m_maxClockHz;
+            }
+
+        const DeviceStats &getStats() const
+            {
+            return this->m_stats;
+            }
+
+    private:
+        friend class cI2cBus;
+
+        TwoWire *m_wire;
+        cI2cBus *m_pBus = nullptr;
+        std::uint8_t m_i2caddr;
+        std::uint32_t m_maxClockHz;
+        DeviceStats m_stats {};
+        };
+
+    //*******************************************
+    // Constructor, etc.
+    //*******************************************
+public:
+    cI2cBus(TwoWire *pWire, std::uint32_t maxClockHz = kFastClockHz)
+        : m_wire(pWire)
+        , m_maxClockHz(maxClockHz)
+        {}
+
+    // neither copyable nor movable
+    cI2cBus(const cI2cBus&) = delete;
+    cI2cBus& operator=(const cI2cBus&) = delete;
+    cI2cBus(const cI2cBus&&) = delete;
+    cI2cBus& operator=(const cI2cBus&&) = delete;
+
+    //*******************************************
+    // The public methods
+    //*******************************************
+public:
+    // register for polling.
+    bool begin(McciCatena::CatenaBase &rCatena);
+
+    // run everything that's queued, and stop.
+    void end();
+
+    // run one queued transaction.
+    virtual void poll() override;
+
+    // queue a transaction.
+    bool submit(Transaction *pTxn);
+
+    // run a transaction now, ahead of anything queued.
+    bool execute(Transaction *pTxn);
+
+    // true if transactions are waiting; don't sleep.
+    bool isBusy() const
+        {
+        return this->m_pHead != nullptr;
+        }
+
+    const Stats &getStats() const
+        {
+        return this->m_stats;
+        }
+
+    // run a transaction on pWire, with no clock management.
+    static Status transfer(TwoWire *pWire, Transaction *pTxn);
+
+    //*******************************************
+    // The implementation
+    //*******************************************
+private:
+    static void complete(Transaction *pTxn, Status status, std::uint32_t tUs);
+    void setClock(std::uint32_t hz);
+
+    //*******************************************
+    // The instance data
+    //*******************************************
+private:
+    TwoWire *m_wire;
+    std::uint32_t m_maxClockHz;
+    Transaction *m_pHead = nullptr;
+    Transaction *m_pTail = nullptr;
+    std::uint8_t m_queueDepth = 0;
+    bool m_fRegistered = false;
+    // true if the clock isn't kDefaultClockHz.
+    bool m_fFastClock = false;
+    Stats m_stats {};
+    };
+
+} // namespace McciCatena4430
+
+#endif // _Catena4430_cI2cBus_h_
@@ -0,0 +1,151 @@
+/*
+
+Module: Catena4430_cLedMirror.h
+
+Function:
+    The Catena4430 library: copy the PIR and feeder inputs to the LEDs.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena4430_cLedMirror_h_
+# define _Catena4430_cLedMirror_h_
+
+#pragma once
+
+#include <Arduino.h>
+#include <CatenaBase_types.h>
+#include <Catena_PollableInterface.h>
+#include <Catena4430_c4430Gpios.h>
+#include <cstdint>
+
+namespace McciCatena4430 {
+
+/****************************************************************************\
+|
+|   cLedMirror shows the PIR input on the blue LED, and the two feeder
+|   inputs on the green and red LEDs. The inputs raise pin-change
+|   interrupts; the interrupt only sets a flag, and poll() updates the
+|   LEDs, no more than once per kMinUpdateMs. Between changes, poll()
+|   costs one test.
+|
+|   A feeder LED stays off until its input has been seen low once; that
+|   means something is plugged into the connector.
+|
+|   setDisabled() turns off the feeder LEDs (and forgets which feeders
+|   are connected); if the light is also low (setLowLight()), the PIR
+|   LED is turned off as well.
+|
+|   Only one instance can be active, because the interrupt handlers
+|   have no context pointer.
+|
+\****************************************************************************/
+
+class cLedMirror : public McciCatena::cPollableObject
+    {
+    // the default digital pins for the inputs.
+    static const unsigned kPirData = A0;
+    static const unsigned kFeeder0 = A1;
+    static const unsigned kFeeder1 = A2;
+
+public:
+    // minimum time between LED updates, to bound the I2C traffic when
+    // an input is chattering.
+    static constexpr std::uint32_t kMinUpdateMs = 50;
+
+    struct Stats
+        {
+        std::uint32_t nInterrupts;  // pin changes seen
+        std::uint32_t nUpdates;     // times the LEDs were recomputed
+        };
+
+    //*******************************************
+    // Constructor, etc.
+    //*******************************************
+public:
+    cLedMirror(c4430Gpios *pGpios)
+        : m_gpios(pGpios)
+        {}
+
+    // neither copyable nor movable
+    cLedMirror(const cLedMirror&) = delete;
+    cLedMirror& operator=(const cLedMirror&) = delete;
+    cLedMirror(const cLedMirror&&) = delete;
+    cLedMirror& operator=(const cLedMirror&&) = delete;
+
+    //*******************************************
+    // The public methods
+    //*******************************************
+public:
+    // attach the interrupts and start mirroring.
+    bool begin(McciCatena::CatenaBase& rCatena);
+
+    // detach the interrupts and turn the LEDs off.
+    void end();
+
+    // poll function (updates the LEDs if an input changed)
+    virtual void poll() override;
+
+    // turn the feeder LEDs off (true) or let them follow the inputs.
+    void setDisabled(bool fDisabled);
+
+    // tell us whether the light is low.
+    void setLowLight(bool fLowLight);
+
+    // true if an update is waiting for the rate limit; the caller
+    // shouldn't sleep for long.
+    bool isPending() const
+        {
+        return this->m_fActive && this->m_fChanged;
+        }
+
+    const Stats &getStats() const
+        {
+        return this->m_stats;
+        }
+
+    //*******************************************
+    // The implementation
+    //*******************************************
+private:
+    static void isr();
+    void update();
+    void requestUpdate()
+        {
+        this->m_fChanged = true;
+        }
+
+    //*******************************************
+    // The instance data
+    //*******************************************
+private:
+    // the active instance, for the interrupt handler.
+    static cLedMirror *s_pActive;
+
+    // the LEDs.
+    c4430Gpios *m_gpios;
+    // when the LEDs were last updated.
+    std::uint32_t m_lastUpdateMs = 0;
+    // counters
+    Stats m_stats {};
+    // set by the interrupt handler.
+    volatile bool m_fChanged = false;
+    // are we registered?
+    bool m_fRegistered = false;
+    // are we active?
+    bool m_fActive = false;
+    bool m_fDisabled = false;
+    bool m_fLowLight = false;
+    // has each feeder been seen low?
+    bool m_fFeeder0Connected = false;
+    bool m_fFeeder1Connected = false;
+    };
+
+} // namespace McciCatena4430
+
+#endif // _Catena4430_cLedMirror_h_
@@ -18,6 +18,7 @@ Author:
 
 #pragma once
 
+#include "Catena4430_cRegisterCache.h"
 #include <cstdint>
 #include <Wire.h>
 
@@ -27,6 +28,14 @@ namespace McciCatena4430 {
 |
 |   PCA9570 I2C output buffer
 |
+|   The device has a single output register and no register pointer.
+|   The cached image holds the value as written (after inversion), so
+|   set() only does an I2C write if the outputs actually change.
+|
+|   In write-back mode, set() and modify() only update the image, and
+|   flush() writes it; that way a caller that sets outputs many times
+|   in a loop pays for at most one write per pass.
+|
 \****************************************************************************/
 
 class cPCA9570
@@ -34,6 +43,22 @@ class cPCA9570
 public:
     // the default i2c address
     static constexpr std::uint8_t kI2cAddress = 0x24;
+    // the device supports Fast-mode Plus.
+    static constexpr std::uint32_t kMaxClockHz = 1000000;
+
+    // the device's only register.
+    enum class kReg : std::uint8_t
+        {
+        Output = 0,
+        };
+
+    using RegisterCache = cRegisterCache<kReg, kReg::Output, kReg::Output>;
+
+    struct Stats
+        {
+        std::uint32_t nRequests;    // calls to set() and modify()
+        std::uint32_t nWrites;      // writes actually done
+        };
 
 private:
     // the mask of bits in the PCA9570 output register that are active.
@@ -43,7 +68,11 @@ private:
     // Constructor, etc.
     //*******************************************
 public:
-    cPCA9570(TwoWire *pWire) : m_i2caddr(kI2cAddress), m_wire(pWire), m_inversion(0) {};
+    cPCA9570(TwoWire *pWire)
+        : m_wire(pWire)
+        , m_regs(pWire, kI2cAddress, 0, RegisterCache::AddressMode::kNone, kMaxClockHz)
+        , m_inversion(0)
+        {};
 
     // neither copyable nor movable
     cPCA9570(const cPCA9570&) = delete;
@@ -61,15 +90,35 @@ public:
     // stop using the PCA9570.
     void end();
 
-    // set the output of the PCA9579 to value.
+    // set the output of the PCA9579 to value. In write-back mode, the
+    // value is written by the next flush().
     bool set(std::uint8_t value);
 
+    // write the outputs, if they've changed since the last write.
+    bool flush();
+
+    // like flush(), but queue the write on the bus and return at once.
+    // Outputs set while the write is queued are written after it.
+    bool startFlush();
+
+    // queue transfers on pBus, rather than using Wire directly.
+    void setBus(cI2cBus *pBus)
+        { this->m_regs.getDevice().setBus(pBus); }
+
+    // select write-back mode (true) or write-through mode (false).
+    // Leaving write-back mode flushes.
+    bool setWriteBack(bool fWriteBack);
+
+    bool isWriteBack() const
+        { return this->m_fWriteBack; }
+
     // modify the output of the PCA9579; use mask to enable writing of bits
     bool modify(std::uint8_t mask, std::uint8_t bits);
 
     // set the polarity of each output; 0 == normal, 1 == inverting.
-    bool setPolarity(std::uint8_t mask)
-        { this->m_inversion = (~mask) & kActiveBits; }
+    // The outputs keep their logical values; the change is written
+    // by the next set().
+    bool setPolarity(std::uint8_t mask);
 
     // get the polarity of each output.
     std::uint8_t getPolarity() const
@@ -77,12 +126,29 @@ public:
 
     // get the current (cached) value.
     std::uint8_t get() const
-        { return this->m_value & kActiveBits; }
+        { return (this->m_regs.get(kReg::Output) ^ this->m_inversion) & kActiveBits; }
 
     // read the output register of the PCA9570. Takes into
     // account inversion, so result is conmensurate with
     // cPCA9570::get().
-    bool read(std::uint8_t &value) const;
+    bool read(std::uint8_t &value);
+
+    // requested vs. performed writes.
+    const Stats &getStats() const
+        { return this->m_stats; }
+
+    // I2C statistics.
+    const RegisterCache::Stats &getRegisterStats() const
+        { return this->m_regs.getStats(); }
+    const cI2cBus::DeviceStats &getI2cStats() const
+        { return this->m_regs.getDevice().getStats(); }
+
+    //*******************************************
+    // The implementation
+    //*******************************************
+private:
+    // completion for startFlush().
+    static void flushDone(void *pUserData, bool fSuccess);
 
     //*******************************************
     // The instance data
@@ -90,12 +156,14 @@ public:
 private:
     // the i2c bus used to access the device.
     TwoWire *m_wire;
-    // the i2c address.
-    std::uint8_t m_i2caddr;
-    // the most recent value.
-    std::uint8_t m_value;
+    // the cached output register.
+    RegisterCache m_regs;
     // the inversion mask. For each bit, 0 ==> non-inverting.
     std::uint8_t m_inversion;
+    // true if writes are deferred to flush().
+    bool m_fWriteBack = false;
+    // write counters.
+    Stats m_stats {};
     };
 
 } // namespace McciCatena4430
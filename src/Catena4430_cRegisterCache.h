@@ -0,0 +1,471 @@
+/*
+
+Module: Catena4430_cRegisterCache.h
+
+Function:
+    The Catena4430 library: cached register map for I2C devices.
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#ifndef _Catena4430_cRegisterCache_h_
+# define _Catena4430_cRegisterCache_h_
+
+#pragma once
+
+#include "Catena4430_cBitFields.h"
+#include "Catena4430_cI2cBus.h"
+#include <Wire.h>
+#include <cstdint>
+
+namespace McciCatena4430 {
+
+/****************************************************************************\
+|
+|   cRegisterCache keeps an image of a block of device registers, and
+|   remembers which registers have been changed (dirty) and which hold a
+|   value known to match the device (valid).
+|
+|   put() only marks a register dirty if the value changes, or if the
+|   register isn't valid; flush() writes each run of contiguous dirty
+|   registers in one I2C transaction. read() fetches a run of registers
+|   in one transaction.
+|
+|   Registers that change by themselves (counters, status flags) should
+|   be listed in the volatile mask; they're never valid, so put() always
+|   writes them.
+|
+|   Devices with a register pointer get it as the first byte of each
+|   transaction. Devices without one (AddressMode::kNone) must have a
+|   single register.
+|
+|   Transfers go through a cI2cBus::cDevice, which keeps the I2C
+|   statistics. startRead() and startFlush() queue the transfers on the
+|   bus (if the device is attached to one) and call back when done;
+|   only one of them can be outstanding at a time.
+|
+\****************************************************************************/
+
+template <typename T, T firstReg, T lastReg>
+class cRegisterCache : public cBitFields
+    {
+public:
+    using Image = RegisterImage<T, firstReg, lastReg>;
+    static constexpr unsigned kNumRegs = unsigned(lastReg) - unsigned(firstReg) + 1;
+    static_assert(kNumRegs <= 32, "dirty and valid masks hold at most 32 registers");
+
+    enum class AddressMode : std::uint8_t
+        {
+        kRegisterPointer,   // first byte written is the register number
+        kNone,              // device has a single register and no pointer
+        };
+
+    struct Stats
+        {
+        std::uint32_t nReadTransactions;
+        std::uint32_t nWriteTransactions;
+        std::uint32_t nPuts;            // calls to put()
+        std::uint32_t nPutsUnchanged;   // put() calls that changed nothing
+        std::uint32_t nErrors;
+        };
+
+    // completion callback for startRead() and startFlush().
+    typedef void (DoneFn)(void *pUserData, bool fSuccess);
+
+    cRegisterCache(
+        TwoWire *pWire,
+        std::uint8_t i2caddr,
+        std::uint32_t volatileMask = 0,
+        AddressMode addressMode = AddressMode::kRegisterPointer,
+        std::uint32_t maxClockHz = cI2cBus::kDefaultClockHz
+        )
+        : m_device(pWire, i2caddr, maxClockHz)
+        , m_addressMode(addressMode)
+        , m_volatileMask(volatileMask)
+        {
+        static_assert(kNumRegs >= 1, "need at least one register");
+        }
+
+    // neither copyable nor movable
+    cRegisterCache(const cRegisterCache&) = delete;
+    cRegisterCache& operator=(const cRegisterCache&) = delete;
+    cRegisterCache(const cRegisterCache&&) = delete;
+    cRegisterCache& operator=(const cRegisterCache&&) = delete;
+
+    // the cached value of a register.
+    template <typename Tresult = std::uint8_t>
+    Tresult get(T reg) const
+        {
+        return this->m_image.template get<Tresult>(reg);
+        }
+
+    // set the cached value of a register; it's written by flush().
+    template <typename Tvalue = std::uint8_t>
+    void put(T reg, Tvalue v)
+        {
+        if (! inRange(reg))
+            return;
+
+        std::uint32_t const bit = mask(reg);
+        std::uint8_t const b = std::uint8_t(v);
+
+        ++this->m_stats.nPuts;
+        if ((this->m_valid & bit) && this->m_image.get(reg) == b)
+            {
+            ++this->m_stats.nPutsUnchanged;
+            return;
+            }
+
+        this->m_image.put(reg, b);
+        this->m_dirty |= bit;
+        }
+
+    // change the bits in mask to bits.
+    void modify(T reg, std::uint8_t maskBits, std::uint8_t bits)
+        {
+        this->put(reg, std::uint8_t((this->get(reg) & ~maskBits) | (bits & maskBits)));
+        }
+
+    // forget the values of registers first..last; they'll be written by
+    // the next flush() after a put(), even if the value matches.
+    void invalidate(T first = firstReg, T last = lastReg)
+        {
+        this->m_valid &= ~rangeMask(first, last);
+        }
+
+    bool isValid(T reg) const
+        {
+        return inRange(reg) && (this->m_valid & mask(reg)) != 0;
+        }
+
+    bool isDirty() const
+        {
+        return this->m_dirty != 0;
+        }
+
+    // read registers first..last from the device, in one transaction.
+    // Pending writes to those registers are lost.
+    bool read(T first = firstReg, T last = lastReg)
+        {
+        if (! inRange(first) || ! inRange(last) || last < first)
+            return false;
+
+        this->wait();
+
+        unsigned const iFirst = index(first);
+        unsigned const n = index(last) - iFirst + 1;
+        std::uint8_t const reg = std::uint8_t(first);
+        std::uint8_t buf[kNumRegs];
+
+        ++this->m_stats.nReadTransactions;
+        if (! this->m_device.writeRead(
+                &reg, this->m_addressMode == AddressMode::kRegisterPointer ? 1 : 0,
+                buf, std::uint8_t(n)
+                ))
+            return this->error();
+
+        this->readDone(iFirst, n, buf);
+        return true;
+        }
+
+    // start reading registers first..last; pDoneFn is called when the
+    // image has been updated.
+    bool startRead(T first, T last, DoneFn *pDoneFn, void *pUserData)
+        {
+        if (! inRange(first) || ! inRange(last) || last < first || this->isBusy())
+            return false;
+
+        this->m_async.iFirst = std::uint8_t(index(first));
+        this->m_async.n = std::uint8_t(index(last) - index(first) + 1);
+        this->m_async.fRead = true;
+        this->m_async.fSuccess = true;
+        this->m_async.pDoneFn = pDoneFn;
+        this->m_async.pUserData = pUserData;
+        this->m_async.buf[0] = std::uint8_t(first);
+
+        ++this->m_stats.nReadTransactions;
+        if (! this->m_device.submit(
+                this->m_async.txn,
+                this->m_async.buf, this->m_addressMode == AddressMode::kRegisterPointer ? 1 : 0,
+                this->m_async.buf + 1, this->m_async.n,
+                asyncDone, this
+                ))
+            return this->error();
+
+        return true;
+        }
+
+    // write all dirty registers, one transaction per contiguous run.
+    // If a write fails, the registers stay dirty.
+    bool flush()
+        {
+        this->wait();
+
+        bool fResult = true;
+        unsigned i = 0;
+
+        while (this->nextRun(i))
+            {
+            unsigned iEnd = i;
+            while (iEnd < kNumRegs && (this->m_dirty & (std::uint32_t(1) << iEnd)))
+                ++iEnd;
+
+            if (! this->writeRun(i, iEnd - i))
+                fResult = false;
+
+            i = iEnd;
+            }
+
+        return fResult;
+        }
+
+    // start writing the dirty registers; pDoneFn is called when they've
+    // all been written, or one has failed. Registers put() while the
+    // write is in progress may still be dirty when pDoneFn is called.
+    bool startFlush(DoneFn *pDoneFn, void *pUserData)
+        {
+        if (this->isBusy())
+            return false;
+
+        this->m_async.fRead = false;
+        this->m_async.fSuccess = true;
+        this->m_async.pDoneFn = pDoneFn;
+        this->m_async.pUserData = pUserData;
+
+        unsigned i = 0;
+        if (! this->nextRun(i))
+            {
+            // nothing to do.
+            if (pDoneFn != nullptr)
+                pDoneFn(pUserData, true);
+            return true;
+            }
+
+        return this->startWriteRun(i);
+        }
+
+    // true while startRead() or startFlush() is in progress.
+    bool isBusy() const
+        {
+        return this->m_async.txn.isPending();
+        }
+
+    // finish startRead() or startFlush(), by running the bus queue up to
+    // and including our transactions. read() and flush() do this first.
+    void wait()
+        {
+        cI2cBus * const pBus = this->m_device.getBus();
+
+        while (this->isBusy() && pBus != nullptr)
+            pBus->poll();
+        }
+
+    // the device, for I2C statistics and attaching to a bus.
+    cI2cBus::cDevice &getDevice()
+        {
+        return this->m_device;
+        }
+
+    const cI2cBus::cDevice &getDevice() const
+        {
+        return this->m_device;
+        }
+
+    const Stats &getStats() const
+        {
+        return this->m_stats;
+        }
+
+    // the image, for bulk access.
+    const Image &getImage() const
+        {
+        return this->m_image;
+        }
+
+private:
+    static constexpr bool inRange(T reg)
+        {
+        return firstReg <= reg && reg <= lastReg;
+        }
+
+    static constexpr unsigned index(T reg)
+        {
+        return unsigned(reg) - unsigned(firstReg);
+        }
+
+    static constexpr std::uint32_t mask(T reg)
+        {
+        return std::uint32_t(1) << index(reg);
+        }
+
+    static std::uint32_t rangeMask(T first, T last)
+        {
+        if (! inRange(first) || ! inRange(last) || last < first)
+            return 0;
+
+        unsigned const n = index(last) - index(first) + 1;
+        std::uint32_t const bits = n >= 32 ? ~std::uint32_t(0) : (std::uint32_t(1) << n) - 1;
+        return bits << index(first);
+        }
+
+    bool error()
+        {
+        ++this->m_stats.nErrors;
+        return false;
+        }
+
+    static std::uint32_t runMask(unsigned iFirst, unsigned n)
+        {
+        return (n >= 32 ? ~std::uint32_t(0) : (std::uint32_t(1) << n) - 1) << iFirst;
+        }
+
+    // advance i to the next dirty register; false if there isn't one.
+    bool nextRun(unsigned &i) const
+        {
+        while (i < kNumRegs && ! (this->m_dirty & (std::uint32_t(1) << i)))
+            ++i;
+        return i < kNumRegs;
+        }
+
+    // copy a run into buf, with the register pointer if needed; returns
+    // the number of bytes to write.
+    std::uint8_t stageRun(std::uint8_t *buf, unsigned iFirst, unsigned n) const
+        {
+        std::uint8_t nWrite = 0;
+
+        if (this->m_addressMode == AddressMode::kRegisterPointer)
+            buf[nWrite++] = std::uint8_t(unsigned(firstReg) + iFirst);
+        for (unsigned i = 0; i < n; ++i)
+            buf[nWrite++] = this->m_image.getraw(iFirst + i);
+
+        return nWrite;
+        }
+
+    void readDone(unsigned iFirst, unsigned n, const std::uint8_t *buf)
+        {
+        for (unsigned i = 0; i < n; ++i)
+            this->m_image.putraw(iFirst + i, buf[i]);
+
+        std::uint32_t const bits = runMask(iFirst, n);
+        this->m_dirty &= ~bits;
+        this->m_valid |= bits & ~this->m_volatileMask;
+        }
+
+    // the run was written from buf; registers that were put() since
+    // then are still dirty.
+    void writeDone(unsigned iFirst, unsigned n, const std::uint8_t *buf)
+        {
+        for (unsigned i = 0; i < n; ++i)
+            {
+            if (this->m_image.getraw(iFirst + i) != buf[i])
+                continue;
+
+            std::uint32_t const bit = std::uint32_t(1) << (iFirst + i);
+            this->m_dirty &= ~bit;
+            this->m_valid |= bit & ~this->m_volatileMask;
+            }
+        }
+
+    bool writeRun(unsigned iFirst, unsigned n)
+        {
+        std::uint8_t buf[kNumRegs + 1];
+        std::uint8_t const nWrite = this->stageRun(buf, iFirst, n);
+
+        ++this->m_stats.nWriteTransactions;
+        if (! this->m_device.writeRead(buf, nWrite, nullptr, 0))
+            return this->error();
+
+        this->writeDone(iFirst, n, buf + nWrite - n);
+        return true;
+        }
+
+    bool startWriteRun(unsigned iFirst)
+        {
+        unsigned iEnd = iFirst;
+        while (iEnd < kNumRegs && (this->m_dirty & (std::uint32_t(1) << iEnd)))
+            ++iEnd;
+
+        this->m_async.iFirst = std::uint8_t(iFirst);
+        this->m_async.n = std::uint8_t(iEnd - iFirst);
+
+        std::uint8_t const nWrite = this->stageRun(this->m_async.buf, iFirst, this->m_async.n);
+
+        ++this->m_stats.nWriteTransactions;
+        if (! this->m_device.submit(
+                this->m_async.txn,
+                this->m_async.buf, nWrite,
+                nullptr, 0,
+                asyncDone, this
+                ))
+            return this->error();
+
+        return true;
+        }
+
+    static void asyncDone(void *pUserData, cI2cBus::Transaction *pTxn)
+        {
+        auto const pThis = static_cast<cRegisterCache *>(pUserData);
+        auto &async = pThis->m_async;
+        bool const fOk = pTxn->status == cI2cBus::Status::kDone;
+
+        if (! fOk)
+            {
+            pThis->error();
+            async.fSuccess = false;
+            }
+        else if (async.fRead)
+            {
+            pThis->readDone(async.iFirst, async.n, async.buf + 1);
+            }
+        else
+            {
+            pThis->writeDone(async.iFirst, async.n, async.buf + pTxn->nWrite - async.n);
+
+            // on to the next run, if any; the next run starts after this
+            // one, so a register that's still dirty here waits for the
+            // next flush.
+            unsigned i = async.iFirst + async.n;
+            if (pThis->nextRun(i))
+                {
+                if (pThis->startWriteRun(i))
+                    return;
+                async.fSuccess = false;
+                }
+            }
+
+        if (async.pDoneFn != nullptr)
+            async.pDoneFn(async.pUserData, async.fSuccess);
+        }
+
+    // state for startRead() and startFlush().
+    struct Async
+        {
+        cI2cBus::Transaction txn {};
+        DoneFn *pDoneFn = nullptr;
+        void *pUserData = nullptr;
+        std::uint8_t iFirst = 0;
+        std::uint8_t n = 0;
+        bool fRead = false;
+        bool fSuccess = false;
+        // register pointer, then data.
+        std::uint8_t buf[kNumRegs + 1];
+        };
+
+    cI2cBus::cDevice m_device;
+    AddressMode m_addressMode;
+    std::uint32_t m_volatileMask;
+    std::uint32_t m_dirty = 0;
+    std::uint32_t m_valid = 0;
+    Image m_image;
+    Stats m_stats {};
+    Async m_async;
+    };
+
+} // namespace McciCatena4430
+
+#endif // !defined(_Catena4430_cRegisterCache_h_)
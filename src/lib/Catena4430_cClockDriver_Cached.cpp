@@ -0,0 +1,156 @@
+/*
+
+Module: Catena4430_cClockDriver_Cached.cpp
+
+Function:
+    The Catena4430 library: implementation for the cached clock driver
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#include "../Catena4430_cClockDriver_Cached.h"
+#include <Arduino.h>
+
+using namespace McciCatena4430;
+using namespace McciCatena;
+
+bool cClockDriver_Cached::begin()
+    {
+    this->invalidate();
+    return this->m_pMaster->begin();
+    }
+
+void cClockDriver_Cached::end()
+    {
+    this->invalidate();
+    this->m_pMaster->end();
+    }
+
+bool cClockDriver_Cached::isInitialized()
+    {
+    return this->m_pMaster->isInitialized();
+    }
+
+void cClockDriver_Cached::setAnchor(std::int64_t tFirstMs, std::int64_t tLastMs, std::uint32_t nowMs)
+    {
+    this->m_anchorFirstMs = tFirstMs;
+    this->m_anchorSpanMs = std::uint32_t(tLastMs - tFirstMs);
+    this->m_anchorMs = nowMs;
+    this->m_fAnchorValid = true;
+    }
+
+bool cClockDriver_Cached::get(cDate &d, unsigned *pError)
+    {
+    std::uint16_t ms;
+
+    return this->getWithMs(d, ms, pError);
+    }
+
+bool cClockDriver_Cached::getWithMs(cDate &d, std::uint16_t &ms, unsigned *pError)
+    {
+    std::uint32_t const nowMs = millis();
+
+    ++this->m_stats.nGets;
+
+    if (this->m_fAnchorValid && nowMs - this->m_anchorMs < this->m_resyncMs)
+        ++this->m_stats.nCacheHits;
+    else if (! this->resync(nowMs, pError))
+        return false;
+
+    std::int64_t const tMs = this->m_anchorFirstMs + this->m_anchorSpanMs / 2 +
+                             std::uint32_t(nowMs - this->m_anchorMs);
+
+    ms = std::uint16_t(tMs % 1000);
+    return d.setCommonTime(cDate::CommonTime_t(tMs / 1000));
+    }
+
+bool cClockDriver_Cached::resync(std::uint32_t nowMs, unsigned *pError)
+    {
+    cDate masterDate;
+
+    ++this->m_stats.nMasterReads;
+    if (! this->m_pMaster->get(masterDate, pError))
+        {
+        this->invalidate();
+        return false;
+        }
+
+    // the master's time is somewhere in this second.
+    std::int64_t const tFirstMs = std::int64_t(masterDate.getCommonTime()) * 1000;
+    std::int64_t const tLastMs = tFirstMs + 999;
+
+    if (! this->m_fAnchorValid)
+        {
+        this->setAnchor(tFirstMs, tLastMs, nowMs);
+        this->m_stats.windowMs = this->m_anchorSpanMs + 1;
+        return true;
+        }
+
+    // where the window is now, widened for drift.
+    std::uint32_t const elapsedMs = nowMs - this->m_anchorMs;
+    std::uint32_t const allowanceMs = std::uint32_t(
+        std::uint64_t(elapsedMs) * kDriftAllowancePpm / 1000000 + 1
+        );
+    std::int64_t const tOldMs = this->m_anchorFirstMs + elapsedMs;
+    std::int64_t const tOldMidMs = tOldMs + this->m_anchorSpanMs / 2;
+    std::int64_t tNewFirstMs = tOldMs - allowanceMs;
+    std::int64_t tNewLastMs = tOldMs + this->m_anchorSpanMs + allowanceMs;
+
+    // keep the part that's in the master's second.
+    if (tNewFirstMs < tFirstMs)
+        tNewFirstMs = tFirstMs;
+    if (tNewLastMs > tLastMs)
+        tNewLastMs = tLastMs;
+
+    if (tNewFirstMs > tNewLastMs)
+        {
+        // no overlap: millis() has drifted more than allowed.
+        ++this->m_stats.nDrift;
+        tNewFirstMs = tFirstMs;
+        tNewLastMs = tLastMs;
+        this->m_resyncMs /= 2;
+        if (this->m_resyncMs < kResyncMinMs)
+            this->m_resyncMs = kResyncMinMs;
+        }
+    else if (this->m_resyncMs < this->m_resyncMaxMs)
+        {
+        this->m_resyncMs *= 2;
+        if (this->m_resyncMs > this->m_resyncMaxMs)
+            this->m_resyncMs = this->m_resyncMaxMs;
+        }
+
+    this->setAnchor(tNewFirstMs, tNewLastMs, nowMs);
+
+    // how far the answer moved.
+    std::int32_t const error = std::int32_t(
+        tNewFirstMs + this->m_anchorSpanMs / 2 - tOldMidMs
+        );
+    std::uint32_t const absError = error < 0 ? std::uint32_t(-error) : std::uint32_t(error);
+
+    this->m_stats.lastErrorMs = error;
+    if (absError > this->m_stats.maxErrorMs)
+        this->m_stats.maxErrorMs = absError;
+    this->m_stats.windowMs = this->m_anchorSpanMs + 1;
+    return true;
+    }
+
+bool cClockDriver_Cached::set(const cDate &d, unsigned *pError)
+    {
+    std::uint32_t const nowMs = millis();
+
+    if (! this->m_pMaster->set(d, pError))
+        {
+        this->invalidate();
+        return false;
+        }
+
+    // we set the master to the start of the second, so the window is tight.
+    std::int64_t const tMs = std::int64_t(d.getCommonTime()) * 1000;
+    this->setAnchor(tMs, tMs, nowMs);
+    return true;
+    }
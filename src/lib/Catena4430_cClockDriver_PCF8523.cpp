@@ -1,9 +1,9 @@
 /*
 
-Module: Catena4430_cPCA9570.cpp
+Module: Catena4430_cClockDriver_PCF8523.cpp
 
 Function:
-    The Catena4430 library: implementation for the PCA9570 I2C output buffer
+    The Catena4430 library: implementation for the PCF8523 RTC
 
 Copyright:
     See accompanying LICENSE file for copyright and license information.
@@ -33,6 +33,7 @@ static constexpr uint8_t bin2bcd(uint8_t val)
 bool cClockDriver_PCF8523::begin()
     {
     this->m_wire->begin();
+    return true;
     }
 
 void cClockDriver_PCF8523::end()
@@ -62,23 +63,13 @@ bool cClockDriver_PCF8523::checkInitialized(kRegControl_1 rControl_1, kRegContro
 
 bool cClockDriver_PCF8523::isInitialized()
     {
-    bool fStatus;
-
-    this->m_wire->beginTransmission(this->m_i2caddr);
-    this->m_wire->write(std::uint8_t(kReg::Control_1));
-    fStatus = this->m_wire->endTransmission() == 0;
-
-    if (! fStatus)
+    if (! this->m_regs.read(kReg::Control_1, kReg::Control_3))
         return false;
 
-    if (this->m_wire->requestFrom(this->m_i2caddr, std::uint8_t(3)) != 3)
-        return false;
-
-    // get the byte and check the status.
-    kRegControl_1 rControl_1 = kRegControl_1(this->m_wire->read());
-    (void) this->m_wire->read();
-    kRegControl_3 rControl_3 = kRegControl_3(this->m_wire->read());
-    return checkInitialized(rControl_1, rControl_3);
+    return checkInitialized(
+            this->m_regs.get<kRegControl_1>(kReg::Control_1),
+            this->m_regs.get<kRegControl_3>(kReg::Control_3)
+            );
     }
 
 bool cClockDriver_PCF8523::get(McciCatena::cDate &d, unsigned *pError)
@@ -89,20 +80,23 @@ bool cClockDriver_PCF8523::get(McciCatena::cDate &d, unsigned *pError)
 
     auto seterror = [pError](unsigned ecode) ->bool { *pError = ecode; return false; };
 
-    this->m_wire->beginTransmission(this->m_i2caddr);
-    this->m_wire->write(std::uint8_t(kReg::Control_1));
-    bool fStatus = this->m_wire->endTransmission() == 0;
+    // one transaction for the control and time registers.
+    if (! this->m_regs.read(kReg::Control_1, kReg::Years))
+        return seterror(2);
 
-    if (! fStatus)
-        return seterror(1);
+    return this->getResult(d, pError);
+    }
 
-    RegisterImage<kReg, kReg::Control_1, kReg::Years> regs;
+// decode the time registers, as read by get() or startGet().
+bool cClockDriver_PCF8523::getResult(McciCatena::cDate &d, unsigned *pError)
+    {
+    unsigned nonceError;
+    if (pError == nullptr)
+        pError = &nonceError;
 
-    if (this->m_wire->requestFrom(this->m_i2caddr, regs.length()) != regs.length())
-        return seterror(2);
+    auto seterror = [pError](unsigned ecode) ->bool { *pError = ecode; return false; };
 
-    for (unsigned i = 0; i < regs.length(); ++i)
-        regs.putraw(i, this->m_wire->read());
+    auto &regs = this->m_regs;
 
     if (! checkInitialized(
             regs.get<kRegControl_1>(kReg::Control_1),
@@ -147,63 +141,326 @@ bool cClockDriver_PCF8523::set(const McciCatena::cDate &d, unsigned *pError)
     if (! (2000 <= d.year() && d.year() <= 2099))
         return seterror(2);
 
-    // make sure 24-hour mode is selected
-    RegisterImage<kReg, kReg::Control_1, kReg::Control_3> ctrlregs;
-    this->m_wire->beginTransmission(this->m_i2caddr);
-    this->m_wire->write(std::uint8_t(kReg::Control_1));
-    bool fStatus = this->m_wire->endTransmission() == 0;
-    if (! fStatus)
-        return seterror(3);
+    auto &regs = this->m_regs;
 
-    if (this->m_wire->requestFrom(this->m_i2caddr, ctrlregs.length()) != ctrlregs.length())
+    // make sure 24-hour mode is selected
+    if (! regs.read(kReg::Control_1, kReg::Control_3))
         return seterror(4);
 
-    for (unsigned i = 0; i < ctrlregs.length(); ++i)
-        ctrlregs.putraw(i, this->m_wire->read());
-
-    kRegControl_1 rControl_1 = ctrlregs.get<kRegControl_1>(kReg::Control_1);
+    kRegControl_1 rControl_1 = regs.get<kRegControl_1>(kReg::Control_1);
     if (getField<bool, kRegControl_1>(rControl_1, kRegControl_1::k12_24))
         {
         // reset the bit and write it back
-        ctrlregs.put<kRegControl_1>(kReg::Control_1, setField<kRegControl_1, unsigned>(rControl_1, kRegControl_1::k12_24, 0u));
-        this->m_wire->beginTransmission(this->m_i2caddr);
-        this->m_wire->write(std::uint8_t(kReg::Control_1));
-        this->m_wire->write(ctrlregs.get(kReg::Control_1));
-        fStatus = this->m_wire->endTransmission() == 0;
-
-        if (! fStatus)
+        regs.put<kRegControl_1>(kReg::Control_1, setField<kRegControl_1, unsigned>(rControl_1, kRegControl_1::k12_24, 0u));
+        if (! regs.flush())
             return seterror(5);
         }
 
-    // now, write the values.
-    RegisterImage<kReg, kReg::Seconds, kReg::Years> regs;
+    // now, write the values; they're contiguous, so this is one transaction.
     regs.put(kReg::Years, bin2bcd(d.year() - 2000));
     regs.put<kRegMonths>(kReg::Months, setField<kRegMonths, std::uint8_t>(kRegMonths(0), kRegMonths::MONTHS, bin2bcd(d.month())));
+    regs.put(kReg::Weekdays, 0);
     regs.put<kRegDays>(kReg::Days, setField<kRegDays, std::uint8_t>(kRegDays(0), kRegDays::DAYS, bin2bcd(d.day())));
     regs.put<kRegHours>(kReg::Hours, setField<kRegHours, std::uint8_t>(kRegHours(0), kRegHours::HOURS24, bin2bcd(d.hour())));
     regs.put<kRegMinutes>(kReg::Minutes, setField<kRegMinutes, std::uint8_t>(kRegMinutes(0), kRegMinutes::MINUTES, bin2bcd(d.minute())));
     regs.put<kRegSeconds>(kReg::Seconds, setField<kRegSeconds, std::uint8_t>(kRegSeconds(0), kRegSeconds::SECONDS, bin2bcd(d.second())));
 
-    this->m_wire->beginTransmission(this->m_i2caddr);
-    this->m_wire->write(std::uint8_t(kReg::Seconds));
-    for (unsigned i = 0; i < regs.length(); ++i)
-        this->m_wire->write(regs.getraw(i));
-    fStatus = this->m_wire->endTransmission() == 0;
-
-    if (! fStatus)
+    if (! regs.flush())
         return seterror(6);
 
     // finally, make sure the battery mode is set.
-    if (getField<kRegControl_3_PM, kRegControl_3>(ctrlregs.get<kRegControl_3>(kReg::Control_3), kRegControl_3::PM) ==
+    if (getField<kRegControl_3_PM, kRegControl_3>(regs.get<kRegControl_3>(kReg::Control_3), kRegControl_3::PM) ==
         kRegControl_3_PM::NoSwitchNoLowBattDetect)
         {
-        this->m_wire->beginTransmission(this->m_i2caddr);
-        this->m_wire->write(std::uint8_t(kReg::Control_3));
-        this->m_wire->write(0);
-        fStatus = this->m_wire->endTransmission() == 0;
-        if (! fStatus)
+        regs.put(kReg::Control_3, 0);
+        if (! regs.flush())
             return seterror(7);
         }
 
     return true;
     }
+
+// read a register unless the cache already has it.
+bool cClockDriver_PCF8523::readIfNeeded(kReg reg)
+    {
+    return this->m_regs.isValid(reg) || this->m_regs.read(reg, reg);
+    }
+
+// The flags in Control_2 are cleared by writing 0, and left alone by
+// writing 1; so when writing Control_2, all flags that we don't mean to
+// clear are written as 1.
+static constexpr std::uint8_t kControl_2_Flags =
+    std::uint8_t(cClockDriver_PCF8523::kRegControl_2::WTAF) |
+    std::uint8_t(cClockDriver_PCF8523::kRegControl_2::CTAF) |
+    std::uint8_t(cClockDriver_PCF8523::kRegControl_2::CTBF) |
+    std::uint8_t(cClockDriver_PCF8523::kRegControl_2::SF) |
+    std::uint8_t(cClockDriver_PCF8523::kRegControl_2::AF);
+
+bool cClockDriver_PCF8523::setInterruptEnables(
+    kRegControl_1 setControl_1,
+    kRegControl_1 clearControl_1,
+    kRegControl_2 setControl_2,
+    kRegControl_2 clearControl_2
+    )
+    {
+    auto &regs = this->m_regs;
+
+    // Control_2 always has to be read; Control_1 comes along for free.
+    if (! regs.read(kReg::Control_1, kReg::Control_2))
+        return false;
+
+    regs.put(
+        kReg::Control_1,
+        (regs.get(kReg::Control_1) & ~std::uint8_t(clearControl_1)) | std::uint8_t(setControl_1)
+        );
+    regs.put(
+        kReg::Control_2,
+        ((regs.get(kReg::Control_2) | kControl_2_Flags) & ~std::uint8_t(clearControl_2)) | std::uint8_t(setControl_2)
+        );
+
+    return regs.flush();
+    }
+
+bool cClockDriver_PCF8523::disableClkout()
+    {
+    if (! this->readIfNeeded(kReg::Tmr_CLKOUT_ctrl))
+        return false;
+
+    this->m_regs.put<kRegTmr_CLKOUT_ctrl>(
+        kReg::Tmr_CLKOUT_ctrl,
+        setField<kRegTmr_CLKOUT_ctrl, std::uint8_t>(
+            this->m_regs.get<kRegTmr_CLKOUT_ctrl>(kReg::Tmr_CLKOUT_ctrl), kRegTmr_CLKOUT_ctrl::COF, kCofDisabled
+            )
+        );
+
+    // no I2C traffic if CLKOUT was already off.
+    return this->m_regs.flush();
+    }
+
+bool cClockDriver_PCF8523::startCountdown(std::uint32_t seconds, unsigned *pError)
+    {
+    unsigned nonceError;
+    if (pError == nullptr)
+        pError = &nonceError;
+
+    auto seterror = [pError](unsigned ecode) ->bool { *pError = ecode; return false; };
+
+    kRegTmr_freq_ctrl_TQ source;
+    std::uint32_t count;
+
+    if (seconds == 0)
+        return seterror(1);
+    else if (seconds <= 255)
+        {
+        source = kRegTmr_freq_ctrl_TQ::Hz1;
+        count = seconds;
+        }
+    else if (seconds < 256 * 60)
+        {
+        source = kRegTmr_freq_ctrl_TQ::PerMinute;
+        count = seconds / 60;
+        }
+    else
+        {
+        source = kRegTmr_freq_ctrl_TQ::PerHour;
+        count = seconds / 3600;
+        if (count > 255)
+            count = 255;
+        }
+
+    auto &regs = this->m_regs;
+
+    if (! this->readIfNeeded(kReg::Tmr_CLKOUT_ctrl))
+        return seterror(2);
+
+    // stop timer A, so the new value is loaded when it's restarted.
+    kRegTmr_CLKOUT_ctrl rNew = setField<kRegTmr_CLKOUT_ctrl, kRegTmr_CLKOUT_ctrl_TAC>(
+        regs.get<kRegTmr_CLKOUT_ctrl>(kReg::Tmr_CLKOUT_ctrl), kRegTmr_CLKOUT_ctrl::TAC, kRegTmr_CLKOUT_ctrl_TAC::Disabled
+        );
+    rNew = setField<kRegTmr_CLKOUT_ctrl, std::uint8_t>(rNew, kRegTmr_CLKOUT_ctrl::COF, kCofDisabled);
+    // permanent (level) interrupt, not a pulse, so a sleeping MCU can't miss it.
+    rNew = setField<kRegTmr_CLKOUT_ctrl, std::uint8_t>(rNew, kRegTmr_CLKOUT_ctrl::TAM, 0);
+    regs.put(kReg::Tmr_CLKOUT_ctrl, rNew);
+    if (! regs.flush())
+        return seterror(3);
+
+    regs.put(kReg::Tmr_A_freq_ctrl, source);
+    regs.put(kReg::Tmr_A_reg, count);
+    if (! regs.flush())
+        return seterror(4);
+
+    // clear any stale flag and enable the interrupt.
+    if (! this->setInterruptEnables(
+            kRegControl_1(0), kRegControl_1(0),
+            kRegControl_2::CTAIE, kRegControl_2::CTAF
+            ))
+        return seterror(5);
+
+    rNew = setField<kRegTmr_CLKOUT_ctrl, kRegTmr_CLKOUT_ctrl_TAC>(
+        rNew, kRegTmr_CLKOUT_ctrl::TAC, kRegTmr_CLKOUT_ctrl_TAC::Countdown
+        );
+    regs.put(kReg::Tmr_CLKOUT_ctrl, rNew);
+    if (! regs.flush())
+        return seterror(6);
+
+    return true;
+    }
+
+bool cClockDriver_PCF8523::stopCountdown(unsigned *pError)
+    {
+    unsigned nonceError;
+    if (pError == nullptr)
+        pError = &nonceError;
+
+    auto seterror = [pError](unsigned ecode) ->bool { *pError = ecode; return false; };
+
+    auto &regs = this->m_regs;
+
+    if (! this->readIfNeeded(kReg::Tmr_CLKOUT_ctrl))
+        return seterror(1);
+
+    regs.put(
+        kReg::Tmr_CLKOUT_ctrl,
+        setField<kRegTmr_CLKOUT_ctrl, kRegTmr_CLKOUT_ctrl_TAC>(
+            regs.get<kRegTmr_CLKOUT_ctrl>(kReg::Tmr_CLKOUT_ctrl), kRegTmr_CLKOUT_ctrl::TAC, kRegTmr_CLKOUT_ctrl_TAC::Disabled
+            )
+        );
+    if (! regs.flush())
+        return seterror(2);
+
+    if (! this->setInterruptEnables(
+            kRegControl_1(0), kRegControl_1(0),
+            kRegControl_2(0), kRegControl_2(std::uint8_t(kRegControl_2::CTAIE) | std::uint8_t(kRegControl_2::CTAF))
+            ))
+        return seterror(3);
+
+    return true;
+    }
+
+bool cClockDriver_PCF8523::setMinuteAlarm(std::uint8_t minute, unsigned *pError)
+    {
+    unsigned nonceError;
+    if (pError == nullptr)
+        pError = &nonceError;
+
+    auto seterror = [pError](unsigned ecode) ->bool { *pError = ecode; return false; };
+
+    if (minute > 59)
+        return seterror(1);
+
+    auto &regs = this->m_regs;
+
+    // match on minutes only; AEN is active low.
+    regs.put(kReg::Minute_alarm, bin2bcd(minute));
+    regs.put(kReg::Hour_alarm, kRegAlarm::AEN);
+    regs.put(kReg::Day_alarm, kRegAlarm::AEN);
+    regs.put(kReg::Weekday_alarm, kRegAlarm::AEN);
+
+    if (! regs.flush())
+        return seterror(2);
+
+    if (! this->disableClkout())
+        return seterror(3);
+
+    if (! this->setInterruptEnables(
+            kRegControl_1::AIE, kRegControl_1(0),
+            kRegControl_2(0), kRegControl_2::AF
+            ))
+        return seterror(4);
+
+    return true;
+    }
+
+bool cClockDriver_PCF8523::clearMinuteAlarm(unsigned *pError)
+    {
+    unsigned nonceError;
+    if (pError == nullptr)
+        pError = &nonceError;
+
+    auto seterror = [pError](unsigned ecode) ->bool { *pError = ecode; return false; };
+
+    auto &regs = this->m_regs;
+
+    regs.put(kReg::Minute_alarm, kRegAlarm::AEN);
+    regs.put(kReg::Hour_alarm, kRegAlarm::AEN);
+    regs.put(kReg::Day_alarm, kRegAlarm::AEN);
+    regs.put(kReg::Weekday_alarm, kRegAlarm::AEN);
+
+    if (! regs.flush())
+        return seterror(1);
+
+    if (! this->setInterruptEnables(
+            kRegControl_1(0), kRegControl_1::AIE,
+            kRegControl_2(0), kRegControl_2::AF
+            ))
+        return seterror(2);
+
+    return true;
+    }
+
+bool cClockDriver_PCF8523::getAndClearFlags(kRegControl_2 &flags, unsigned *pError)
+    {
+    unsigned nonceError;
+    if (pError == nullptr)
+        pError = &nonceError;
+
+    auto seterror = [pError](unsigned ecode) ->bool { *pError = ecode; return false; };
+
+    auto &regs = this->m_regs;
+
+    if (! regs.read(kReg::Control_2, kReg::Control_2))
+        return seterror(1);
+
+    std::uint8_t const r = regs.get(kReg::Control_2);
+    flags = kRegControl_2(r);
+
+    std::uint8_t const clear =
+        r & (std::uint8_t(kRegControl_2::CTAF) |
+             std::uint8_t(kRegControl_2::CTBF) |
+             std::uint8_t(kRegControl_2::AF));
+
+    if (clear == 0)
+        return true;
+
+    // only clear the flags we saw, so one that sets in the meantime isn't lost.
+    regs.put(kReg::Control_2, (r | kControl_2_Flags) & ~clear);
+    if (! regs.flush())
+        return seterror(2);
+
+    return true;
+    }
+
+bool cClockDriver_PCF8523::getOffset(std::int8_t &offset, unsigned *pError)
+    {
+    unsigned nonceError;
+    if (pError == nullptr)
+        pError = &nonceError;
+
+    auto seterror = [pError](unsigned ecode) ->bool { *pError = ecode; return false; };
+
+    if (! this->readIfNeeded(kReg::Offset))
+        return seterror(1);
+
+    // sign-extend the 7-bit field.
+    std::uint8_t const v = getField<std::uint8_t, kRegOffset>(this->m_regs.get<kRegOffset>(kReg::Offset), kRegOffset::OFFSET);
+    offset = std::int8_t(v & 0x40 ? v | 0x80 : v);
+    return true;
+    }
+
+bool cClockDriver_PCF8523::setOffset(std::int8_t offset, unsigned *pError)
+    {
+    unsigned nonceError;
+    if (pError == nullptr)
+        pError = &nonceError;
+
+    auto seterror = [pError](unsigned ecode) ->bool { *pError = ecode; return false; };
+
+    if (offset < kOffsetMin || offset > kOffsetMax)
+        return seterror(1);
+
+    this->m_regs.put(kReg::Offset, std::uint8_t(offset) & std::uint8_t(kRegOffset::OFFSET));
+    if (! this->m_regs.flush())
+        return seterror(2);
+
+    return true;
+    }
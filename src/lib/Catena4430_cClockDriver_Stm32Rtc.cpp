@@ -0,0 +1,246 @@
+/*
+
+Module: Catena4430_cClockDriver_Stm32Rtc.cpp
+
+Function:
+    The Catena4430 library: implementation for the STM32L0 RTC clock driver
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#include "../Catena4430_cClockDriver_Stm32Rtc.h"
+
+#if defined(ARDUINO_ARCH_STM32)
+
+#include <Arduino.h>
+
+using namespace McciCatena4430;
+using namespace McciCatena;
+
+// the RTC register fields, which are BCD; the tens digit is always in
+// the four bits above the units digit.
+namespace {
+
+constexpr std::uint32_t kTR_SU = 0;         // seconds, [6:0]
+constexpr std::uint32_t kTR_MNU = 8;        // minutes, [14:8]
+constexpr std::uint32_t kTR_HU = 16;        // hours, [21:16]
+constexpr std::uint32_t kDR_DU = 0;         // day, [5:0]
+constexpr std::uint32_t kDR_MU = 8;         // month, [12:8]
+constexpr std::uint32_t kDR_YU = 16;        // year, [23:16]
+
+// how long to wait for RSF; it takes two RTCCLK cycles.
+constexpr std::uint32_t kRtcWaitMs = 10;
+
+// longest wait for the master's second to tick over.
+constexpr std::uint32_t kMasterEdgeWaitMs = 1100;
+
+std::uint32_t field(std::uint32_t reg, std::uint32_t shift, std::uint32_t tensMask)
+    {
+    return ((reg >> (shift + 4)) & tensMask) * 10 + ((reg >> shift) & 0xF);
+    }
+
+bool waitIsr(std::uint32_t mask)
+    {
+    std::uint32_t const tStart = millis();
+
+    while ((RTC->ISR & mask) == 0)
+        {
+        if (millis() - tStart > kRtcWaitMs)
+            return false;
+        }
+    return true;
+    }
+
+// ISR is mostly flags that are cleared by writing 0, so it's written
+// directly (writing 1 leaves a flag alone) rather than read-modify-write,
+// which could lose an alarm flag that the platform is waiting for. INIT
+// is written as 0, so the calendar keeps running.
+void unlockRtc()
+    {
+    PWR->CR |= PWR_CR_DBP;
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+    }
+
+void lockRtc()
+    {
+    RTC->WPR = 0xFF;
+    }
+
+// clear RSF and wait for the shadow registers to be reloaded.
+bool syncShadow()
+    {
+    unlockRtc();
+    RTC->ISR = ~(RTC_ISR_RSF | RTC_ISR_INIT);
+    lockRtc();
+    return waitIsr(RTC_ISR_RSF);
+    }
+
+} // namespace
+
+bool cClockDriver_Stm32Rtc::begin()
+    {
+    this->m_fNeedShadowSync = true;
+
+    // the platform starts the RTC; we can't do anything if it didn't.
+    if ((RCC->CSR & RCC_CSR_RTCEN) == 0)
+        return false;
+
+    if (this->m_pMaster != nullptr)
+        {
+        this->m_pMaster->begin();
+        (void) this->syncFromMaster();
+        }
+
+    return true;
+    }
+
+void cClockDriver_Stm32Rtc::end()
+    {
+    if (this->m_pMaster != nullptr)
+        this->m_pMaster->end();
+    }
+
+bool cClockDriver_Stm32Rtc::isInitialized()
+    {
+    return this->m_fSet;
+    }
+
+bool cClockDriver_Stm32Rtc::get(cDate &d, unsigned *pError)
+    {
+    std::uint16_t ms;
+
+    return this->getWithMs(d, ms, pError);
+    }
+
+bool cClockDriver_Stm32Rtc::getWithMs(cDate &d, std::uint16_t &ms, unsigned *pError)
+    {
+    unsigned nonceError;
+    if (pError == nullptr)
+        pError = &nonceError;
+
+    auto seterror = [pError](unsigned ecode) ->bool { *pError = ecode; return false; };
+
+    if (! this->m_fSet)
+        return seterror(kErrNotSet);
+
+    std::int64_t tRtcMs;
+    if (! this->readRtc(tRtcMs, pError))
+        return false;
+
+    std::int64_t const tMs = tRtcMs + this->m_offsetMs;
+
+    d.setCommonTime(cDate::CommonTime_t(tMs / 1000));
+    ms = std::uint16_t(tMs % 1000);
+    ++this->m_stats.nGets;
+    return true;
+    }
+
+bool cClockDriver_Stm32Rtc::readRtc(std::int64_t &tMs, unsigned *pError)
+    {
+    auto seterror = [pError](unsigned ecode) ->bool { *pError = ecode; return false; };
+
+    if ((RCC->CSR & RCC_CSR_RTCEN) == 0)
+        return seterror(kErrNoRtc);
+
+    if (this->m_fNeedShadowSync)
+        {
+        if (! syncShadow())
+            return seterror(kErrSyncTimeout);
+        this->m_fNeedShadowSync = false;
+        }
+
+    // reading SSR locks TR and DR until DR is read, so the set is
+    // consistent. SSR counts down from PREDIV_S to 0 during each second.
+    std::uint32_t const ssr = RTC->SSR & 0xFFFF;
+    std::uint32_t const tr = RTC->TR;
+    std::uint32_t const dr = RTC->DR;
+    std::uint32_t const prediv_s = RTC->PRER & 0x7FFF;
+
+    cDate::Year_t const y = 2000 + field(dr, kDR_YU, 0xF);
+    cDate::Month_t const mon = field(dr, kDR_MU, 0x1);
+    cDate::Day_t const day = field(dr, kDR_DU, 0x3);
+    cDate::Hour_t const h = field(tr, kTR_HU, 0x3);
+    cDate::Minute_t const min = field(tr, kTR_MNU, 0x7);
+    cDate::Second_t const s = field(tr, kTR_SU, 0x7);
+
+    if (! (cDate::isValidYearMonthDay(y, mon, day) && cDate::isValidHourMinuteSecond(h, min, s)))
+        return seterror(kErrBadRegisters);
+
+    cDate dRtc;
+    dRtc.setDate(y, mon, day);
+    dRtc.setTime(h, min, s);
+
+    // SSR can briefly exceed PREDIV_S after a shift; call that zero.
+    std::uint32_t const ms = ssr > prediv_s ? 0 : (prediv_s - ssr) * 1000 / (prediv_s + 1);
+
+    tMs = std::int64_t(dRtc.getCommonTime()) * 1000 + ms;
+    return true;
+    }
+
+bool cClockDriver_Stm32Rtc::setRtc(const cDate &d, unsigned *pError)
+    {
+    unsigned nonceError;
+    if (pError == nullptr)
+        pError = &nonceError;
+
+    auto seterror = [pError](unsigned ecode) ->bool { *pError = ecode; return false; };
+
+    if (! d.isValid())
+        return seterror(kErrInvalidDate);
+
+    // the calendar belongs to the platform, so we don't write it; we
+    // just note how far it is from the time we were given.
+    std::int64_t tRtcMs;
+    if (! this->readRtc(tRtcMs, pError))
+        return false;
+
+    this->m_offsetMs = std::int64_t(d.getCommonTime()) * 1000 - tRtcMs;
+    this->m_fSet = true;
+    return true;
+    }
+
+bool cClockDriver_Stm32Rtc::set(const cDate &d, unsigned *pError)
+    {
+    if (! this->setRtc(d, pError))
+        return false;
+
+    ++this->m_stats.nSets;
+
+    // the master is the copy that survives loss of power.
+    if (this->m_pMaster != nullptr)
+        return this->m_pMaster->set(d, pError);
+
+    return true;
+    }
+
+bool cClockDriver_Stm32Rtc::syncFromMaster(unsigned *pError)
+    {
+    cDate dStart;
+    cDate d;
+
+    if (this->m_pMaster == nullptr || ! this->m_pMaster->get(dStart, pError))
+        return false;
+
+    // the master only reports whole seconds; wait for it to tick so the
+    // RTC starts its second at the same moment.
+    std::uint32_t const tStart = millis();
+    do  {
+        if (! this->m_pMaster->get(d, pError))
+            return false;
+        } while (d.getCommonTime() == dStart.getCommonTime() &&
+                 millis() - tStart < kMasterEdgeWaitMs);
+
+    if (! this->setRtc(d, pError))
+        return false;
+
+    ++this->m_stats.nMasterSyncs;
+    return true;
+    }
+
+#endif // defined(ARDUINO_ARCH_STM32)
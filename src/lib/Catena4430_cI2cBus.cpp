@@ -0,0 +1,227 @@
+/*
+
+Module: Catena4430_cI2cBus.cpp
+
+Function:
+    The Catena4430 library: implementation for the I2C transaction manager
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#include "../Catena4430_cI2cBus.h"
+
+#include <Arduino.h>
+#include <CatenaBase.h>
+
+using namespace McciCatena4430;
+using namespace McciCatena;
+
+/****************************************************************************\
+|
+|   The bus
+|
+\****************************************************************************/
+
+bool cI2cBus::begin(McciCatena::CatenaBase &rCatena)
+    {
+    // set up for polling.
+    if (! this->m_fRegistered)
+        {
+        this->m_fRegistered = true;
+        rCatena.registerObject(this);
+        }
+
+    return true;
+    }
+
+void cI2cBus::end()
+    {
+    while (this->isBusy())
+        this->poll();
+    }
+
+void cI2cBus::poll() /* override */
+    {
+    Transaction * const pTxn = this->m_pHead;
+
+    if (pTxn == nullptr)
+        return;
+
+    // unlink first; the callback may submit more.
+    this->m_pHead = pTxn->pNext;
+    if (this->m_pHead == nullptr)
+        this->m_pTail = nullptr;
+    --this->m_queueDepth;
+
+    (void) this->execute(pTxn);
+    }
+
+bool cI2cBus::submit(Transaction *pTxn)
+    {
+    if (pTxn == nullptr || pTxn->pDevice == nullptr || pTxn->isPending())
+        return false;
+
+    pTxn->status = Status::kQueued;
+    pTxn->pNext = nullptr;
+
+    if (this->m_pTail == nullptr)
+        this->m_pHead = pTxn;
+    else
+        this->m_pTail->pNext = pTxn;
+    this->m_pTail = pTxn;
+
+    ++this->m_stats.nSubmitted;
+    if (++this->m_queueDepth > this->m_stats.maxQueueDepth)
+        this->m_stats.maxQueueDepth = this->m_queueDepth;
+
+    return true;
+    }
+
+bool cI2cBus::execute(Transaction *pTxn)
+    {
+    std::uint32_t hz = pTxn->pDevice->m_maxClockHz;
+
+    if (hz > this->m_maxClockHz)
+        hz = this->m_maxClockHz;
+
+    this->setClock(hz);
+
+    std::uint32_t const tStart = micros();
+    Status const status = transfer(this->m_wire, pTxn);
+    std::uint32_t const tUs = micros() - tStart;
+
+    this->setClock(kDefaultClockHz);
+
+    complete(pTxn, status, tUs);
+    return status == Status::kDone;
+    }
+
+void cI2cBus::setClock(std::uint32_t hz)
+    {
+    // the clock is kDefaultClockHz except during a transaction, so we
+    // only have to change it around devices that differ.
+    if (hz == kDefaultClockHz && this->m_fFastClock == false)
+        return;
+
+    this->m_wire->setClock(hz);
+    this->m_fFastClock = (hz != kDefaultClockHz);
+    ++this->m_stats.nClockChanges;
+    }
+
+cI2cBus::Status cI2cBus::transfer(TwoWire *pWire, Transaction *pTxn)
+    {
+    std::uint8_t const i2caddr = pTxn->pDevice->m_i2caddr;
+
+    // a transaction with nothing to read is a write, even if it's empty
+    // (that's a probe).
+    if (pTxn->nWrite != 0 || pTxn->nRead == 0)
+        {
+        pWire->beginTransmission(i2caddr);
+        if (pTxn->nWrite != 0)
+            pWire->write(pTxn->pWrite, pTxn->nWrite);
+
+        // 2 is address NACK, 3 is data NACK.
+        auto const error = pWire->endTransmission();
+        if (error == 2 || error == 3)
+            return Status::kNack;
+        else if (error != 0)
+            return Status::kError;
+        }
+
+    if (pTxn->nRead != 0)
+        {
+        auto const nRead = pWire->requestFrom(i2caddr, pTxn->nRead);
+
+        // Wire reports an address NACK as zero bytes read.
+        if (nRead == 0)
+            return Status::kNack;
+        else if (nRead != pTxn->nRead)
+            return Status::kError;
+
+        for (unsigned i = 0; i < nRead; ++i)
+            pTxn->pRead[i] = pWire->read();
+        }
+
+    return Status::kDone;
+    }
+
+void cI2cBus::complete(Transaction *pTxn, Status status, std::uint32_t tUs)
+    {
+    auto &stats = pTxn->pDevice->m_stats;
+
+    ++stats.nTransactions;
+    stats.busTimeUs += tUs;
+    if (status == Status::kDone)
+        stats.nBytes += pTxn->nWrite + pTxn->nRead;
+    else if (status == Status::kNack)
+        ++stats.nNacks;
+    else
+        ++stats.nErrors;
+
+    pTxn->status = status;
+    if (pTxn->pDoneFn != nullptr)
+        pTxn->pDoneFn(pTxn->pUserData, pTxn);
+    }
+
+/****************************************************************************\
+|
+|   The devices
+|
+\****************************************************************************/
+
+bool cI2cBus::cDevice::writeRead(
+    const std::uint8_t *pWrite, std::uint8_t nWrite,
+    std::uint8_t *pRead, std::uint8_t nRead
+    )
+    {
+    Transaction txn {};
+
+    txn.pDevice = this;
+    txn.pWrite = pWrite;
+    txn.nWrite = nWrite;
+    txn.pRead = pRead;
+    txn.nRead = nRead;
+
+    if (this->m_pBus != nullptr)
+        return this->m_pBus->execute(&txn);
+
+    std::uint32_t const tStart = micros();
+    Status const status = transfer(this->m_wire, &txn);
+    complete(&txn, status, micros() - tStart);
+    return status == Status::kDone;
+    }
+
+bool cI2cBus::cDevice::submit(
+    Transaction &txn,
+    const std::uint8_t *pWrite, std::uint8_t nWrite,
+    std::uint8_t *pRead, std::uint8_t nRead,
+    DoneFn *pDoneFn, void *pUserData
+    )
+    {
+    if (txn.isPending())
+        return false;
+
+    txn.pDevice = this;
+    txn.pWrite = pWrite;
+    txn.nWrite = nWrite;
+    txn.pRead = pRead;
+    txn.nRead = nRead;
+    txn.pDoneFn = pDoneFn;
+    txn.pUserData = pUserData;
+    txn.pNext = nullptr;
+    txn.status = Status::kIdle;
+
+    if (this->m_pBus != nullptr)
+        return this->m_pBus->submit(&txn);
+
+    // no bus: run it now.
+    std::uint32_t const tStart = micros();
+    Status const status = transfer(this->m_wire, &txn);
+    complete(&txn, status, micros() - tStart);
+    return true;
+    }
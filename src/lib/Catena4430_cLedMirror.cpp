@@ -0,0 +1,156 @@
+/*
+
+Module: Catena4430_cLedMirror.cpp
+
+Function:
+    The Catena4430 library: implementation for the LED mirror
+
+Copyright:
+    See accompanying LICENSE file for copyright and license information.
+
+Author:
+    Terry Moore, MCCI Corporation   May 2021
+
+*/
+
+#include "../Catena4430_cLedMirror.h"
+
+#include <Arduino.h>
+#include <CatenaBase.h>
+
+using namespace McciCatena4430;
+using namespace McciCatena;
+
+cLedMirror *cLedMirror::s_pActive;
+
+void cLedMirror::isr()
+    {
+    cLedMirror * const pThis = s_pActive;
+
+    if (pThis != nullptr)
+        {
+        ++pThis->m_stats.nInterrupts;
+        pThis->m_fChanged = true;
+        }
+    }
+
+bool cLedMirror::begin(McciCatena::CatenaBase& rCatena)
+    {
+    // if already up, do nothing.
+    if (this->m_fActive)
+        return true;
+
+    if (s_pActive != nullptr)
+        return false;
+
+    s_pActive = this;
+    this->m_fActive = true;
+    this->m_fFeeder0Connected = false;
+    this->m_fFeeder1Connected = false;
+
+    attachInterrupt(digitalPinToInterrupt(kPirData), isr, CHANGE);
+    attachInterrupt(digitalPinToInterrupt(kFeeder0), isr, CHANGE);
+    attachInterrupt(digitalPinToInterrupt(kFeeder1), isr, CHANGE);
+
+    // pick up the current state of the inputs.
+    this->requestUpdate();
+
+    // set up for polling.
+    if (! this->m_fRegistered)
+        {
+        this->m_fRegistered = true;
+        rCatena.registerObject(this);
+        }
+
+    return true;
+    }
+
+void cLedMirror::end()
+    {
+    if (! this->m_fActive)
+        return;
+
+    detachInterrupt(digitalPinToInterrupt(kPirData));
+    detachInterrupt(digitalPinToInterrupt(kFeeder0));
+    detachInterrupt(digitalPinToInterrupt(kFeeder1));
+
+    this->m_fActive = false;
+    this->m_fChanged = false;
+    s_pActive = nullptr;
+
+    this->m_gpios->setBlue(false);
+    this->m_gpios->setGreen(false);
+    this->m_gpios->setRed(false);
+    this->m_gpios->flush();
+    }
+
+void cLedMirror::setDisabled(bool fDisabled)
+    {
+    if (fDisabled)
+        {
+        // forget the feeders, so they have to show up again.
+        this->m_fFeeder0Connected = false;
+        this->m_fFeeder1Connected = false;
+        }
+
+    if (fDisabled != this->m_fDisabled)
+        {
+        this->m_fDisabled = fDisabled;
+        this->requestUpdate();
+        }
+    }
+
+void cLedMirror::setLowLight(bool fLowLight)
+    {
+    if (fLowLight != this->m_fLowLight)
+        {
+        this->m_fLowLight = fLowLight;
+        this->requestUpdate();
+        }
+    }
+
+void cLedMirror::poll() /* override */
+    {
+    if (! this->isPending())
+        return;
+
+    if (std::uint32_t(millis() - this->m_lastUpdateMs) < kMinUpdateMs)
+        return;
+
+    // clear the flag first, so a change while we read isn't lost.
+    this->m_fChanged = false;
+    this->update();
+    }
+
+void cLedMirror::update()
+    {
+    this->m_lastUpdateMs = millis();
+    ++this->m_stats.nUpdates;
+
+    bool const fPir = digitalRead(kPirData);
+    bool const fFeeder0 = digitalRead(kFeeder0);
+    bool const fFeeder1 = digitalRead(kFeeder1);
+
+    if (this->m_fDisabled)
+        {
+        this->m_gpios->setBlue(fPir && ! this->m_fLowLight);
+        this->m_gpios->setGreen(false);
+        this->m_gpios->setRed(false);
+        }
+    else
+        {
+        // a feeder is connected once its input has been seen low.
+        if (! fFeeder0)
+            this->m_fFeeder0Connected = true;
+        if (! fFeeder1)
+            this->m_fFeeder1Connected = true;
+
+        this->m_gpios->setBlue(fPir);
+        this->m_gpios->setGreen(this->m_fFeeder0Connected && fFeeder0);
+        this->m_gpios->setRed(this->m_fFeeder1Connected && fFeeder1);
+        }
+
+    // one I2C write at most, and none if nothing changed; if there's a
+    // bus manager, it's queued.
+    this->m_gpios->startFlush();
+    }
@@ -21,12 +21,17 @@ bool cPCA9570::begin()
     {
     this->m_wire->begin();
 
-    return this->set(0);
+    // the device must be written even in write-back mode.
+    this->m_regs.invalidate();
+    if (! this->set(0))
+        return false;
+    return this->flush();
     }
 
 void cPCA9570::end()
     {
     (void) this->set(0);
+    (void) this->flush();
     }
 
 bool cPCA9570::modify(std::uint8_t mask, std::uint8_t bits)
@@ -34,34 +39,75 @@ bool cPCA9570::modify(std::uint8_t mask, std::uint8_t bits)
     return this->set((this->get() & ~mask) | (bits & mask));
     }
 
+bool cPCA9570::setPolarity(std::uint8_t mask)
+    {
+    std::uint8_t const value = this->get();
+
+    this->m_inversion = (~mask) & kActiveBits;
+    this->m_regs.put(kReg::Output, value ^ this->m_inversion);
+    return true;
+    }
+
 bool cPCA9570::set(std::uint8_t value)
     {
-    int error;
+    ++this->m_stats.nRequests;
+    this->m_regs.put(kReg::Output, (value & kActiveBits) ^ this->m_inversion);
 
-    this->m_wire->beginTransmission(this->m_i2caddr);
-    this->m_wire->write((value & kActiveBits) ^ this->m_inversion);
-    error = this->m_wire->endTransmission();
+    if (this->m_fWriteBack)
+        return true;
 
-    if (error != 0)
-        return false;
-    else
-        {
-        this->m_value = value & kActiveBits;
+    return this->flush();
+    }
+
+bool cPCA9570::flush()
+    {
+    // finish any startFlush() first, so it isn't counted twice.
+    this->m_regs.wait();
+
+    // no I2C traffic unless the outputs change.
+    if (! this->m_regs.isDirty())
+        return true;
+
+    ++this->m_stats.nWrites;
+    return this->m_regs.flush();
+    }
+
+bool cPCA9570::startFlush()
+    {
+    // if a write is in progress, flushDone() starts the next one.
+    if (! this->m_regs.isDirty() || this->m_regs.isBusy())
         return true;
-        }
+
+    ++this->m_stats.nWrites;
+    return this->m_regs.startFlush(flushDone, this);
     }
 
-bool cPCA9570::read(std::uint8_t &value) const
+void cPCA9570::flushDone(void *pUserData, bool fSuccess)
     {
-    unsigned nRead;
+    auto const pThis = static_cast<cPCA9570 *>(pUserData);
 
-    nRead = this->m_wire->requestFrom(this->m_i2caddr, uint8_t(1));
+    // outputs set while the write was queued are still dirty; write
+    // them now, rather than leaving them until the next change. After
+    // a failure, they wait for the next flush.
+    if (fSuccess)
+        (void) pThis->startFlush();
+    }
+
+bool cPCA9570::setWriteBack(bool fWriteBack)
+    {
+    this->m_fWriteBack = fWriteBack;
 
-    if (nRead == 0)
+    if (! fWriteBack)
+        return this->flush();
+
+    return true;
+    }
+
+bool cPCA9570::read(std::uint8_t &value)
+    {
+    if (! this->m_regs.read())
         return false;
-    else
-        {
-        value = (this->m_wire->read() ^ this->m_inversion) & kActiveBits;
-        return true;
-        }
+
+    value = this->get();
+    return true;
     }